@@ -40,11 +40,16 @@ USA.
 #define DRES_LOG_INFO    VM_LOG_INFO
 
 
-#define DRES_MAGIC    ('D'<<24|('R'<<16)|('E'<<8)|'S')
+#define DRES_FORMAT   4                 /* bump on binary format changes */
+#define DRES_MAGIC    ('D'<<24|('R'<<16)|('E'<<8)|('S' + DRES_FORMAT))
 #define DRES_MAX_NAME 128
+#define DRES_ALLOC_MIN 16               /* initial size of growing arrays */
 
 #define DRES_SUFFIX_BINARY "dresc"
 #define DRES_SUFFIX_PLAIN  "dres"
+#define DRES_SUFFIX_NATIVE "dres.so"       /* AOT-compiled targets */
+
+#define DRES_NATIVE_ENV    "DRES_NATIVE"   /* native module path, or off */
 
 
 enum {
@@ -91,6 +96,7 @@ typedef vm_action_t dres_handler_t;
 
 struct dres_s;
 typedef struct dres_s dres_t;
+typedef struct dres_goal_s dres_goal_t;
 
 typedef struct {
     int *ids;                              /* prerequisite IDs */
@@ -310,7 +316,6 @@ typedef struct {
     int   id;                               /* variable ID */
     int   stamp;                            /* last update stamp */
     int   txid;                             /*   of stamp */
-    int   txstamp;                          /* stamp before txid */
     char *name;                             /* variable name */
     int   flags;                            /* DRES_VAR_* */
 } dres_variable_t;
@@ -321,6 +326,24 @@ enum {
 };
 
 
+#define DRES_STATS_NBUCKET 32               /* log2(ns) histogram buckets */
+
+typedef struct {
+    const char         *name;               /* target name */
+    unsigned long       ncheck;             /* # of times checked */
+    unsigned long       nskip;              /* # of times up-to-date */
+    unsigned long       nclean;             /* # of times skipped as clean */
+    unsigned long       nrun;               /* # of times actions run */
+    unsigned long       nfail;              /* # of failed action runs */
+    unsigned long       nerror;             /* # of action runs with error */
+    unsigned long       ngoal;              /* # of updates as a goal */
+    unsigned long       nrollback;          /* # of rolled back updates */
+    unsigned long long  nsec;               /* total action run time */
+    unsigned long long  maxnsec;            /* longest action run time */
+    unsigned long       hist[DRES_STATS_NBUCKET]; /* runs by log2(ns) */
+} dres_target_stats_t;
+
+
 typedef struct {
     int            id;                      /* target ID */
     char          *name;                    /* target name */
@@ -329,7 +352,6 @@ typedef struct {
     vm_chunk_t    *code;                    /* VM code */
     int            stamp;                   /* last update stamp */
     int            txid;                    /* of stamp */
-    int            txstamp;                 /* stamp before txid */
     int           *dependencies;            /* sorted depedencies */
 } dres_target_t;
 
@@ -341,10 +363,29 @@ typedef struct {
 } dres_graph_t;
 
 
+typedef struct {
+    char *name;                             /* symbol name, NULL if unused */
+    int   idx;                              /* target or variable index */
+} dres_symbol_t;
+
+typedef struct {
+    dres_symbol_t *symbols;                 /* open-addressed hash table */
+    int            nsymbol;                 /* table size, a power of 2 */
+    int            nused;                   /* # of symbols in the table */
+} dres_symtab_t;
+
+typedef struct {
+    int id;                                 /* target or dresvar ID */
+    int stamp;                              /* stamp to restore */
+    int txid;                               /* txid to restore */
+} dres_touched_t;
+
 typedef struct dres_store_s {
     OhmFactStore     *fs;                   /* fact store of our globals */
     OhmFactStoreView *view;                 /* to track our globals */
-    GHashTable       *ht;                   /* hash table of our globals */
+    GHashTable       *ht;                   /* fact name quark -> var ID */
+    unsigned int      gen;                  /* bumped on fact store changes */
+    unsigned int      checked;              /* gen at last check */
 } dres_store_t;
 
 
@@ -354,6 +395,9 @@ enum {
     DRES_TARGETS_FINALIZED  = 0x2,          /* sorted dependency graph */
     DRES_TRANSACTION_ACTIVE = 0x4,          /* has an active transaction */
     DRES_COMPILED           = 0x8,          /* compiled dres buffer */
+    DRES_TRANSACTION_FAILED = 0x10,         /* transaction cannot commit */
+    DRES_NO_FOLDING         = 0x20,         /* compile without folding */
+    DRES_NO_PROPAGATION     = 0x40,         /* check every target */
 };
 
 #define DRES_TST_FLAG(d, f) ((d)->flags &   DRES_##f)
@@ -368,20 +412,53 @@ struct dres_s {
     int              nfactvar;
     dres_variable_t *dresvars;
     int              ndresvar;
+    int              maxtarget;             /* allocated size of targets */
+    int              maxfactvar;            /*   of factvars */
+    int              maxdresvar;            /*   of dresvars */
+    dres_symtab_t    tsymtab;               /* target names */
+    dres_symtab_t    fsymtab;               /* factvar names */
+    dres_symtab_t    dsymtab;               /* dresvar names */
     dres_store_t     store;
     
     int              stamp;
-    int              txid;                  /* transaction id */
+    int              txid;                  /* transaction/savepoint id */
+    dres_touched_t  *touched;               /* stamps changed in transaction */
+    int              ntouched;              /* # of changed stamps */
+    int              maxtouched;            /* allocated size of touched */
 
     dres_handler_t   fallback;
     unsigned long    flags;
     
     dres_initializer_t *initializers;
     
+    dres_target_stats_t *tstats;            /* per-target statistics */
+    void                *native;            /* native code module, if any */
+
+    dres_prereq_t       *depends;           /* reversed prerequisites */
+    unsigned char       *dirty;             /* possibly outdated targets */
+
     vm_state_t         vm;
 };
 
 
+/*
+ * VM execution statistics (see dres_vm_stats_get)
+ */
+
+typedef struct {
+    const char         *name;                      /* opcode/method name */
+    unsigned long long  count;                     /* # of executions */
+    unsigned long long  nsec;                      /* total time in ns */
+} dres_vm_counter_t;
+
+typedef struct {
+    dres_vm_counter_t *opcodes;                    /* executed opcodes */
+    int                nopcode;                    /* # of opcodes */
+    dres_vm_counter_t *methods;                    /* called methods */
+    int                nmethod;                    /* # of methods */
+} dres_vm_stats_t;
+
+
 typedef struct {
     u_int32_t magic;                               /* DRES_MAGIC */
     u_int32_t ssize;                               /* string table size */
@@ -394,6 +471,8 @@ typedef struct {
     u_int32_t ninit;                               /* # of initializers */
     u_int32_t nfield;                              /* # of fields */
     u_int32_t nmethod;                             /* # of methods */
+    u_int32_t nfieldname;                          /* # of field names */
+    u_int32_t nsymbol;                             /* # of symbol slots */
 } dres_header_t;
 
 typedef struct {
@@ -445,6 +524,39 @@ typedef vm_log_level_t dres_log_level_t;
 void dres_set_logger(void (*logger)(dres_log_level_t, const char *, va_list));
 dres_log_level_t dres_set_log_level(dres_log_level_t level);
 
+typedef enum {
+    DRES_EXEC_DEFAULT   = VM_EXEC_DEFAULT,   /* native code or interpreter */
+    DRES_EXEC_INTERPRET = VM_EXEC_INTERPRET, /* interpreter only */
+    DRES_EXEC_JIT       = VM_EXEC_JIT,       /* native code or JIT */
+} dres_exec_mode_t;
+
+int dres_set_exec_mode(dres_t *dres, dres_exec_mode_t mode);
+int dres_set_folding  (dres_t *dres, int enabled);
+int dres_set_propagation(dres_t *dres, int enabled);
+
+
+/* stats.c */
+int  dres_vm_stats_get  (dres_t *dres, dres_vm_stats_t *stats);
+void dres_vm_stats_free (dres_vm_stats_t *stats);
+void dres_vm_stats_reset(dres_t *dres);
+
+int  dres_target_stats_get  (dres_t *dres,
+                             dres_target_stats_t **stats, int *nstat);
+void dres_target_stats_free (dres_target_stats_t *stats);
+void dres_target_stats_reset(dres_t *dres);
+
+dres_target_stats_t *dres_target_stats(dres_t *dres, dres_target_t *target);
+void dres_target_stats_run (dres_t *dres, dres_target_t *target,
+                            int status, unsigned long long nsec);
+void dres_target_stats_exit(dres_t *dres);
+
+
+/* native.c */
+int  dres_native_open (dres_t *dres, const char *file);
+int  dres_native_bind (dres_t *dres);
+void dres_native_close(dres_t *dres);
+int  dres_native_emit (dres_t *dres, const char *source, FILE *fp);
+
 
 /* target.c */
 int            dres_add_target   (dres_t *dres, char *name);
@@ -482,6 +594,15 @@ int  dres_save_dresvars(dres_t *dres, dres_buf_t *buf);
 int  dres_load_dresvars(dres_t *dres, dres_buf_t *buf);
 
 
+/* symtab.c */
+int  dres_symtab_add   (dres_symtab_t *st, char *name, int idx);
+int  dres_symtab_lookup(dres_symtab_t *st, const char *name);
+void dres_symtab_free  (dres_symtab_t *st);
+int  dres_symtab_save  (dres_symtab_t *st, dres_buf_t *buf);
+int  dres_symtab_load  (dres_symtab_t *st, dres_buf_t *buf,
+                        void *base, int nentry, size_t size, size_t offs);
+
+
 
 /* prereq.c */
 dres_prereq_t *dres_new_prereq (int id);
@@ -510,6 +631,7 @@ dres_handler_t dres_fallback_handler(dres_t *dres, dres_handler_t handler);
 void dres_dump_statement(dres_t *dres, dres_stmt_t *stmt, int level);
 void dres_free_statement(dres_stmt_t *stmt);
 void dres_free_expr(dres_expr_t *expr);
+dres_stmt_t *dres_fold_statement(dres_stmt_t *stmts);
 
 
 /* compiler.c */
@@ -546,7 +668,21 @@ int   dres_print_varref(dres_t *dres, dres_varref_t *v, char *buf, size_t size);
 int  *dres_sort_graph(dres_t *dres, dres_graph_t *graph);
 void  dres_dump_sort(dres_t *dres, int *list);
 
+int  dres_build_depends(dres_t *dres);
+void dres_free_depends (dres_t *dres);
+void dres_mark_depends (dres_t *dres, int id);
+void dres_mark_dirty   (dres_t *dres, int tid);
+void dres_clear_dirty  (dres_t *dres, int tid);
+
+#define DRES_IS_DIRTY(dres, tid) \
+    ((dres)->dirty == NULL || (dres)->dirty[DRES_INDEX(tid)])
+
 int dres_update_goal(dres_t *dres, char *goal, char **locals);
+int dres_update_goals(dres_t *dres, char **goals, char **locals);
+
+dres_goal_t *dres_prepare_goal   (dres_t *dres, char *goal, char **locals);
+int          dres_update_prepared(dres_goal_t *goal, dres_value_t *values);
+void         dres_free_prepared  (dres_goal_t *goal);
 
 dres_handler_t dres_lookup_handler(dres_t *dres, char *name);
 
@@ -561,11 +697,16 @@ int  dres_store_init (dres_t *dres);
 void dres_store_free (dres_t *dres);
 int  dres_store_track(dres_t *dres);
 int  dres_store_check(dres_t *dres);
+void dres_cache_stats(dres_t *dres, unsigned int *nhit, unsigned int *nmiss);
 
 int  dres_store_tx_new     (dres_t *dres);
 int  dres_store_tx_commit  (dres_t *dres);
 int  dres_store_tx_rollback(dres_t *dres);
 
+int  dres_store_tx_savepoint  (dres_t *dres);
+void dres_store_tx_rollback_to(dres_t *dres, int savepoint);
+void dres_store_tx_touch      (dres_t *dres, int id, int stamp, int txid);
+
 
 
 /* 
@@ -24,8 +24,8 @@ USA.
 #define __DRES_VM_H__
 
 #include <string.h>
-#include <setjmp.h>
 #include <stdint.h>
+#include <time.h>
 
 #include <ohm/ohm-fact.h>
 
@@ -74,6 +74,7 @@ typedef enum {
     VM_TYPE_LOCAL,                            /* local variables */
     VM_TYPE_FACTS,                            /* an array of facts */
     VM_TYPE_GLOBAL = VM_TYPE_FACTS,           /* globals are facts */
+    VM_TYPE_FIELD,                            /* an interned field name */
 } vm_type_t;
 
 
@@ -91,37 +92,146 @@ typedef struct vm_global_s {
 } vm_global_t;
 
 
+/*
+ * source and destination facts grouped by key fields (see vm_global_join)
+ */
+
+#define VM_JOIN_NOMATCH    (-1)               /* no matching destination */
+#define VM_JOIN_NOFIELD(i) (-2 - (i))         /* source lacks key field #i */
+#define VM_JOIN_FIELD(g)   (-2 - (g))         /* key field lacking */
+
+typedef struct {
+    int *group;                               /* group of source facts */
+    int *first;                               /* first destination of group */
+    int *next;                                /* next destination in group */
+} vm_join_t;
+
+
 typedef union vm_value_s {
     double       d;                           /* VM_TYPE_DOUBLE  */
     int          i;                           /* VM_TYPE_INTEGER */
     char        *s;                           /* VM_TYPE_STRING */
     vm_global_t *g;                           /* VM_TYPE_GLOBAL */
+    GQuark       q;                           /* VM_TYPE_FIELD */
 } vm_value_t;
 
 
 typedef struct vm_stack_entry_s {
-    vm_value_t v;                             /* actual value on the stack */
+    vm_value_t v;                             /* actual value */
     int        type;                          /* type of the value */
-} vm_stack_entry_t;
+} vm_stack_entry_t;                           /* unpacked, for handlers */
+
+
+/*
+ * compact tagged values
+ *
+ * The stack and local variable scopes keep values NaN-boxed in 64 bits.
+ * Doubles are stored as such, with NaNs canonicalized to a single positive
+ * quiet NaN. Everything else lives in the negative NaN space: the top 16
+ * bits are VM_TAG_BASE + type + 1, the low 48 bits carry the payload (a
+ * 32-bit integer, a quark or a pointer). Pointers are assumed to fit into
+ * 48 bits which holds for the user space of all our targets.
+ *
+ * Method handlers still get their arguments and return their results as
+ * vm_stack_entry_t's, vm_method_call packs and unpacks these.
+ */
+
+typedef uint64_t vm_tagged_t;
+
+#define VM_TAG_SHIFT    48
+#define VM_TAG_BASE     0xfff0U
+#define VM_TAG_PAYLOAD  ((UINT64_C(1) << VM_TAG_SHIFT) - 1)
+#define VM_TAG_NAN      UINT64_C(0x7ff8000000000000)
+
+#define VM_TAGGED(type, payload)                                        \
+    (((vm_tagged_t)(VM_TAG_BASE + (type) + 1) << VM_TAG_SHIFT) |        \
+     ((vm_tagged_t)(payload) & VM_TAG_PAYLOAD))
+#define VM_TAGGED_UNKNOWN VM_TAGGED(VM_TYPE_UNKNOWN, 0)
+
+#define VM_TAGGED_IS_DOUBLE(t) (((t) >> VM_TAG_SHIFT) <= VM_TAG_BASE)
+#define VM_TAGGED_TYPE(t)                                               \
+    (VM_TAGGED_IS_DOUBLE(t) ? VM_TYPE_DOUBLE :                          \
+     (int)(((t) >> VM_TAG_SHIFT) - VM_TAG_BASE - 1))
+#define VM_TAGGED_INT(t)   ((int)(uint32_t)(t))
+#define VM_TAGGED_QUARK(t) ((GQuark)(t))
+#define VM_TAGGED_PTR(t)   ((void *)(uintptr_t)((t) & VM_TAG_PAYLOAD))
+
+static inline vm_tagged_t
+vm_tag(int type, vm_value_t value)
+{
+    union { double d; vm_tagged_t t; } u;
+
+    switch (type) {
+    case VM_TYPE_INTEGER:
+        return VM_TAGGED(type, (uint32_t)value.i);
+    case VM_TYPE_DOUBLE:
+        if (value.d != value.d)
+            return VM_TAG_NAN;
+        u.d = value.d;
+        return u.t;
+    case VM_TYPE_STRING:
+        return VM_TAGGED(type, (uintptr_t)value.s);
+    case VM_TYPE_GLOBAL:
+        return VM_TAGGED(type, (uintptr_t)value.g);
+    case VM_TYPE_FIELD:
+        return VM_TAGGED(type, value.q);
+    default:
+        return VM_TAGGED(type, 0);
+    }
+}
+
+static inline int
+vm_untag(vm_tagged_t t, vm_value_t *value)
+{
+    union { double d; vm_tagged_t t; } u;
+    int type = VM_TAGGED_TYPE(t);
+
+    switch (type) {
+    case VM_TYPE_INTEGER: value->i = VM_TAGGED_INT(t);   break;
+    case VM_TYPE_DOUBLE:  u.t = t; value->d = u.d;       break;
+    case VM_TYPE_STRING:  value->s = VM_TAGGED_PTR(t);   break;
+    case VM_TYPE_GLOBAL:  value->g = VM_TAGGED_PTR(t);   break;
+    case VM_TYPE_FIELD:   value->q = VM_TAGGED_QUARK(t); break;
+    default:                                             break;
+    }
+
+    return type;
+}
 
 
 typedef struct vm_stack_s {
-    vm_stack_entry_t *entries;                /* actual stack entries */
-    int               nentry;                 /* top of the stack */
-    int               nalloc;                 /* size of the stack */
+    vm_tagged_t *entries;                     /* actual stack entries */
+    int          nentry;                      /* top of the stack */
+    int          nalloc;                      /* size of the stack */
 } vm_stack_t;
 
 
 #define VM_LOCAL_INDEX(id) ((id)&0x00ffffff)  /* XXX TODO DRES_INDEX(id) */
 
 
-typedef struct vm_scope_s vm_scope_t;
+/*
+ * Local variables are kept in a single flat table of current values. Every
+ * assignment in a scope saves the overwritten value in an undo log and
+ * popping a scope replays the log back to where it was when the scope was
+ * pushed. A local unset in the innermost scope thus reads through to the
+ * closest enclosing scope that has set it, like with nested tables.
+ */
+
+typedef struct {
+    unsigned int      idx;                    /* variable index */
+    vm_tagged_t       value;                  /* value to restore */
+} vm_undo_t;
 
-struct vm_scope_s {
-    vm_scope_t       *parent;                 /* parent scope */
+typedef struct {
+    vm_tagged_t      *variables;              /* current variable values */
     unsigned int      nvariable;              /* number of variables */
-    vm_stack_entry_t  variables[0];           /* variable table */
-};
+    vm_undo_t        *undo;                   /* undo log */
+    int               nundo;                  /* undo log length */
+    int               nundoslot;              /* allocated undo entries */
+    int              *marks;                  /* undo log length per scope */
+    int               depth;                  /* number of active scopes */
+    int               nmarkslot;              /* allocated scope marks */
+} vm_scope_t;
 
 
 /*
@@ -143,6 +253,7 @@ typedef enum {
     VM_OP_DEBUG,                              /* VM debugging */
     VM_OP_HALT,                               /* stop VM execution */
     VM_OP_REPLACE,                            /* global replacement */
+    VM_OP_LOAD,                               /* filtered global/field load */
     VM_OP_MAXCODE = 0xff
 } vm_opcode_t;
 
@@ -193,8 +304,7 @@ typedef enum {
         int           n   = VM_ALIGN_TO_INSTR(len);                     \
         uintptr_t     instr[1 + n];                                     \
         instr[0] = VM_PUSH_INSTR(VM_TYPE_STRING, len);                  \
-        strcpy((char *)(instr + 1), val);                               \
-        /* could pad here with zeros if (len & 0x3) */                  \
+        strncpy((char *)(instr + 1), val, n * sizeof(uintptr_t));       \
         ec = vm_chunk_add(c, instr, 1, sizeof(instr));                  \
         if (ec)                                                         \
             goto errlbl;                                                \
@@ -205,8 +315,7 @@ typedef enum {
         int           n   = VM_ALIGN_TO_INSTR(len);                     \
         uintptr_t     instr[1 + n];                                     \
         instr[0] = VM_PUSH_INSTR(VM_TYPE_GLOBAL, len);                  \
-        strcpy((char *)(instr + 1), val);                               \
-        /* could pad here with zeros if (len & 0x3) */                  \
+        strncpy((char *)(instr + 1), val, n * sizeof(uintptr_t));       \
         ec = vm_chunk_add(c, instr, 1, sizeof(instr));                  \
         if (ec)                                                         \
             goto errlbl;                                                \
@@ -219,6 +328,14 @@ typedef enum {
         if (ec)                                                         \
             goto errlbl;                                                \
     } while (0)
+
+#define VM_INSTR_PUSH_FIELD(c, errlbl, ec, id) do {                     \
+        uintptr_t instr;                                                \
+        instr = VM_PUSH_INSTR(VM_TYPE_FIELD, id);                       \
+        ec = vm_chunk_add(c, &instr, 1, sizeof(instr));                 \
+        if (ec)                                                         \
+            goto errlbl;                                                \
+    } while (0)
     
 
 /*
@@ -296,6 +413,76 @@ enum {
     } while (0)
 
 
+/*
+ * LOAD instructions
+ *
+ * LOAD fuses PUSH GLOBAL, a FILTER with constant selector values and
+ * optionally a GET FIELD into a single instruction. The instruction word
+ * is followed by the length and name of the global, then by a table of
+ * selectors. Each selector is a word with the relational operator, the
+ * type of the value and the field index, followed by the value itself:
+ * one word for integers, an aligned double, or the length and the
+ * aligned string.
+ */
+
+#define VM_LOAD_NSELECT(instr) (VM_OP_ARGS(instr) & 0xff)
+#define VM_LOAD_FIELD(instr)   ((int)(VM_OP_ARGS(instr) >> 8) - 1)
+#define VM_LOAD_INSTR(n, f)                                             \
+    VM_INSTR(VM_OP_LOAD, ((n) & 0xff) | ((uintptr_t)((f) + 1) << 8))
+
+#define VM_LOAD_MAX_SELECT 0xff               /* max. selectors per LOAD */
+#define VM_LOAD_MAX_FIELD  0xfffe             /* max. field index */
+
+#define VM_SELECT_RELOP(w) ((w) & 0xff)
+#define VM_SELECT_TYPE(w)  (((w) >> 8) & 0xff)
+#define VM_SELECT_FIELD(w) ((int)(((w) >> 16) & 0x7fffffff))
+#define VM_SELECT_WORD(relop, type, field)                              \
+    (((relop) & 0xff) | (((type) & 0xff) << 8) | ((uintptr_t)(field) << 16))
+
+#define VM_INSTR_LOAD(c, errlbl, ec, name, nselect, field) do {         \
+        int           len = strlen(name) + 1;                           \
+        int           n   = VM_ALIGN_TO_INSTR(len);                     \
+        uintptr_t     instr[2 + n];                                     \
+        instr[0] = VM_LOAD_INSTR(nselect, field);                       \
+        instr[1] = len;                                                 \
+        strncpy((char *)(instr + 2), name, n * sizeof(uintptr_t));      \
+        ec = vm_chunk_add(c, instr, 1, sizeof(instr));                  \
+        if (ec)                                                         \
+            goto errlbl;                                                \
+    } while (0)
+
+#define VM_INSTR_SELECT_INT(c, errlbl, ec, relop, field, val) do {      \
+        uintptr_t instr[2];                                             \
+        instr[0] = VM_SELECT_WORD(relop, VM_TYPE_INTEGER, field);       \
+        instr[1] = (uintptr_t)(intptr_t)(val);                          \
+        ec = vm_chunk_add(c, instr, 0, sizeof(instr));                  \
+        if (ec)                                                         \
+            goto errlbl;                                                \
+    } while (0)
+
+#define VM_INSTR_SELECT_DOUBLE(c, errlbl, ec, relop, field, val) do {   \
+        uintptr_t instr[1 + VM_ALIGN_TO_INSTR(sizeof(double))];         \
+        double   *dp = (double *)&instr[1];                             \
+        instr[0] = VM_SELECT_WORD(relop, VM_TYPE_DOUBLE, field);        \
+        *dp      = val;                                                 \
+        ec = vm_chunk_add(c, instr, 0, sizeof(instr));                  \
+        if (ec)                                                         \
+            goto errlbl;                                                \
+    } while (0)
+
+#define VM_INSTR_SELECT_STRING(c, errlbl, ec, relop, field, val) do {   \
+        int           len = strlen(val) + 1;                            \
+        int           n   = VM_ALIGN_TO_INSTR(len);                     \
+        uintptr_t     instr[2 + n];                                     \
+        instr[0] = VM_SELECT_WORD(relop, VM_TYPE_STRING, field);        \
+        instr[1] = len;                                                 \
+        strncpy((char *)(instr + 2), val, n * sizeof(uintptr_t));       \
+        ec = vm_chunk_add(c, instr, 0, sizeof(instr));                  \
+        if (ec)                                                         \
+            goto errlbl;                                                \
+    } while (0)
+
+
 /*
  * CREATE instructions
  */
@@ -468,8 +655,7 @@ typedef enum {
         int           n   = VM_ALIGN_TO_INSTR(len);                     \
         uintptr_t     instr[1 + n];                                     \
         instr[0] = VM_DEBUG_INSTR(len);                                 \
-        strcpy((char *)(instr + 1), val);                               \
-        /* could pad here with zeros if (len & 0x3) */                  \
+        strncpy((char *)(instr + 1), val, n * sizeof(uintptr_t));       \
         ec = vm_chunk_add(c, instr, 1, sizeof(instr));                  \
         if (ec)                                                         \
             goto errlbl;                                                \
@@ -491,15 +677,44 @@ typedef enum {
 
 
 
+/*
+ * decoded VM instructions
+ */
+
+typedef struct vm_op_s vm_op_t;
+
+struct vm_op_s {
+    int           code;                      /* opcode */
+    int           type;                      /* PUSH/BRANCH type, partial */
+    int           arg;                       /* opcode-specific argument */
+    int           size;                      /* encoded size in words */
+    union {
+        int       i;                         /* PUSH INTEGER */
+        double    d;                         /* PUSH DOUBLE */
+        char     *s;                         /* PUSH STRING/GLOBAL, DEBUG */
+        vm_op_t  *branch;                    /* BRANCH target */
+    } imm;
+};
+
+
 /*
  * a chunk of VM instructions
  */
 
+struct vm_state_s;
+
 typedef struct vm_chunk_s {
     uintptr_t    *instrs;                    /* actual VM instructions */
     int           ninstr;                    /* number of instructions */
     int           nsize;                     /* code size in bytes */
     int           nleft;                     /* number of bytes free */
+    vm_op_t      *ops;                       /* decoded instructions */
+    int           nop;                       /* number of decoded ones */
+    int           maxdepth;                  /* max. stack depth, or -1 */
+    int           verified;                  /* passed vm_chunk_verify */
+    int         (*native)(struct vm_state_s *vm); /* AOT-compiled code */
+    int         (*jit)(struct vm_state_s *vm);    /* JIT-compiled code */
+    int           njit;                      /* JIT code size, < 0 failed */
 } vm_chunk_t;
 
 
@@ -519,12 +734,54 @@ typedef struct vm_method_s {
 } vm_method_t;
 
 
+/*
+ * VM execution statistics
+ *
+ * Notes: Statistics are only collected if libdres has been configured with
+ *        --enable-vm-statistics. Otherwise the accounting macros expand to
+ *        nothing and the interpreter loops are left untouched. Times are
+ *        inclusive: a CALL includes the time spent in the method, which in
+ *        turn includes any nested VM execution triggered by the method.
+ */
+
+typedef struct {
+    unsigned long long  count;                /* number of executions */
+    unsigned long long  nsec;                 /* total time in nanoseconds */
+} vm_counter_t;
+
+typedef struct {
+    vm_counter_t  opcodes[VM_OP_MAXCODE + 1]; /* per-opcode counters */
+    vm_counter_t *methods;                    /* per-method counters */
+    int           nmethod;                    /* number of method counters */
+} vm_stats_t;
+
+#ifdef DRES_VM_STATISTICS
+#  define VM_STATS_START(t)        unsigned long long t = vm_stats_now()
+#  define VM_STATS_OPCODE(vm, code, t)                          \
+    vm_stats_update((vm)->stats->opcodes + (code), t)
+#  define VM_STATS_METHOD(vm, id, t) do {                       \
+        vm_counter_t *__c = vm_stats_method((vm), (id));        \
+        if (__c != NULL)                                        \
+            vm_stats_update(__c, t);                            \
+    } while (0)
+#else
+#  define VM_STATS_START(t)            do { } while (0)
+#  define VM_STATS_OPCODE(vm, code, t) do { } while (0)
+#  define VM_STATS_METHOD(vm, id, t)   do { } while (0)
+#endif
+
+
 /*
  * VM exceptions
  *
- * Notes: Handling exceptions with setjmp/longjmp for our primitive language /
- *        virtual machine is arguably an overkill. However it should keep some
- *        of the underlying code cleaner and easier to extend.
+ * Notes: Instruction handlers return a status that the interpreter loops
+ *        propagate: 0 for success, a negative error code for an exception
+ *        and VM_STATUS_FAIL for silent failure. VM_RAISE and VM_FAIL fill
+ *        in the details of the exception and return the status from the
+ *        function they are used in, which has to return an int status.
+ *        vm_exec logs the exception and cleans up the stack and the scope
+ *        stack. Hence nothing needs to be set up for catching exceptions
+ *        on the normal, error-free, path of execution.
  *
  * Notes: As a convention, methods return a negative error code to signal
  *        an error that should raise an exception. To fail silently without
@@ -544,127 +801,33 @@ typedef struct {
         (e)->context    = NULL;    \
     } while (0)
 
-typedef struct vm_catch_s vm_catch_t;
-struct vm_catch_s {
-    jmp_buf         location;                  /* catch exceptions here */
-    int             depth;                     /* stack depth upon entry */
-    vm_scope_t     *scope;                     /* locals upon entry */
-    vm_exception_t  exception;                 /* exception details */
-    vm_catch_t     *prev;                      /* previous entry if any */
-};
-
+#define VM_STATUS_OK    0                      /* success */
+#define VM_STATUS_FAIL  1                      /* silent failure */
 
-
-/*
- * Notes: This macro implements the calling conventions of the top-level
- *        VM interface vm_exec. A negative status indicates a VM exception.
- *        This will result in an error message and the rollback of the current
- *        DRES transaction. A zero status indicates (silent) failure resulting
- *        in the rollback of the current transaction. Any other status is
- *        interpreted as TRUE, and results in the continued evaluation of the
- *        current DRES goal.
- *
- *        This convention is directly visible at the VM/DRES method handler
- *        level. The handler return value should be crafted according to the
- *        rules above.
- */
-
-#define VM_TRY(vm) ({                                                   \
-        vm_catch_t __catch;                                             \
-        int        __status;                                            \
-                                                                        \
-        VM_RESET_EXCEPTION(&__catch.exception);                         \
-        __catch.prev  = vm->catch;                                      \
-        __catch.depth = vm->stack ? vm->stack->nentry : 0;              \
-        __catch.scope = vm->scope;                                      \
-        vm->catch     = &__catch;                                       \
-                                                                        \
-        if ((__status = setjmp(__catch.location)) != 0) {               \
-            vm_exception_t *e = &__catch.exception;                     \
-                                                                        \
-            if (e->error != 0) {                                        \
-                int         i, type;                                    \
-                vm_value_t  v;                                          \
-                char       *name;                                       \
-                                                                        \
-                VM_ERROR("VM exception %d", __status);                  \
-                if (e->message[0])                                      \
-                    VM_ERROR("  %s", e->message);                       \
-                if (e->context)                                         \
-                    VM_ERROR("  while excecuting %s", e->context);      \
-                                                                        \
-                VM_ERROR("  local variables:");                         \
-                for (i = 0; i < vm->nlocal; i++) {                      \
-                    type = vm_scope_get(vm->scope, i, &v);              \
-                    name = vm->names && vm->names[i] ?                  \
-                        vm->names[i] : "<unknown>";                     \
-                    switch (type) {                                     \
-                    case VM_TYPE_UNKNOWN:                               \
-                    case VM_TYPE_NIL:                                   \
-                        /* VM_ERROR("    0x%x (%s) is unset", i, name);*/ \
-                        break;                                          \
-                    case VM_TYPE_INTEGER:                               \
-                        VM_ERROR("    0x%x (%s): %d", i, name, v.i);    \
-                        break;                                          \
-                    case VM_TYPE_DOUBLE:                                \
-                        VM_ERROR("    0x%x (%s): %f", i, name, v.d);    \
-                        break;                                          \
-                    case VM_TYPE_STRING:                                \
-                        VM_ERROR("    0x%x (%s): '%s'", i, name,        \
-                                 v.s && v.s[0] ? v.s : "");             \
-                        break;                                          \
-                    default:                                            \
-                        VM_ERROR("    0x%x (%s): ???", i, name);        \
-                        break;                                          \
-                    }                                                   \
-                }                                                       \
-            }                                                           \
-            fflush(stdout);                                             \
-                                                                        \
-            if (vm->stack->nentry > __catch.depth) {                    \
-                VM_INFO("cleaning up the stack...");                    \
-                vm_stack_cleanup(vm->stack,                             \
-                                 vm->stack->nentry - __catch.depth);    \
-            }                                                           \
-            if (vm->scope != __catch.scope) {                           \
-                VM_INFO("cleaning up the local/scope stack...");        \
-                while (vm->scope && vm->scope != __catch.scope)         \
-                    vm_scope_pop(vm);                                   \
-            }                                                           \
-                                                                        \
-            vm->catch = vm->catch->prev;                                \
-            __status = e->error;                                        \
-            if (__status > 0)                                           \
-                __status = -__status;                                   \
-        }                                                               \
-        else {                                                          \
-            __status = vm_run(vm);             /* __status = 0 */       \
-            vm->catch = vm->catch->prev;                                \
-            __status = TRUE;                                            \
-        }                                                               \
-        __status;                                                       \
-    })
+/* map an error code to an exception status */
+#define VM_ERROR_STATUS(err)                                            \
+    ((err) > 0 ? -(err) : ((err) < 0 ? (err) : VM_STATUS_FAIL))
 
 /* macro for VM failure with an exception */
 #define VM_RAISE(vm, err, fmt, args...) do {                            \
-        vm_exception_t *e = &vm->catch->exception;                      \
+        vm_exception_t *e = &(vm)->exception;                           \
                                                                         \
         e->error = err;                                                 \
         snprintf(e->message, sizeof(e->message), "%s: VM error: "fmt,   \
                  __FUNCTION__, ## args);                                \
-        e->context = vm->info;                                          \
-        longjmp(vm->catch->location, err);                              \
+        e->context = (vm)->info;                                        \
+        return VM_ERROR_STATUS(e->error);                               \
     } while (0)
 
 /* macro for silent VM failure without an exception (just rollback) */
 #define VM_FAIL(vm, fmt, args...) do {                                  \
-        vm_exception_t *e = &vm->catch->exception;                      \
+        vm_exception_t *e = &(vm)->exception;                           \
                                                                         \
         e->error = 0;                                                   \
         snprintf(e->message, sizeof(e->message), "%s: VM failure: "fmt, \
                  __FUNCTION__, ## args);                                \
-        e->context = vm->info;                                          \
-        longjmp(vm->catch->location, 1);                                \
+        e->context = (vm)->info;                                        \
+        return VM_STATUS_FAIL;                                          \
     } while (0)
 
 
@@ -681,6 +844,17 @@ enum {
 };
 
 
+/*
+ * execution engines
+ */
+
+typedef enum {
+    VM_EXEC_DEFAULT = 0,                      /* AOT code or interpreter */
+    VM_EXEC_INTERPRET,                        /* interpreter only */
+    VM_EXEC_JIT,                              /* AOT code or JIT */
+} vm_exec_mode_t;
+
+
 
 
 /*
@@ -697,17 +871,101 @@ typedef struct vm_state_s {
 
     vm_method_t   *methods;                   /* action handlers */
     int            nmethod;                   /* number of actions */
-    vm_scope_t    *scope;                     /* current local variables */
+    int            nmethodslot;               /* allocated action slots */
+    GHashTable    *methodtbl;                 /* action name to ID + 1 */
+    vm_scope_t     scope;                     /* local variables */
     int            nlocal;                    /* number of local variables */
     char         **names;                     /* names of local variables */
+    GQuark        *fields;                    /* interned field names */
+    int            nfield;                    /* number of field names */
+    int            nfieldslot;                /* allocated field slots */
 
-    vm_catch_t    *catch;                     /* catch exceptions here */
+    GHashTable    *globals;                   /* cached globals by name */
+    unsigned int   nglobalhit;                /* global cache hits */
+    unsigned int   nglobalmiss;               /* global cache misses */
+    GHashTable    *indexes;                   /* field indexes by name */
+    unsigned int   nindexhit;                 /* selections by index */
+
+    vm_exception_t exception;                 /* last exception */
     int            flags;
+    vm_stats_t    *stats;                     /* execution statistics */
+    vm_exec_mode_t mode;                      /* execution engine */
 
     const char    *info;                      /* debug info for current pc */
 } vm_state_t;
 
 
+/*
+ * field indexes
+ *
+ * Notes: An index maps the values of a field of the cached facts with
+ *        a given name to the facts having that value. LOAD uses it for
+ *        an equality selector on the field instead of scanning all the
+ *        facts. Fields get indexed either explicitly or once equality
+ *        selectors have been used often enough on them. Indexes are
+ *        rebuilt lazily from the global cache after the facts change.
+ */
+
+#define VM_INDEX_MIN_USE   4                  /* learn index after # uses */
+#define VM_INDEX_MIN_FACTS 8                  /* don't index fewer facts */
+
+typedef struct vm_index_s vm_index_t;
+
+struct vm_index_s {
+    vm_index_t  *next;                        /* more indexes of the facts */
+    GQuark       field;                       /* indexed field */
+    int          nuse;                        /* equality selections seen */
+    int          type;                        /* type of indexed values */
+    vm_global_t *global;                      /* cached facts indexed */
+    GHashTable  *values;                      /* value to facts */
+};
+
+
+/*
+ * ahead-of-time compiled code (see dresc --emit-c)
+ *
+ * Notes: A native module has one C function per target, translated from
+ *        the bytecode of the target. Every instruction becomes a direct
+ *        call to the corresponding interpreter handler, passed in by the
+ *        library in vm_aot_api_t, and branches become plain C control flow.
+ *        A module is only used if its ABI version and word size match and
+ *        the bytecode it was translated from is identical to the one being
+ *        replaced, including the method and field tables the code refers
+ *        to. Everything else keeps running in the interpreter.
+ */
+
+#define VM_AOT_ABI    1                       /* bump on any VM ABI change */
+#define VM_AOT_SYMBOL "dres_native_module"    /* module descriptor symbol */
+#define VM_AOT_NINSTR (VM_OP_LOAD + 1)        /* size of the handler table */
+
+typedef int (*vm_instr_t) (vm_state_t *vm, vm_op_t *op);
+typedef int (*vm_native_t)(vm_state_t *vm);
+
+typedef struct {
+    int                    abi;               /* VM_AOT_ABI */
+    vm_instr_t             instr[VM_AOT_NINSTR]; /* handlers by opcode */
+} vm_aot_api_t;
+
+typedef struct {
+    const char            *name;              /* target name */
+    unsigned int           checksum;          /* of the source bytecode */
+    int                    nsize;             /* size of source bytecode */
+    vm_native_t            code;              /* translated code */
+} vm_aot_target_t;
+
+typedef struct {
+    int                    abi;               /* VM_AOT_ABI */
+    int                    wordsize;          /* sizeof(uintptr_t) */
+    const char * const    *methods;           /* method names by ID */
+    int                    nmethod;           /* number of methods */
+    const char * const    *fields;            /* field names by index */
+    int                    nfield;            /* number of fields */
+    const vm_aot_target_t *targets;           /* translated targets */
+    int                    ntarget;           /* number of targets */
+    const vm_aot_api_t   **api;               /* API table of the module */
+} vm_aot_module_t;
+
+
 
 
 /* vm-stack.c */
@@ -724,8 +982,9 @@ int vm_push_int   (vm_stack_t *s, int i);
 int vm_push_double(vm_stack_t *s, double d);
 int vm_push_string(vm_stack_t *s, char *str);
 int vm_push_global(vm_stack_t *s, vm_global_t *g);
+int vm_push_field (vm_stack_t *s, GQuark field);
 
-vm_stack_entry_t *vm_args(vm_stack_t *s, int narg);
+vm_tagged_t *vm_args(vm_stack_t *s, int narg);
 
 int         vm_pop (vm_stack_t *s, vm_value_t *value);
 int         vm_peek(vm_stack_t *s, int idx, vm_value_t *value);
@@ -734,6 +993,7 @@ int         vm_pop_int   (vm_stack_t *s);
 double      vm_pop_double(vm_stack_t *s);
 char        *vm_pop_string(vm_stack_t *s);
 vm_global_t *vm_pop_global(vm_stack_t *s);
+GQuark       vm_pop_field (vm_stack_t *s);
 
 
 /* vm-instr.c */
@@ -742,8 +1002,14 @@ void          vm_chunk_del (vm_chunk_t *chunk);
 uintptr_t    *vm_chunk_grow(vm_chunk_t *c, int nsize);
 int           vm_chunk_add (vm_chunk_t *c,
                             uintptr_t *code, int ninstr, int nsize);
+int           vm_chunk_decode  (vm_chunk_t *c);
+int           vm_chunk_depth   (vm_chunk_t *c);
+void          vm_chunk_undecode(vm_chunk_t *c);
+int           vm_chunk_remap_methods(vm_chunk_t *c, int *map, int nmap);
+int           vm_load_size(uintptr_t *pc, int nsize);
 
 int vm_run(vm_state_t *vm);
+int vm_run_traced(vm_state_t *vm);
 
 
 /* vm-method.c */
@@ -765,10 +1031,18 @@ void         vm_free_methods  (vm_state_t *vm);
 int  vm_init(vm_state_t *vm, int stack_size);
 void vm_exit(vm_state_t *vm);
 int  vm_exec(vm_state_t *vm, vm_chunk_t *code);
+int  vm_set_exec_mode(vm_state_t *vm, vm_exec_mode_t mode);
 
 
 /* vm-global.c */
 int          vm_global_lookup(char *name, vm_global_t **gp);
+int          vm_global_cache_init (vm_state_t *vm);
+void         vm_global_cache_exit (vm_state_t *vm);
+void         vm_global_cache_flush(vm_state_t *vm);
+void         vm_global_cache_invalidate(vm_state_t *vm, const char *name);
+int          vm_global_cache_lookup(vm_state_t *vm, char *name,
+                                    vm_global_t **gp);
+vm_global_t *vm_global_cache_peek  (vm_state_t *vm, char *name);
 vm_global_t *vm_global_name  (char *name);
 vm_global_t *vm_global_alloc (int nfact);
 
@@ -787,36 +1061,94 @@ void         vm_fact_remove_instance(OhmFact *fact);
 
 void         vm_fact_insert(OhmFact *fact);
 
-int          vm_fact_set_field  (vm_state_t *vm, OhmFact *fact, char *field,
+int          vm_fact_set_field  (vm_state_t *vm, OhmFact *fact, GQuark field,
                                  int type, vm_value_t *value);
-int          vm_fact_get_field  (vm_state_t *vm, OhmFact *fact, char *field,
+int          vm_fact_get_field  (vm_state_t *vm, OhmFact *fact, GQuark field,
                                  vm_value_t *value);
-int          vm_fact_match_field(vm_state_t *vm, OhmFact *fact, char *field,
+int          vm_fact_match_field(vm_state_t *vm, OhmFact *fact, GQuark field,
                                  GValue *gval, int type, vm_value_t *value);
 
-int          vm_fact_collect_fields(OhmFact *f, char **fields, int nfield,
+int          vm_fact_collect_fields(OhmFact *f, GQuark *fields, int nfield,
                                     GValue **values);
-int          vm_fact_matches       (OhmFact *f, char **fields, GValue **values,
+int          vm_fact_matches       (OhmFact *f, GQuark *fields, GValue **values,
                                     int nfield);
 int          vm_global_find_first(vm_global_t *g,
-                                  char **fields, GValue **values, int nfield);
+                                  GQuark *fields, GValue **values, int nfield);
 int          vm_global_find_next(vm_global_t *g, int idx,
-                                 char **fields, GValue **values, int nfield);
+                                 GQuark *fields, GValue **values, int nfield);
+int          vm_global_join(vm_global_t *src, vm_global_t *dst,
+                            GQuark *fields, int nfield, vm_join_t *join);
+void         vm_join_free  (vm_join_t *join);
+
+int          vm_field_add   (vm_state_t *vm, const char *name);
+const char  *vm_field_name  (vm_state_t *vm, int id);
+void         vm_free_fields (vm_state_t *vm);
 
 void vm_fact_print(FILE *fp, OhmFact *fact);
 
 
+/* vm-index.c */
+int  vm_index_init  (vm_state_t *vm);
+void vm_index_exit  (vm_state_t *vm);
+int  vm_index_add   (vm_state_t *vm, const char *name, const char *field);
+void vm_index_reset (vm_state_t *vm, const char *name, GQuark field);
+int  vm_index_lookup(vm_state_t *vm, char *name, GQuark field, int type,
+                     vm_value_t *value, vm_global_t **gp);
+
+
 /* vm-local.c */
-int vm_scope_push(vm_state_t *vm);
-int vm_scope_pop (vm_state_t *vm);
+int  vm_scope_push(vm_state_t *vm);
+int  vm_scope_pop (vm_state_t *vm);
+void vm_scope_exit(vm_state_t *vm);
 
-int vm_scope_set(vm_scope_t *scope, int id, int type, vm_value_t value);
-int vm_scope_get(vm_scope_t *scope, int id, vm_value_t *value);
+int vm_scope_set(vm_state_t *vm, int id, int type, vm_value_t value);
+int vm_scope_get(vm_state_t *vm, int id, vm_value_t *value);
 
 int  vm_set_varname  (vm_state_t *vm, int id, const char *name);
 void vm_free_varnames(vm_state_t *vm);
 
 
+/* vm-aot.c */
+const vm_aot_api_t *vm_aot_api        (void);
+unsigned int        vm_chunk_checksum (vm_chunk_t *c);
+int                 vm_chunk_emit_c   (vm_chunk_t *c, const char *fn, FILE *fp);
+
+
+/* vm-verify.c */
+int vm_chunk_verify(vm_state_t *vm, vm_chunk_t *c, const char **error);
+
+
+/* vm-jit.c */
+int  vm_jit_available(void);
+int  vm_jit_compile  (vm_chunk_t *c);
+void vm_jit_free     (vm_chunk_t *c);
+
+
+/* vm-stats.c */
+int           vm_stats_init  (vm_state_t *vm);
+void          vm_stats_exit  (vm_state_t *vm);
+void          vm_stats_reset (vm_state_t *vm);
+vm_counter_t *vm_stats_method(vm_state_t *vm, int id);
+const char   *vm_opcode_name (int code);
+
+static inline unsigned long long
+vm_stats_now(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void
+vm_stats_update(vm_counter_t *c, unsigned long long start)
+{
+    c->count++;
+    c->nsec += vm_stats_now() - start;
+}
+
+
 /* vm-debug.c */
 int vm_dump_chunk(vm_state_t *vm, char *buf, size_t size, int indent);
 int vm_dump_instr(uintptr_t **pc, char *buf, size_t size, int indent);
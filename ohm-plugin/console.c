@@ -60,6 +60,8 @@ static void command_release(int id, char *input);
 static void command_debug  (int id, char *input);
 static void command_log    (int id, char *input);
 static void command_statistics(int id, char *input);
+static void vm_statistics(int id, char *input);
+static void target_statistics(int id, char *input);
 
 typedef struct {
     char  *name;
@@ -97,7 +99,7 @@ static command_t commands[] = {
     COMMAND(release, NULL       , "Release any previous grabs."             ),
     COMMAND(debug  , "list|set|rule...", "Configure runtime debugging/tracing."  ),
     COMMAND(log    , "[+|-]{error,info,warning}", "Configure logging level."  ),
-    COMMAND(statistics, NULL, "Print rule evaluation statistics."),
+    COMMAND(statistics, "[vm|targets [reset]]", "Print rule, VM or target statistics."),
     END
 };
 
@@ -695,12 +697,177 @@ command_log(int id, char *input)
 static void
 command_statistics(int id, char *input)
 {
-    (void)id;
+    if (!strncmp(input, "vm", 2) && (input[2] == '\0' || input[2] == ' ')) {
+        vm_statistics(id, input + 2);
+        return;
+    }
+
+    if (!strncmp(input, "targets", 7) && (input[7] == '\0' || input[7] == ' ')) {
+        target_statistics(id, input + 7);
+        return;
+    }
     
     rule_statistics(input);
 }
 
 
+/********************
+ * vm_counter_cmp
+ ********************/
+static int
+vm_counter_cmp(const void *p1, const void *p2)
+{
+    const dres_vm_counter_t *c1 = (const dres_vm_counter_t *)p1;
+    const dres_vm_counter_t *c2 = (const dres_vm_counter_t *)p2;
+
+    if (c1->nsec != c2->nsec)
+        return c1->nsec < c2->nsec ? 1 : -1;
+    else
+        return c1->count < c2->count ? 1 : (c1->count > c2->count ? -1 : 0);
+}
+
+
+/********************
+ * vm_counters_print
+ ********************/
+static void
+vm_counters_print(int id, const char *title, dres_vm_counter_t *c, int n)
+{
+    int i;
+
+    qsort(c, n, sizeof(*c), vm_counter_cmp);
+
+    console_printf(id, "%-32s %12s %14s %10s\n",
+                   title, "count", "total (us)", "avg (ns)");
+    for (i = 0; i < n; i++, c++)
+        console_printf(id, "%-32.32s %12llu %14.1f %10.1f\n", c->name,
+                       c->count, c->nsec / 1000.0,
+                       (double)c->nsec / c->count);
+}
+
+
+/********************
+ * vm_statistics
+ ********************/
+static void
+vm_statistics(int id, char *input)
+{
+    dres_vm_stats_t stats;
+    int             err;
+
+    while (*input == ' ' || *input == '\t')
+        input++;
+
+    if (!strcmp(input, "reset")) {
+        dres_vm_stats_reset(dres);
+        console_printf(id, "VM statistics reset.\n");
+        return;
+    }
+
+    if ((err = dres_vm_stats_get(dres, &stats)) != 0) {
+        if (err == ENOSYS)
+            console_printf(id, "VM statistics are not enabled in libdres "
+                           "(configure with --enable-vm-statistics).\n");
+        else
+            console_printf(id, "failed to get VM statistics (%d: %s)\n",
+                           err, strerror(err));
+        return;
+    }
+
+    if (stats.nopcode == 0 && stats.nmethod == 0)
+        console_printf(id, "No VM statistics collected yet.\n");
+    else {
+        vm_counters_print(id, "opcode", stats.opcodes, stats.nopcode);
+        console_printf(id, "\n");
+        vm_counters_print(id, "method", stats.methods, stats.nmethod);
+    }
+
+    dres_vm_stats_free(&stats);
+}
+
+
+/********************
+ * target_stats_cmp
+ ********************/
+static int
+target_stats_cmp(const void *p1, const void *p2)
+{
+    const dres_target_stats_t *s1 = (const dres_target_stats_t *)p1;
+    const dres_target_stats_t *s2 = (const dres_target_stats_t *)p2;
+
+    if (s1->nsec != s2->nsec)
+        return s1->nsec < s2->nsec ? 1 : -1;
+    else
+        return strcmp(s1->name, s2->name);
+}
+
+
+/********************
+ * target_statistics
+ ********************/
+static void
+target_statistics(int id, char *input)
+{
+    dres_target_stats_t *stats, *s;
+    int                  nstat, err, i, b;
+
+    while (*input == ' ' || *input == '\t')
+        input++;
+
+    if (!strcmp(input, "reset")) {
+        dres_target_stats_reset(dres);
+        console_printf(id, "Target statistics reset.\n");
+        return;
+    }
+
+    if ((err = dres_target_stats_get(dres, &stats, &nstat)) != 0) {
+        console_printf(id, "failed to get target statistics (%d: %s)\n",
+                       err, strerror(err));
+        return;
+    }
+
+    if (nstat == 0) {
+        console_printf(id, "No target statistics collected yet.\n");
+        return;
+    }
+
+    qsort(stats, nstat, sizeof(*stats), target_stats_cmp);
+
+    console_printf(id, "%-24s %7s %7s %7s %7s %5s %5s %7s %5s %12s %10s "
+                   "%10s\n", "target", "checked", "skipped", "clean", "run",
+                   "fail", "error", "goal", "rollb", "total (us)", "avg (us)",
+                   "max (us)");
+    for (i = 0, s = stats; i < nstat; i++, s++) {
+        console_printf(id,
+                       "%-24.24s %7lu %7lu %7lu %7lu %5lu %5lu %7lu %5lu "
+                       "%12.1f %10.1f %10.1f\n", s->name,
+                       s->ncheck, s->nskip, s->nclean, s->nrun, s->nfail,
+                       s->nerror, s->ngoal, s->nrollback, s->nsec / 1000.0,
+                       s->nrun ? s->nsec / 1000.0 / s->nrun : 0.0,
+                       s->maxnsec / 1000.0);
+    }
+
+    console_printf(id, "\naction run time histograms (runs per time range):\n");
+    for (i = 0, s = stats; i < nstat; i++, s++) {
+        if (s->nrun == 0)
+            continue;
+        console_printf(id, "%s:", s->name);
+        for (b = 0; b < DRES_STATS_NBUCKET; b++) {
+            if (s->hist[b] == 0)
+                continue;
+            if ((2ULL << b) < 10000)
+                console_printf(id, " <%lluns:%lu", 2ULL << b, s->hist[b]);
+            else
+                console_printf(id, " <%lluus:%lu", (2ULL << b) / 1000,
+                               s->hist[b]);
+        }
+        console_printf(id, "\n");
+    }
+
+    dres_target_stats_free(stats);
+}
+
+
 /********************
  * command_help
  ********************/
@@ -342,6 +342,65 @@ OHM_EXPORTABLE(int, update_goal, (char *goal, char **locals))
 }
 
 
+/********************
+ * dres/resolve_goals
+ ********************/
+OHM_EXPORTABLE(int, update_goals, (char **goals, char **locals))
+{
+    int status;
+
+    status = dres_update_goals(dres, goals, locals);
+
+    OHM_DEBUG(DBG_RESOLVE, "resolving goals starting with '%s' %s",
+              goals && goals[0] ? goals[0] : "<none>",
+              status > 0 ? "succeeded" :
+              (status == 0 ? "failed" : "failed with an exception"));
+
+    return status;
+}
+
+
+/********************
+ * dres/prepare
+ ********************/
+OHM_EXPORTABLE(dres_goal_t *, prepare_goal, (char *goal, char **locals))
+{
+    dres_goal_t *g;
+
+    if ((g = dres_prepare_goal(dres, goal, locals)) == NULL)
+        OHM_ERROR("dres: failed to prepare goal '%s' (%d: %s)",
+                  goal ? goal : "<default>", errno, strerror(errno));
+    
+    return g;
+}
+
+
+/********************
+ * dres/resolve_prepared
+ ********************/
+OHM_EXPORTABLE(int, update_prepared, (dres_goal_t *goal, dres_value_t *values))
+{
+    int status;
+
+    status = dres_update_prepared(goal, values);
+
+    OHM_DEBUG(DBG_RESOLVE, "resolving prepared goal %s",
+              status > 0 ? "succeeded" :
+              (status == 0 ? "failed" : "failed with an exception"));
+
+    return status;
+}
+
+
+/********************
+ * dres/free_prepared
+ ********************/
+OHM_EXPORTABLE(void, free_prepared, (dres_goal_t *goal))
+{
+    dres_free_prepared(goal);
+}
+
+
 /********************
  * register_method
  ********************/
@@ -999,8 +1058,12 @@ OHM_PLUGIN_DESCRIPTION("dres",
                        plugin_exit,
                        NULL);
 
-OHM_PLUGIN_PROVIDES_METHODS(dres, 5,
+OHM_PLUGIN_PROVIDES_METHODS(dres, 9,
     OHM_EXPORT(update_goal      , "resolve"),
+    OHM_EXPORT(update_goals     , "resolve_goals"),
+    OHM_EXPORT(prepare_goal     , "prepare"),
+    OHM_EXPORT(update_prepared  , "resolve_prepared"),
+    OHM_EXPORT(free_prepared    , "free_prepared"),
     OHM_EXPORT(add_command      , "add_command"),
     OHM_EXPORT(del_command      , "del_command"),
     OHM_EXPORT(register_method  , "register_method"),
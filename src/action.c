@@ -96,14 +96,14 @@ dres_register_handler(dres_t *dres, char *name, dres_handler_t handler)
         /*
          * Notes:
          *   For compiled rulesets, registering a handler for a non-
-         *   existing method is not treated as an error. As the VM is
-         *   never going to attempt to call the method (that is why it
-         *   is non-existent) no harm is done. If we start compiling
-         *   extra code for precompiled rulesets (eg. for the debug
-         *   console) this might need different treatment (eg. the
-         *   introduction of a dynamic method table).
+         *   existing method is not treated as an error. The VM is never
+         *   going to call it from the precompiled code, but we still add
+         *   it to the (dynamic) method table so that it can be looked up
+         *   and called by name.
          */
-        return (status == 0 || status == ENOENT ? 0 : status);
+        if (status == ENOENT)
+            status = vm_method_add(&dres->vm, name, handler, dres);
+        return status;
     }
 }
 
@@ -140,15 +140,20 @@ dres_lookup_handler(dres_t *dres, char *name)
 int
 dres_run_actions(dres_t *dres, dres_target_t *target)
 {
-    int status;
+    unsigned long long start;
+    int                status;
 
     DEBUG(DBG_RESOLVE, "executing actions for %s", target->name);
 
+    start = vm_stats_now();
+
     if (target->code == NULL)
         status = TRUE;
     else
         status = vm_exec(&dres->vm, target->code);
     
+    dres_target_stats_run(dres, target, status, vm_stats_now() - start);
+
     return status;
 }
 
@@ -33,6 +33,7 @@ USA.
 
 static void dump_expr(dres_t *dres, dres_expr_t *expr);
 static void free_expr(dres_expr_t *expr);
+static dres_expr_t *fold_expr(dres_expr_t *expr, int cond);
 
 
 static void
@@ -335,7 +336,365 @@ dres_dump_statement(dres_t *dres, dres_stmt_t *stmt, int level)
 }
 
 
+static int
+expr_is_const(dres_expr_t *expr)
+{
+    if (expr == NULL || expr->type != DRES_EXPR_CONST)
+        return FALSE;
+
+    switch (expr->constant.vtype) {
+    case DRES_TYPE_INTEGER:
+    case DRES_TYPE_DOUBLE:
+    case DRES_TYPE_STRING:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+
+static int
+expr_is_boolean(dres_expr_t *expr)
+{
+    /*
+     * Notes:
+     *   Every relop (including and/or) leaves an integer 0 or 1 on the
+     *   stack, so these can be used in place of their own truth value.
+     */
+
+    if (expr->type == DRES_EXPR_RELOP)
+        return TRUE;
+
+    if (expr->type == DRES_EXPR_CONST &&
+        expr->constant.vtype == DRES_TYPE_INTEGER)
+        return expr->constant.v.i == 0 || expr->constant.v.i == 1;
+    
+    return FALSE;
+}
+
+
+static int
+expr_is_global(dres_expr_t *expr)
+{
+    dres_varref_t *vref;
+
+    if (expr->type != DRES_EXPR_VARREF)
+        return FALSE;
+
+    vref = &expr->varref.ref;
+    
+    return DRES_ID_TYPE(vref->variable) == DRES_TYPE_FACTVAR &&
+        vref->field == NULL;
+}
+
+
+static int
+const_truth(dres_expr_const_t *c)
+{
+    /* this must agree with the VM BRANCH instruction */
+    switch (c->vtype) {
+    case DRES_TYPE_INTEGER: return c->v.i != 0;
+    case DRES_TYPE_DOUBLE:  return c->v.d != 0.0;
+    case DRES_TYPE_STRING:  return c->v.s != NULL && *c->v.s;
+    default:                return FALSE;
+    }
+}
+
+
+static int
+const_not(dres_expr_const_t *c)
+{
+    /* this must agree with the VM CMP instruction for NOT */
+    switch (c->vtype) {
+    case DRES_TYPE_INTEGER: return c->v.i == 0;
+    case DRES_TYPE_DOUBLE:  return c->v.d == 0.0;
+    case DRES_TYPE_STRING:  return c->v.s == NULL;
+    default:                return FALSE;
+    }
+}
+
+
+static int
+const_compare(dres_relop_t op, dres_expr_const_t *c1, dres_expr_const_t *c2)
+{
+    /* this must agree with the VM CMP instruction */
+    int cmp;
+
+    if (c1->vtype != c2->vtype)
+        return FALSE;
+
+    switch (c1->vtype) {
+    case DRES_TYPE_INTEGER:
+        cmp = c1->v.i < c2->v.i ? -1 : (c1->v.i > c2->v.i ? 1 : 0);
+        break;
+    case DRES_TYPE_DOUBLE:
+        if (c1->v.d != c1->v.d || c2->v.d != c2->v.d)     /* NaN */
+            return op == DRES_RELOP_NE;
+        cmp = c1->v.d < c2->v.d ? -1 : (c1->v.d > c2->v.d ? 1 : 0);
+        break;
+    case DRES_TYPE_STRING:
+        cmp = strcmp(c1->v.s, c2->v.s);
+        break;
+    default:
+        return FALSE;
+    }
+
+    switch (op) {
+    case DRES_RELOP_EQ: return cmp == 0;
+    case DRES_RELOP_NE: return cmp != 0;
+    case DRES_RELOP_LT: return cmp <  0;
+    case DRES_RELOP_LE: return cmp <= 0;
+    case DRES_RELOP_GT: return cmp >  0;
+    case DRES_RELOP_GE: return cmp >= 0;
+    default:            return FALSE;
+    }
+}
+
+
+static dres_expr_t *
+replace_expr(dres_expr_t *expr, dres_expr_t *with)
+{
+    /*
+     * Notes:
+     *   Any part of expr that is reused in with must have been unhooked
+     *   from expr by the caller as expr is freed here.
+     */
+    
+    with->any.next = expr->any.next;
+    expr->any.next = NULL;
+    free_expr(expr);
+    
+    return with;
+}
+
+
+static dres_expr_t *
+replace_bool(dres_expr_t *expr, int value)
+{
+    dres_expr_const_t *c;
+
+    if ((c = ALLOC(dres_expr_const_t)) == NULL)
+        return expr;                          /* leave it unfolded */
+
+    c->type  = DRES_EXPR_CONST;
+    c->vtype = DRES_TYPE_INTEGER;
+    c->v.i   = value ? 1 : 0;
+
+    return replace_expr(expr, (dres_expr_t *)c);
+}
+
+
+static dres_expr_t *
+fold_args(dres_expr_t *args)
+{
+    dres_expr_t **prev, *arg;
+
+    for (prev = &args; (arg = *prev) != NULL; prev = &(*prev)->any.next)
+        *prev = fold_expr(arg, FALSE);
+
+    return args;
+}
+
+
+static dres_expr_t *
+fold_not(dres_expr_relop_t *expr, int cond)
+{
+    dres_expr_t *arg, *inner;
 
+    arg = expr->arg1 = fold_expr(expr->arg1, FALSE);
+
+    if (expr_is_const(arg))
+        return replace_bool((dres_expr_t *)expr, const_not(&arg->constant));
+
+    /*
+     * not not x: the double negation is an integer with the truth value
+     * of x so we can use x directly if it is boolean to begin with. In a
+     * branch condition a fact variable is fine too, as BRANCH and NOT
+     * agree about those.
+     */
+    if (arg->type == DRES_EXPR_RELOP && arg->relop.op == DRES_RELOP_NOT) {
+        inner = arg->relop.arg1;
+        
+        if (expr_is_boolean(inner) || (cond && expr_is_global(inner))) {
+            arg->relop.arg1 = NULL;
+            return replace_expr((dres_expr_t *)expr, inner);
+        }
+    }
+
+    return (dres_expr_t *)expr;
+}
+
+
+static dres_expr_t *
+fold_boolean(dres_expr_relop_t *expr, int cond)
+{
+    dres_expr_t *arg1, *arg2, *keep;
+    int          absorb, truth;
+
+    /*
+     * Notes:
+     *   Both arguments of and/or are only ever tested by BRANCH so they
+     *   are folded as conditions. The short-circuiting of the evaluation
+     *   lets us drop the second argument if the first one decides the
+     *   outcome, but we never drop a non-constant first argument as it
+     *   might have side-effects.
+     */
+
+    arg1 = expr->arg1 = fold_expr(expr->arg1, TRUE);
+    arg2 = expr->arg2 = fold_expr(expr->arg2, TRUE);
+
+    absorb = (expr->op == DRES_RELOP_OR);        /* true || x, false && x */
+    keep   = NULL;
+
+    if (expr_is_const(arg1)) {
+        truth = const_truth(&arg1->constant);
+
+        if (truth == absorb)
+            return replace_bool((dres_expr_t *)expr, absorb);
+
+        if (expr_is_const(arg2))
+            return replace_bool((dres_expr_t *)expr,
+                                const_truth(&arg2->constant));
+        keep = arg2;
+    }
+    else if (expr_is_const(arg2)) {
+        truth = const_truth(&arg2->constant);
+
+        if (truth != absorb)                     /* x || false, x && true */
+            keep = arg1;
+    }
+    
+    if (keep != NULL && (cond || expr_is_boolean(keep))) {
+        if (keep == arg1)
+            expr->arg1 = NULL;
+        else
+            expr->arg2 = NULL;
+        return replace_expr((dres_expr_t *)expr, keep);
+    }
+
+    return (dres_expr_t *)expr;
+}
+
+
+static dres_expr_t *
+fold_relop(dres_expr_relop_t *expr, int cond)
+{
+    dres_expr_t *arg1, *arg2;
+
+    switch (expr->op) {
+    case DRES_RELOP_NOT:
+        return fold_not(expr, cond);
+    case DRES_RELOP_OR:
+    case DRES_RELOP_AND:
+        return fold_boolean(expr, cond);
+    default:
+        break;
+    }
+
+    arg1 = expr->arg1 = fold_expr(expr->arg1, FALSE);
+    arg2 = expr->arg2 = fold_expr(expr->arg2, FALSE);
+    
+    if (expr_is_const(arg1) && expr_is_const(arg2))
+        return replace_bool((dres_expr_t *)expr,
+                            const_compare(expr->op,
+                                          &arg1->constant, &arg2->constant));
+    
+    return (dres_expr_t *)expr;
+}
+
+
+static dres_expr_t *
+fold_expr(dres_expr_t *expr, int cond)
+{
+    if (expr == NULL)
+        return NULL;
+    
+    switch (expr->type) {
+    case DRES_EXPR_RELOP:
+        return fold_relop(&expr->relop, cond);
+    case DRES_EXPR_CALL:
+        expr->call.args = fold_args(expr->call.args);
+        return expr;
+    default:
+        return expr;
+    }
+}
+
+
+/********************
+ * dres_fold_statement
+ ********************/
+EXPORTED dres_stmt_t *
+dres_fold_statement(dres_stmt_t *stmts)
+{
+    /*
+     * Notes:
+     *   Folds constant subexpressions and removes the dead branches of
+     *   if-then-else statements with a constant condition in the given
+     *   statement list. The folded list is returned. The statements are
+     *   modified in place, with dropped nodes freed.
+     */
+
+    dres_stmt_t **prev, *stmt, *next, *branch, *last;
+    dres_expr_t  *cond;
+    
+    for (prev = &stmts; (stmt = *prev) != NULL; ) {
+        next = stmt->any.next;
+
+        switch (stmt->type) {
+        case DRES_STMT_FULL_ASSIGN:
+        case DRES_STMT_PARTIAL_ASSIGN:
+        case DRES_STMT_REPLACE_ASSIGN:
+            stmt->assign.rvalue = fold_expr(stmt->assign.rvalue, FALSE);
+            break;
+
+        case DRES_STMT_CALL:
+            stmt->call.args = fold_args(stmt->call.args);
+            break;
+
+        case DRES_STMT_IFTHEN:
+            cond = stmt->ifthen.condition =
+                fold_expr(stmt->ifthen.condition, TRUE);
+            stmt->ifthen.if_branch   =
+                dres_fold_statement(stmt->ifthen.if_branch);
+            stmt->ifthen.else_branch =
+                dres_fold_statement(stmt->ifthen.else_branch);
+
+            if (!expr_is_const(cond))
+                break;
+
+            if (const_truth(&cond->constant)) {
+                branch = stmt->ifthen.if_branch;
+                stmt->ifthen.if_branch = NULL;
+            }
+            else {
+                branch = stmt->ifthen.else_branch;
+                stmt->ifthen.else_branch = NULL;
+            }
+            
+            stmt->any.next = NULL;
+            dres_free_statement(stmt);
+            
+            if (branch != NULL) {
+                for (last = branch; last->any.next; last = last->any.next)
+                    ;
+                last->any.next = next;
+                *prev = branch;
+                prev  = &last->any.next;
+            }
+            else
+                *prev = next;
+            continue;
+            
+        default:
+            break;
+        }
+        
+        prev = &stmt->any.next;
+    }
+
+    return stmts;
+}
 
 
 /* 
@@ -40,6 +40,9 @@ double trunc(double);
 #endif
 
 static int compile_statement(dres_t *dres, dres_stmt_t *stmt, vm_chunk_t *code);
+static int compile_global(dres_t *dres, const char *name,
+                          dres_select_t *selector, const char *field,
+                          vm_chunk_t *code);
 static int compile_stmt_lvalue(dres_t *dres, dres_varref_t *lval, int op,
                                vm_chunk_t *code);
 static int compile_stmt_assign(dres_t *dres, dres_stmt_assign_t *stmt,
@@ -65,12 +68,36 @@ static int save_initializers(dres_t *dres, dres_buf_t *buf);
 static int load_initializers(dres_t *dres, dres_buf_t *buf);
 static int save_methods     (dres_t *dres, dres_buf_t *buf);
 static int load_methods     (dres_t *dres, dres_buf_t *buf);
+static int save_fields      (dres_t *dres, dres_buf_t *buf);
+static int load_fields      (dres_t *dres, dres_buf_t *buf);
+
+static void verify_target(dres_t *dres, dres_target_t *target);
 
 extern int initialize_variables(dres_t *dres); /* XXX TODO: kludge */
 extern int finalize_variables  (dres_t *dres); /* XXX TODO: kludge */
 
 
 
+/********************
+ * verify_target
+ ********************/
+static void
+verify_target(dres_t *dres, dres_target_t *target)
+{
+    /*
+     * Notes:
+     *   Failing to verify is not an error, the target will just be run
+     *   with all the per-instruction checks enabled.
+     */
+
+    const char *error;
+
+    if (vm_chunk_verify(&dres->vm, target->code, &error) != 0)
+        DRES_INFO("code for target %s not verified (%s), running it checked",
+                  target->name, error ? error : "unknown error");
+}
+
+
 /********************
  * dres_compile_target
  ********************/
@@ -83,6 +110,9 @@ dres_compile_target(dres_t *dres, dres_target_t *target)
     dres_stmt_t   *stmt;
     int            err;
 
+    if (!DRES_TST_FLAG(dres, NO_FOLDING))
+        target->statements = dres_fold_statement(target->statements);
+
     if (target->statements == NULL)
         return 0;
 
@@ -100,6 +130,16 @@ dres_compile_target(dres_t *dres, dres_target_t *target)
 
     VM_INSTR_HALT(target->code, fail, err);
 
+    if ((target->code->maxdepth = vm_chunk_depth(target->code)) < 0)
+        DRES_WARNING("failed to determine stack depth for target %s",
+                     target->name);
+
+    if ((err = vm_chunk_decode(target->code)) != 0)
+        DRES_WARNING("failed to decode code for target %s (%d: %s)",
+                     target->name, err, strerror(err));
+    else
+        verify_target(dres, target);
+
     return 0;
 
  fail:
@@ -139,6 +179,16 @@ dres_compile_target(dres_t *dres, dres_target_t *target)
     } while (0)
 
 
+#define PUSH_FIELD(code, fail, err, name) do {                          \
+        int __id = vm_field_add(&dres->vm, (name));                     \
+        if (__id < 0) {                                                 \
+            err = ENOMEM;                                               \
+            goto fail;                                                  \
+        }                                                               \
+        VM_INSTR_PUSH_FIELD((code), fail, err, __id);                   \
+    } while (0)
+
+
 #define FAIL(fmt, args...) do {                           \
         DRES_ERROR("%s: "fmt , __FUNCTION__ , ## args);   \
         goto fail;                                        \
@@ -171,12 +221,110 @@ compile_statement(dres_t *dres, dres_stmt_t *stmt, vm_chunk_t *code)
 }
 
 
+static int
+compile_global(dres_t *dres, const char *name, dres_select_t *selector,
+               const char *field, vm_chunk_t *code)
+{
+    /*
+     * Notes:
+     *   Globals with only constant selector values are compiled to a
+     *   single LOAD instruction that also fetches the field if one is
+     *   given. Anything else gets the generic PUSH GLOBAL, FILTER and
+     *   GET FIELD sequence. Selectors without a value (update fields of
+     *   lvalues) are skipped, these are taken care of by our caller.
+     */
+
+    dres_select_t *sel;
+    int            nselect, fid, id, op, err;
+
+    nselect = 0;
+    for (sel = selector; sel != NULL; sel = sel->next) {
+        switch (sel->field.value.type) {
+        case DRES_TYPE_UNKNOWN:
+            continue;
+        case DRES_TYPE_INTEGER:
+        case DRES_TYPE_DOUBLE:
+        case DRES_TYPE_STRING:
+            if ((id = vm_field_add(&dres->vm, sel->field.name)) < 0)
+                FAIL("failed to add field %s", sel->field.name);
+            if (id > VM_LOAD_MAX_FIELD)
+                goto generic;
+            nselect++;
+            break;
+        default:
+            goto generic;
+        }
+    }
+
+    fid = -1;
+    if (field != NULL && (fid = vm_field_add(&dres->vm, field)) < 0)
+        FAIL("failed to add field %s", field);
+    
+    if (nselect > VM_LOAD_MAX_SELECT || fid > VM_LOAD_MAX_FIELD)
+        goto generic;
+
+    VM_INSTR_LOAD(code, fail, err, name, nselect, fid);
+    
+    for (sel = selector; sel != NULL; sel = sel->next) {
+        if (sel->field.value.type == DRES_TYPE_UNKNOWN)
+            continue;
+
+        id = vm_field_add(&dres->vm, sel->field.name);
+        op = (int)sel->op;
+        
+        switch (sel->field.value.type) {
+        case DRES_TYPE_INTEGER:
+            VM_INSTR_SELECT_INT(code, fail, err, op, id, sel->field.value.v.i);
+            break;
+        case DRES_TYPE_DOUBLE:
+            VM_INSTR_SELECT_DOUBLE(code, fail, err, op, id,
+                                   sel->field.value.v.d);
+            break;
+        case DRES_TYPE_STRING:
+            VM_INSTR_SELECT_STRING(code, fail, err, op, id,
+                                   sel->field.value.v.s);
+            break;
+        }
+    }
+
+    return TRUE;
+
+    
+ generic:
+    VM_INSTR_PUSH_GLOBAL(code, fail, err, name);
+
+    for (nselect = 0, sel = selector; sel != NULL; sel = sel->next) {
+        if (sel->field.value.type == DRES_TYPE_UNKNOWN)
+            continue;
+
+        op = (int)sel->op;
+        VM_INSTR_PUSH_INT(code, fail, err, op);
+        PUSH_VALUE(code, fail, err, &sel->field.value);
+        PUSH_FIELD(code, fail, err, sel->field.name);
+        nselect++;
+    }
+    if (nselect)
+        VM_INSTR_FILTER(code, fail, err, nselect);
+    
+    if (field != NULL) {
+        PUSH_FIELD(code, fail, err, field);
+        VM_INSTR_GET_FIELD(code, fail, err);
+    }
+
+    return TRUE;
+    
+ fail:
+    DRES_ERROR("%s: code generation failed", __FUNCTION__);
+    return FALSE;
+}
+
+
 static int
 compile_stmt_lvalue(dres_t *dres, dres_varref_t *lval, int op, vm_chunk_t *code)
 {
     const char    *name;
     dres_select_t *sel;
-    int            update, nfield, partial, selop, err;
+    int            update, nfield, partial, err;
 
 
     partial = (op == DRES_STMT_PARTIAL_ASSIGN);
@@ -186,24 +334,13 @@ compile_stmt_lvalue(dres_t *dres, dres_varref_t *lval, int op, vm_chunk_t *code)
     if (name == NULL)
         FAIL("failed to look up global");
     
-    VM_INSTR_PUSH_GLOBAL(code, fail, err, name);
+    if (!compile_global(dres, name, lval->selector, NULL, code))
+        FAIL("failed to generate code for global %s", name);
 
     update = FALSE;
-    for (nfield = 0, sel = lval->selector; sel != NULL; sel = sel->next) {
-        if (sel->field.value.type == DRES_TYPE_UNKNOWN) {  /* an update */
+    for (sel = lval->selector; sel != NULL; sel = sel->next)
+        if (sel->field.value.type == DRES_TYPE_UNKNOWN)    /* an update */
             update = TRUE;
-            continue;
-        }
-        else {
-            selop = (int)sel->op;
-            VM_INSTR_PUSH_INT(code, fail, err, selop);
-            PUSH_VALUE(code, fail, err, &sel->field.value);
-            VM_INSTR_PUSH_STRING(code, fail, err, sel->field.name);
-            nfield++;
-        }
-    }
-    if (nfield)
-        VM_INSTR_FILTER(code, fail, err, nfield);
     
     if (partial && !update) {
         /* partial assignments without update make no sense */
@@ -218,7 +355,7 @@ compile_stmt_lvalue(dres_t *dres, dres_varref_t *lval, int op, vm_chunk_t *code)
         for (nfield = 0, sel = lval->selector; sel != NULL; sel = sel->next) {
             if (sel->field.value.type != DRES_TYPE_UNKNOWN) /* a filter */
                 continue;
-            VM_INSTR_PUSH_STRING(code, fail, err, sel->field.name);
+            PUSH_FIELD(code, fail, err, sel->field.name);
             nfield++;
         }
 
@@ -229,7 +366,7 @@ compile_stmt_lvalue(dres_t *dres, dres_varref_t *lval, int op, vm_chunk_t *code)
     }
     else {
         if (lval->field != NULL) {
-            VM_INSTR_PUSH_STRING(code, fail, err, lval->field);
+            PUSH_FIELD(code, fail, err, lval->field);
             VM_INSTR_SET_FIELD(code, fail, err);
         }
         else {
@@ -438,7 +575,7 @@ compile_expr_varref(dres_t *dres, dres_expr_varref_t *expr, vm_chunk_t *code)
     const char    *name;
     dres_varref_t *vref;
     dres_select_t *sel;
-    int            nfield, op, err;
+    int            err;
 
 
     vref = &expr->ref;
@@ -455,26 +592,12 @@ compile_expr_varref(dres_t *dres, dres_expr_varref_t *expr, vm_chunk_t *code)
         if (name == NULL)
             FAIL("failed to look up global 0x%x", vref->variable);
     
-        VM_INSTR_PUSH_GLOBAL(code, fail, err, name);
-
-        for (nfield = 0, sel = vref->selector; sel != NULL; sel = sel->next) {
+        for (sel = vref->selector; sel != NULL; sel = sel->next)
             if (sel->field.value.type == DRES_TYPE_UNKNOWN)
                 FAIL("update-stype field in a non-lvalue variable reference");
 
-            op = (int)sel->op;
-            VM_INSTR_PUSH_INT(code, fail, err, op);
-            PUSH_VALUE(code, fail, err, &sel->field.value);
-            VM_INSTR_PUSH_STRING(code, fail, err, sel->field.name);
-            
-            nfield++;
-        }
-        if (nfield)
-            VM_INSTR_FILTER(code, fail, err, nfield);
-
-        if (vref->field != NULL) {
-            VM_INSTR_PUSH_STRING(code, fail, err, vref->field);
-            VM_INSTR_GET_FIELD(code, fail, err);
-        }
+        if (!compile_global(dres, name, vref->selector, vref->field, code))
+            FAIL("failed to generate code for global %s", name);
     }
 
     return TRUE;
@@ -651,6 +774,9 @@ dres_save(dres_t *dres, char *path)
     if ((status = save_methods(dres, buf)) != 0)
         goto fail;
 
+    if ((status = save_fields(dres, buf)) != 0)
+        goto fail;
+
     if ((fp = fopen(path, "w")) == NULL)
         goto fail;
 
@@ -666,6 +792,8 @@ dres_save(dres_t *dres, char *path)
     HTONL(ninit);
     HTONL(nfield);
     HTONL(nmethod);
+    HTONL(nfieldname);
+    HTONL(nsymbol);
     
     if (fwrite(&buf->header, sizeof(buf->header), 1, fp) != 1)
         goto fail;
@@ -772,6 +900,24 @@ save_methods(dres_t *dres, dres_buf_t *buf)
 }
 
 
+/********************
+ * save_fields
+ ********************/
+static int
+save_fields(dres_t *dres, dres_buf_t *buf)
+{
+    int i;
+
+    dres_buf_ws32(buf, dres->vm.nfield);
+    buf->header.nfieldname = dres->vm.nfield;
+
+    for (i = 0; i < dres->vm.nfield; i++)
+        dres_buf_wstr(buf, (char *)vm_field_name(&dres->vm, i));
+
+    return 0;
+}
+
+
 /********************
  * dres_load
  ********************/
@@ -805,6 +951,8 @@ dres_load(char *path)
     NTOHL(ninit);
     NTOHL(nfield);
     NTOHL(nmethod);
+    NTOHL(nfieldname);
+    NTOHL(nsymbol);
 
     if (hdr->magic != DRES_MAGIC) {
         errno = EINVAL;
@@ -821,7 +969,8 @@ dres_load(char *path)
     size += SIZE(dres_variable_t   , nvariable);
     size += SIZE(dres_initializer_t, ninit);
     size += SIZE(dres_init_t       , nfield);
-    size += SIZE(vm_method_t       , nmethod);
+    size += SIZE(dres_symbol_t     , nsymbol);
+    size += SIZE(int32_t           , nsymbol) + 3 * DRES_ALIGNMENT;
 
     buf.dsize = size;
     buf.dused = 0;
@@ -845,13 +994,27 @@ dres_load(char *path)
         (status = dres_load_factvars(dres, &buf)) != 0 ||
         (status = dres_load_dresvars(dres, &buf)) != 0 ||
         (status = load_initializers(dres, &buf)) != 0 ||
-        (status = load_methods(dres, &buf)) != 0) {
+        (status = load_methods(dres, &buf)) != 0 ||
+        (status = load_fields(dres, &buf)) != 0) {
         errno = status;
         goto fail;
     }
     
     close(buf.fd);
 
+    for (i = 0; i < dres->ntarget; i++) {
+        dres_target_t *t = dres->targets + i;
+
+        if (t->code == NULL)
+            continue;
+        
+        if ((status = vm_chunk_decode(t->code)) != 0)
+            DRES_WARNING("failed to decode code for target %s (%d: %s)",
+                         t->name, status, strerror(status));
+        else
+            verify_target(dres, t);
+    }
+
     if (dres_store_init(dres))
         goto fail;
     if ((status = dres_register_builtins(dres)) != 0) {
@@ -878,6 +1041,10 @@ dres_load(char *path)
     dres->vm.nlocal = dres->ndresvar;
     for (i = 0; i < dres->ndresvar; i++)
         vm_set_varname(&dres->vm, i, dres->dresvars[i].name);
+
+    /* without reverse dependencies we just check every target */
+    if (dres_build_depends(dres) != 0)
+        DRES_WARNING("failed to build reverse dependencies");
     
     return dres;
 
@@ -955,22 +1122,85 @@ load_initializers(dres_t *dres, dres_buf_t *buf)
 static int
 load_methods(dres_t *dres, dres_buf_t *buf)
 {
-    vm_method_t *m;
-    int          i;
+    /*
+     * Notes:
+     *   Methods are registered to the live method table of the VM instead
+     *   of being loaded into the ruleset buffer. This lets the table grow
+     *   if necessary and have handlers registered by name later. Should
+     *   the live IDs differ from the saved ones we remap the code once.
+     */
+
+    dres_target_t *t;
+    char          *name;
+    int           *map, nmethod, saved, remap, status, i;
 
-    dres->vm.nmethod = dres_buf_rs32(buf);
-    dres->vm.methods =
-        dres_buf_alloc(buf, dres->vm.nmethod * sizeof(*dres->vm.methods));
+    nmethod = dres_buf_rs32(buf);
     
-    if (dres->vm.methods == NULL)
+    if (nmethod <= 0)
+        return buf->error;
+    
+    if ((map = ALLOC_ARR(int, nmethod)) == NULL)
         return ENOMEM;
 
-    for (i = 0, m = dres->vm.methods; i < dres->vm.nmethod; i++, m++) {
-        m->id   = dres_buf_rs32(buf);
-        m->name = dres_buf_rstr(buf);
-    }       
+    remap = FALSE;
+    for (i = 0; i < nmethod; i++) {
+        saved = dres_buf_rs32(buf);
+        name  = dres_buf_rstr(buf);
 
-    return 0;
+        if (name == NULL || saved < 0 || saved >= nmethod) {
+            status = EINVAL;
+            goto out;
+        }
+
+        status = vm_method_add(&dres->vm, name, NULL, NULL);
+        if (status != 0 && status != EEXIST)
+            goto out;
+        
+        map[saved] = vm_method_id(&dres->vm, name);
+        if (map[saved] != saved)
+            remap = TRUE;
+    }
+    
+    status = 0;
+    if (remap) {
+        for (i = 0, t = dres->targets; i < dres->ntarget; i++, t++)
+            if ((status = vm_chunk_remap_methods(t->code, map, nmethod)) != 0)
+                break;
+    }
+    
+ out:
+    FREE(map);
+    return status;
+}
+
+
+/********************
+ * load_fields
+ ********************/
+static int
+load_fields(dres_t *dres, dres_buf_t *buf)
+{
+    /*
+     * Notes:
+     *   The code refers to fields by their index in the field table. The
+     *   VM of a freshly loaded ruleset has an empty table so interning the
+     *   names in their saved order must reproduce the saved indices.
+     */
+
+    char *name;
+    int   nfield, i;
+
+    nfield = dres_buf_rs32(buf);
+    
+    for (i = 0; i < nfield; i++) {
+        if ((name = dres_buf_rstr(buf)) == NULL)
+            return EINVAL;
+        
+        if (vm_field_add(&dres->vm, name) != i)
+            return EINVAL;
+    }
+
+    return buf->error;
 }
 
 
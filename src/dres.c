@@ -41,6 +41,15 @@ USA.
 #include "parser.h"
 
 
+/* a goal prepared for repeated updates (see dres_prepare_goal) */
+struct dres_goal_s {
+    dres_t *dres;                           /* resolver of the goal */
+    int     target;                         /* target index */
+    int    *ids;                            /* IDs of the local variables */
+    int     nlocal;                         /* number of local variables */
+};
+
+
 /* trace flags */
 int DBG_GRAPH, DBG_VAR, DBG_RESOLVE, DBG_ACTION, DBG_VM;
 
@@ -64,7 +73,9 @@ static int  finalize_actions    (dres_t *dres);
 static int  check_undefined     (dres_t *dres);
 
 static int  push_locals(dres_t *dres, char **locals);
+static int  push_values(dres_t *dres, int *ids, dres_value_t *values, int n);
 static int  pop_locals (dres_t *dres);
+static void skip_target(dres_t *dres, int tid);
 
 
 
@@ -92,6 +103,83 @@ dres_set_log_level(dres_log_level_t level)
 }
 
 
+/********************
+ * dres_set_exec_mode
+ ********************/
+EXPORTED int
+dres_set_exec_mode(dres_t *dres, dres_exec_mode_t mode)
+{
+    /*
+     * Notes:
+     *   On architectures without JIT support DRES_EXEC_JIT fails with
+     *   EOPNOTSUPP and we keep running in the current mode.
+     */
+
+    return vm_set_exec_mode(&dres->vm, (vm_exec_mode_t)mode);
+}
+
+
+/********************
+ * dres_set_folding
+ ********************/
+EXPORTED int
+dres_set_folding(dres_t *dres, int enabled)
+{
+    /*
+     * Notes:
+     *   Constant folding is on by default. Turning it off is mainly meant
+     *   for testing the folded code against the code as written. It only
+     *   has an effect before the actions are compiled, so it must be set
+     *   between dres_open and dres_finalize of a ruleset in source form.
+     */
+
+    if (DRES_TST_FLAG(dres, ACTIONS_FINALIZED) ||
+        DRES_TST_FLAG(dres, COMPILED))
+        return EBUSY;
+    
+    if (enabled)
+        DRES_CLR_FLAG(dres, NO_FOLDING);
+    else
+        DRES_SET_FLAG(dres, NO_FOLDING);
+
+    return 0;
+}
+
+
+/********************
+ * dres_set_propagation
+ ********************/
+EXPORTED int
+dres_set_propagation(dres_t *dres, int enabled)
+{
+    /*
+     * Notes:
+     *   Dirty propagation is on by default. With it turned off there are
+     *   no dependent lists and every target is checked during goal
+     *   resolution, which is mainly useful for testing the propagation
+     *   against a full scan. Compiled rulesets build their dependents
+     *   already in dres_open so they are freed or rebuilt here as needed.
+     */
+
+    if (DRES_TST_FLAG(dres, TRANSACTION_ACTIVE))
+        return EBUSY;
+
+    if (enabled) {
+        DRES_CLR_FLAG(dres, NO_PROPAGATION);
+        if (dres->depends == NULL &&
+            (DRES_TST_FLAG(dres, TARGETS_FINALIZED) ||
+             DRES_TST_FLAG(dres, COMPILED)))
+            return dres_build_depends(dres);
+    }
+    else {
+        DRES_SET_FLAG(dres, NO_PROPAGATION);
+        dres_free_depends(dres);
+    }
+
+    return 0;
+}
+
+
 /********************
  * dres_open
  ********************/
@@ -116,9 +204,9 @@ dres_open(char *file)
     if (stat(file, &st) == 0 && S_ISREG(st.st_mode)) {
         if ((dres = dres_load(file)) != NULL ||
             (dres = dres_parse_file(file)) != NULL)
-            return dres;
+            dres_native_open(dres, file);
 
-        return NULL;
+        return dres;
     }
 
 
@@ -138,11 +226,15 @@ dres_open(char *file)
     *suffix++ = '.';
     
     strcpy(suffix, DRES_SUFFIX_BINARY);
-    if ((dres = dres_load(path)) != NULL)
-        return dres;
+    if ((dres = dres_load(path)) == NULL) {
+        strcpy(suffix, DRES_SUFFIX_PLAIN);
+        dres = dres_parse_file(path);
+    }
+
+    if (dres != NULL)
+        dres_native_open(dres, path);
     
-    strcpy(suffix, DRES_SUFFIX_PLAIN);
-    return dres_parse_file(path);
+    return dres;
 }
 
 
@@ -189,13 +281,22 @@ dres_init(char *prefix)
 EXPORTED void
 dres_exit(dres_t *dres)
 {
+    int i;
+
     if (dres == NULL)
         return;
     
     dres_store_free(dres);
+    dres_target_stats_exit(dres);
+    dres_free_depends(dres);
+    dres_native_close(dres);
 
-    if (DRES_TST_FLAG(dres, COMPILED))
+    if (DRES_TST_FLAG(dres, COMPILED)) {
+        for (i = 0; i < dres->ntarget; i++)
+            vm_chunk_undecode(dres->targets[i].code);
+        vm_exit(&dres->vm);
         free(dres);
+    }
     else {
         dres_free_targets(dres);
         dres_free_factvars(dres);
@@ -429,7 +530,7 @@ finalize_actions(dres_t *dres)
     }
 
     DRES_SET_FLAG(dres, ACTIONS_FINALIZED);
-    return 0;
+    return dres_native_bind(dres);
 }
 
 
@@ -465,6 +566,10 @@ finalize_targets(dres_t *dres)
         dres_dump_sort(dres, target->dependencies);
     }
 
+    /* without reverse dependencies we just check every target */
+    if (dres_build_depends(dres) != 0)
+        DRES_WARNING("failed to build reverse dependencies");
+
     DRES_SET_FLAG(dres, TARGETS_FINALIZED);
     return 0;
 }
@@ -486,43 +591,124 @@ dres_finalize(dres_t *dres)
 
 
 /********************
- * dres_update_goal
+ * finalize_goals
  ********************/
-EXPORTED int
-dres_update_goal(dres_t *dres, char *goal, char **locals)
+static int
+finalize_goals(dres_t *dres)
 {
-    dres_target_t *target;
-    int            id, i, status, own_tx;
-
+    int status;
     
-    status = 0;
-
     if (!DRES_TST_FLAG(dres, ACTIONS_FINALIZED))
         if ((status = finalize_actions(dres)) != 0)
             if (dres->fallback == NULL)
-                DRES_ACTION_ERROR(status);
+                return status;
     
     if (!DRES_TST_FLAG(dres, TARGETS_FINALIZED))
         if ((status = finalize_targets(dres)) != 0)
-            DRES_ACTION_ERROR(status);
+            return status;
+
+    return 0;
+}
+
+
+/********************
+ * goal_target
+ ********************/
+static dres_target_t *
+goal_target(dres_t *dres, char *goal)
+{
+    dres_target_t *target;
+
+    if (goal != NULL)
+        target = dres_lookup_target(dres, goal);
+    else
+        target = dres->ntarget > 0 ? dres->targets : NULL;
+
+    if (target == NULL || !DRES_IS_DEFINED(target->id))
+        return NULL;
     
-    if (goal != NULL) {
-        if ((target = dres_lookup_target(dres, goal)) == NULL)
-            DRES_ACTION_ERROR(EINVAL);
+    return target;
+}
+
+
+/********************
+ * resolve_target
+ ********************/
+static int
+resolve_target(dres_t *dres, dres_target_t *target, unsigned char *checked)
+{
+    int id, i, status;
+
+    /*
+     * Notes:
+     *   When several goals are resolved in one pass, checked marks the
+     *   targets already visited for an earlier goal. Their dependencies
+     *   precede them in every sorted goal, so skipping them keeps the
+     *   merged order topological.
+     */
+    
+    if (target->prereqs == NULL) {
+        DEBUG(DBG_RESOLVE, "%s has no prereqs => updating", target->name);
+        if (checked != NULL)
+            checked[DRES_INDEX(target->id)] = TRUE;
+        return dres_run_actions(dres, target);
     }
-    else {
-        target = dres->targets;
-        goal   = target->name;
+
+    status = TRUE;
+    for (i = 0; target->dependencies[i] != DRES_ID_NONE; i++) {
+        id = target->dependencies[i];
+        
+        if (DRES_ID_TYPE(id) != DRES_TYPE_TARGET)
+            continue;
+
+        if (checked != NULL) {
+            if (checked[DRES_INDEX(id)])
+                continue;
+            checked[DRES_INDEX(id)] = TRUE;
+        }
+        
+        if (!DRES_IS_DIRTY(dres, id)) {
+            skip_target(dres, id);
+            continue;
+        }
+        
+        if ((status = dres_check_target(dres, id)) <= 0)
+            break;
     }
-    
-    if (!DRES_IS_DEFINED(target->id))
-        DRES_ACTION_ERROR(EINVAL);
 
+    return status;
+}
+
+
+/********************
+ * update_targets
+ ********************/
+static int
+update_targets(dres_t *dres, dres_target_t **targets, int ntarget,
+               char **locals, int *ids, dres_value_t *values, int nvalue)
+{
+    dres_target_stats_t *stats;
+    unsigned char       *checked;
+    int                  i, status, own_tx, scope;
+
+    status  = 0;
+    checked = NULL;
+
+    for (i = 0; i < ntarget; i++)
+        if ((stats = dres_target_stats(dres, targets[i])) != NULL)
+            stats->ngoal++;
+
+    if (ntarget > 1) {
+        if ((checked = ALLOC_ARR(unsigned char, dres->ntarget)) == NULL)
+            DRES_ACTION_ERROR(ENOMEM);
+    }
+    
     if (!DRES_TST_FLAG(dres, TRANSACTION_ACTIVE)) {
-        if (!dres_store_tx_new(dres))
+        if (!dres_store_tx_new(dres)) {
+            FREE(checked);
             DRES_ACTION_ERROR(EINVAL);
+        }
 
-        dres->txid++;
         own_tx = 1;
     }
     else
@@ -531,46 +717,235 @@ dres_update_goal(dres_t *dres, char *goal, char **locals)
     dres->stamp++;
     dres_store_check(dres);
     
-    if (locals != NULL && (status = push_locals(dres, locals)) != 0)
-        goto rollback;
-    
-    if (target->prereqs == NULL) {
-        DEBUG(DBG_RESOLVE, "%s has no prereqs => updating", target->name);
-        status = dres_run_actions(dres, target);
+    if (locals != NULL) {
+        if ((status = push_locals(dres, locals)) != 0)
+            goto rollback;
+        scope = TRUE;
     }
-    else {
-        for (i = 0; target->dependencies[i] != DRES_ID_NONE; i++) {
-            id = target->dependencies[i];
-        
-            if (DRES_ID_TYPE(id) != DRES_TYPE_TARGET)
-                continue;
+    else if (nvalue > 0) {
+        if ((status = push_values(dres, ids, values, nvalue)) != 0)
+            goto rollback;
+        scope = TRUE;
+    }
+    else
+        scope = FALSE;
+    
+    for (i = 0; i < ntarget; i++) {
+        if ((status = resolve_target(dres, targets[i], checked)) <= 0)
+            break;
         
-            if ((status = dres_check_target(dres, id)) <= 0)
-                break;
-        }
+        dres_update_target_stamp(dres, targets[i]);
+
+        DEBUG(DBG_RESOLVE, "updated of goal %s done", targets[i]->name);
     }
     
-    if (locals != NULL)
+    if (scope)
         pop_locals(dres);
     
+    /* a stamp change was not logged, we can only roll back everything */
+    if (own_tx && status > 0 && DRES_TST_FLAG(dres, TRANSACTION_FAILED))
+        status = -EIO;
+    
     if (status > 0) {
-        dres_update_target_stamp(dres, target);
         if (own_tx)
             dres_store_tx_commit(dres);
     }
     else {
     rollback:
-        if (own_tx)
+        if (own_tx) {
             dres_store_tx_rollback(dres);
+            for (i = 0; i < ntarget; i++)
+                if ((stats = dres_target_stats(dres, targets[i])) != NULL)
+                    stats->nrollback++;
+        }
     }
+
+    FREE(checked);
+    
+    DEBUG(DBG_RESOLVE, "updated of %s%s done with status %d (%s)",
+          ntarget > 1 ? "goals starting with " : "goal ", targets[0]->name,
+          status, status < 0 ? "error" : (status ? "success" : "failed"));
+
+    return status;
+}
+
+
+/********************
+ * dres_update_goal
+ ********************/
+EXPORTED int
+dres_update_goal(dres_t *dres, char *goal, char **locals)
+{
+    dres_target_t *target;
+    int            status;
+
+    if ((status = finalize_goals(dres)) != 0)
+        DRES_ACTION_ERROR(status);
+    
+    if ((target = goal_target(dres, goal)) == NULL)
+        DRES_ACTION_ERROR(EINVAL);
+
+    return update_targets(dres, &target, 1, locals, NULL, NULL, 0);
+}
+
+
+/********************
+ * dres_update_goals
+ ********************/
+EXPORTED int
+dres_update_goals(dres_t *dres, char **goals, char **locals)
+{
+    /*
+     * Notes:
+     *   goals is a NULL-terminated array of goal names. All goals are
+     *   updated within a single transaction in the given order, checking
+     *   every shared target only once. If any of them fails, the updates
+     *   of all of them are rolled back.
+     */
+
+    dres_target_t **targets;
+    int             status, n, i;
+
+    if ((status = finalize_goals(dres)) != 0)
+        DRES_ACTION_ERROR(status);
+
+    for (n = 0; goals != NULL && goals[n] != NULL; n++)
+        ;
+
+    if (n == 0)
+        DRES_ACTION_ERROR(EINVAL);
+    
+    if ((targets = ALLOC_ARR(dres_target_t *, n)) == NULL)
+        DRES_ACTION_ERROR(ENOMEM);
     
-    DEBUG(DBG_RESOLVE, "updated of goal %s done with status %d (%s)",
-          goal, status, status < 0 ? "error" : (status ? "success" : "failed"));
+    for (i = 0; i < n; i++) {
+        if ((targets[i] = goal_target(dres, goals[i])) == NULL) {
+            DRES_ERROR("cannot update unknown goal %s", goals[i]);
+            FREE(targets);
+            DRES_ACTION_ERROR(EINVAL);
+        }
+    }
 
+    status = update_targets(dres, targets, n, locals, NULL, NULL, 0);
+    
+    FREE(targets);
+    
     return status;
 }
 
 
+/********************
+ * dres_prepare_goal
+ ********************/
+EXPORTED dres_goal_t *
+dres_prepare_goal(dres_t *dres, char *goal, char **locals)
+{
+    /*
+     * Notes:
+     *   locals is a NULL-terminated array of the names of the local
+     *   variables the goal will be updated with. The values passed to
+     *   dres_update_prepared are bound to these by position.
+     */
+
+    dres_target_t *target;
+    dres_goal_t   *g;
+    int            status, n, i;
+
+    if ((status = finalize_goals(dres)) != 0) {
+        errno = status;
+        return NULL;
+    }
+
+    if ((target = goal_target(dres, goal)) == NULL) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    for (n = 0; locals != NULL && locals[n] != NULL; n++)
+        ;
+    
+    if (ALLOC_OBJ(g) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (n > 0 && (g->ids = ALLOC_ARR(int, n)) == NULL) {
+        FREE(g);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+        if ((g->ids[i] = dres_dresvar_id(dres, locals[i])) == DRES_ID_NONE) {
+            DRES_ERROR("cannot prepare undeclared variable &%s", locals[i]);
+            dres_free_prepared(g);
+            errno = ENOENT;
+            return NULL;
+        }
+    }
+    
+    g->dres   = dres;
+    g->target = DRES_INDEX(target->id);
+    g->nlocal = n;
+
+    return g;
+}
+
+
+/********************
+ * dres_update_prepared
+ ********************/
+EXPORTED int
+dres_update_prepared(dres_goal_t *g, dres_value_t *values)
+{
+    dres_t        *dres = g->dres;
+    dres_target_t *target;
+
+    if (g->nlocal > 0 && values == NULL)
+        DRES_ACTION_ERROR(EINVAL);
+
+    target = dres->targets + g->target;
+
+    return update_targets(dres, &target, 1, NULL, g->ids, values, g->nlocal);
+}
+
+
+/********************
+ * dres_free_prepared
+ ********************/
+EXPORTED void
+dres_free_prepared(dres_goal_t *g)
+{
+    if (g != NULL) {
+        FREE(g->ids);
+        FREE(g);
+    }
+}
+
+
+/********************
+ * skip_target
+ ********************/
+static void
+skip_target(dres_t *dres, int tid)
+{
+    /*
+     * Notes:
+     *   None of the prerequisites of a clean target have been touched
+     *   since it was last checked, so checking it would find it up-to-date.
+     *   It is not checked, so it is counted separately from ncheck/nskip.
+     */
+    
+    dres_target_t       *target = dres->targets + DRES_INDEX(tid);
+    dres_target_stats_t *stats;
+
+    DEBUG(DBG_RESOLVE, "%s is clean => up-to-date", target->name);
+
+    if ((stats = dres_target_stats(dres, target)) != NULL)
+        stats->nclean++;
+}
+
+
 /********************
  * dres_lookup_variable
  ********************/
@@ -634,7 +1009,7 @@ push_locals(dres_t *dres, char **locals)
             FAIL(ENOENT);
         }
             
-        if ((err = vm_scope_set(dres->vm.scope, id, type, v)) != 0)
+        if ((err = vm_scope_set(&dres->vm, id, type, v)) != 0)
             FAIL(err);
     }
     
@@ -647,6 +1022,41 @@ push_locals(dres_t *dres, char **locals)
 }
 
 
+/********************
+ * push_values
+ ********************/
+static int
+push_values(dres_t *dres, int *ids, dres_value_t *values, int nvalue)
+{
+    vm_value_t v;
+    int        err, i;
+    
+    if ((err = vm_scope_push(&dres->vm)) != 0)
+        return err;
+    
+    for (i = 0; i < nvalue; i++) {
+        switch (values[i].type) {
+        case DRES_TYPE_STRING:  v.s = values[i].v.s; break;
+        case DRES_TYPE_INTEGER: v.i = values[i].v.i; break;
+        case DRES_TYPE_DOUBLE:  v.d = values[i].v.d; break;
+        default:
+            DRES_ERROR("local value of invalid type 0x%x", values[i].type);
+            err = EINVAL;
+            goto fail;
+        }
+        
+        if ((err = vm_scope_set(&dres->vm, ids[i], values[i].type, v)) != 0)
+            goto fail;
+    }
+
+    return 0;
+
+ fail:
+    vm_scope_pop(&dres->vm);
+    return err;
+}
+
+
 /********************
  * pop_locals
  ********************/
@@ -663,11 +1073,15 @@ pop_locals(dres_t *dres)
 void
 dres_update_var_stamp(dres_t *dres, dres_variable_t *var)
 {
+    /* factvar stamps are not restored on rollback, don't log them */
     if (var->txid != dres->txid) {
-        var->txid    = dres->txid;
-        var->txstamp = var->stamp;
+        if (DRES_ID_TYPE(var->id) == DRES_TYPE_DRESVAR)
+            dres_store_tx_touch(dres, var->id, var->stamp, var->txid);
+        var->txid = dres->txid;
     }
     var->stamp = dres->stamp;
+
+    dres_mark_depends(dres, var->id);
 }
 
 
@@ -678,10 +1092,12 @@ void
 dres_update_target_stamp(dres_t *dres, dres_target_t *target)
 {
     if (target->txid != dres->txid) {
-        target->txid    = dres->txid;
-        target->txstamp = target->stamp;
+        dres_store_tx_touch(dres, target->id, target->stamp, target->txid);
+        target->txid = dres->txid;
     }
     target->stamp = dres->stamp;
+
+    dres_mark_depends(dres, target->id);
 }
 
 
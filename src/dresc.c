@@ -45,10 +45,12 @@ main(int argc, char *argv[])
     dres_t *dres;
     char   *in, *out;
     char    compiled[PATH_MAX];
+    FILE   *fp;
     int     i, verbose;
     int     op_compile = 0;
     int     op_save = 0;
     int     op_test = 0;
+    int     op_emit = 0;
 
     in = out = NULL;
     verbose  = 0;
@@ -66,6 +68,8 @@ main(int argc, char *argv[])
             op_test = 1;
         else if (!strcmp(argv[i], "--save"))
             op_save = 1;
+        else if (!strcmp(argv[i], "--emit-c"))
+            op_emit = 1;
         else {
             if (in != NULL)
                 fatal(2, "multiple input files given");
@@ -73,11 +77,14 @@ main(int argc, char *argv[])
         }
     }
 
-    if (!op_compile && !op_save && !op_test)
-        fatal(1, "no operation defined (--compile|--test|--save).");
+    if (!op_compile && !op_save && !op_test && !op_emit)
+        fatal(1, "no operation defined (--compile|--test|--save|--emit-c).");
+
+    if (op_save && op_emit)
+        fatal(1, "--save and --emit-c cannot be used together.");
 
     if (out == NULL) {
-        snprintf(compiled, sizeof(compiled), "%sc", in);
+        snprintf(compiled, sizeof(compiled), "%s%s", in, op_emit ? ".c" : "c");
         out = compiled;
     }
     else {
@@ -129,6 +136,20 @@ main(int argc, char *argv[])
             fatal(6, "failed to precompile DRES file %s to %s", in, out);
     }
 
+    if (op_emit) {
+        if (!op_compile)
+            fatal(8, "need to have --compile to be able to --emit-c!");
+
+        printf("* Emitting native code to '%s'...\n", out);
+        if ((fp = fopen(out, "w")) == NULL)
+            fatal(8, "failed to open %s for writing", out);
+        
+        if (dres_native_emit(dres, in, fp) != 0 || fclose(fp) != 0) {
+            unlink(out);
+            fatal(8, "failed to emit native code for %s to %s", in, out);
+        }
+    }
+
     if (op_compile)
         dres_exit(dres);
 
@@ -22,6 +22,7 @@ USA.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <errno.h>
 #include <arpa/inet.h>
@@ -41,22 +42,35 @@ int
 dres_add_dresvar(dres_t *dres, char *name)
 {
     dres_variable_t *var;
-    int              id;
+    int              id, n;
 
     /* don't create new vars if we resolve or run a precompiled file */
     if (DRES_TST_FLAG(dres, TARGETS_FINALIZED) || DRES_TST_FLAG(dres, COMPILED))
         return DRES_ID_NONE;
     
-    if (!REALLOC_ARR(dres->dresvars, dres->ndresvar, dres->ndresvar + 1))
-        return DRES_ID_NONE;
+    if (dres->ndresvar >= dres->maxdresvar) {
+        n = dres->maxdresvar ? 2 * dres->maxdresvar : DRES_ALLOC_MIN;
+        if (!REALLOC_ARR(dres->dresvars, dres->maxdresvar, n))
+            return DRES_ID_NONE;
+        dres->maxdresvar = n;
+    }
 
-    id  = dres->ndresvar++;
+    id  = dres->ndresvar;
     var = dres->dresvars + id;
 
-    var->id   = DRES_DRESVAR(id);
-    var->name = STRDUP(name);
+    if ((var->name = STRDUP(name)) == NULL)
+        return DRES_ID_NONE;
+
+    if (dres_symtab_add(&dres->dsymtab, var->name, id) != 0) {
+        FREE(var->name);
+        var->name = NULL;
+        return DRES_ID_NONE;
+    }
+
+    dres->ndresvar++;
+    var->id = DRES_DRESVAR(id);
 
-    return var->name ? var->id : DRES_ID_NONE;
+    return var->id;
 }
 
 
@@ -66,15 +80,10 @@ dres_add_dresvar(dres_t *dres, char *name)
 int
 dres_dresvar_id(dres_t *dres, char *name)
 {
-    dres_variable_t *var;
-    int              i;
+    int idx;
 
-    if (name != NULL)
-        for (i = 0, var = dres->dresvars; i < dres->ndresvar; i++, var++) {
-            if (!strcmp(name, var->name))
-                return var->id;
-        }
-    
+    if ((idx = dres_symtab_lookup(&dres->dsymtab, name)) >= 0)
+        return dres->dresvars[idx].id;
 
     return dres_add_dresvar(dres, name);
 }
@@ -110,8 +119,11 @@ dres_free_dresvars(dres_t *dres)
     
     FREE(dres->dresvars);
 
-    dres->dresvars = NULL;
-    dres->ndresvar = 0;
+    dres->dresvars   = NULL;
+    dres->ndresvar   = 0;
+    dres->maxdresvar = 0;
+
+    dres_symtab_free(&dres->dsymtab);
 }
 
 
@@ -144,7 +156,7 @@ dres_local_value(dres_t *dres, int id, dres_value_t *value)
 {
     vm_value_t v;
     
-    switch ((value->type = vm_scope_get(dres->vm.scope, id, &v))) {
+    switch ((value->type = vm_scope_get(&dres->vm, id, &v))) {
     case DRES_TYPE_INTEGER: value->v.i = v.i; break;
     case DRES_TYPE_DOUBLE:  value->v.d = v.d; break;
     case DRES_TYPE_STRING:  value->v.s = v.s; break;
@@ -173,7 +185,7 @@ dres_save_dresvars(dres_t *dres, dres_buf_t *buf)
         dres_buf_wstr(buf, v->name);
     }
     
-    return 0;
+    return dres_symtab_save(&dres->dsymtab, buf);
 }
 
 
@@ -197,7 +209,12 @@ dres_load_dresvars(dres_t *dres, dres_buf_t *buf)
         v->name = dres_buf_rstr(buf);
     }
     
-    return buf->error;
+    if (buf->error)
+        return buf->error;
+
+    return dres_symtab_load(&dres->dsymtab, buf, dres->dresvars, dres->ndresvar,
+                            sizeof(*dres->dresvars),
+                            offsetof(dres_variable_t, name));
 }
 
 
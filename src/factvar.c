@@ -22,6 +22,7 @@ USA.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <errno.h>
 #include <arpa/inet.h>
@@ -40,22 +41,35 @@ int
 dres_add_factvar(dres_t *dres, char *name)
 {
     dres_variable_t *var;
-    int              id;
+    int              id, n;
 
     /* don't create new vars if we resolve or run a precompiled file */
     if (DRES_TST_FLAG(dres, TARGETS_FINALIZED) || DRES_TST_FLAG(dres, COMPILED))
         return DRES_ID_NONE;
     
-    if (!REALLOC_ARR(dres->factvars, dres->nfactvar, dres->nfactvar + 1))
-        return DRES_ID_NONE;
+    if (dres->nfactvar >= dres->maxfactvar) {
+        n = dres->maxfactvar ? 2 * dres->maxfactvar : DRES_ALLOC_MIN;
+        if (!REALLOC_ARR(dres->factvars, dres->maxfactvar, n))
+            return DRES_ID_NONE;
+        dres->maxfactvar = n;
+    }
 
-    id  = dres->nfactvar++;
+    id  = dres->nfactvar;
     var = dres->factvars + id;
 
-    var->id   = DRES_FACTVAR(id);
-    var->name = STRDUP(name);
+    if ((var->name = STRDUP(name)) == NULL)
+        return DRES_ID_NONE;
+
+    if (dres_symtab_add(&dres->fsymtab, var->name, id) != 0) {
+        FREE(var->name);
+        var->name = NULL;
+        return DRES_ID_NONE;
+    }
+
+    dres->nfactvar++;
+    var->id = DRES_FACTVAR(id);
 
-    return var->name ? var->id : DRES_ID_NONE;
+    return var->id;
 }
 
 
@@ -65,15 +79,11 @@ dres_add_factvar(dres_t *dres, char *name)
 int
 dres_factvar_id(dres_t *dres, char *name)
 {
-    dres_variable_t *var;
-    int              i;
+    int idx;
+
+    if ((idx = dres_symtab_lookup(&dres->fsymtab, name)) >= 0)
+        return dres->factvars[idx].id;
 
-    if (name != NULL)
-        for (i = 0, var = dres->factvars; i < dres->nfactvar; i++, var++) {
-            if (!strcmp(name, var->name))
-                return var->id;
-        }
-    
     return dres_add_factvar(dres, name);
 }
 
@@ -108,8 +118,11 @@ dres_free_factvars(dres_t *dres)
     
     FREE(dres->factvars);
 
-    dres->factvars = NULL;
-    dres->nfactvar = 0;
+    dres->factvars   = NULL;
+    dres->nfactvar   = 0;
+    dres->maxfactvar = 0;
+
+    dres_symtab_free(&dres->fsymtab);
 }
 
 
@@ -181,7 +194,7 @@ dres_save_factvars(dres_t *dres, dres_buf_t *buf)
         dres_buf_wu32(buf, v->flags);
     }
     
-    return 0;
+    return dres_symtab_save(&dres->fsymtab, buf);
 }
 
 
@@ -206,7 +219,12 @@ dres_load_factvars(dres_t *dres, dres_buf_t *buf)
         v->flags = dres_buf_ru32(buf);
     }
     
-    return buf->error;
+    if (buf->error)
+        return buf->error;
+
+    return dres_symtab_load(&dres->fsymtab, buf, dres->factvars, dres->nfactvar,
+                            sizeof(*dres->factvars),
+                            offsetof(dres_variable_t, name));
 }
 
 
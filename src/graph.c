@@ -540,6 +540,171 @@ dres_sort_graph(dres_t *dres, dres_graph_t *graph)
 
 
 
+/*****************************************************************************
+ *                  *** reverse dependencies, dirty targets ***              *
+ *****************************************************************************/
+
+/********************
+ * depends_idx
+ ********************/
+static inline int
+depends_idx(dres_t *dres, int id)
+{
+    int idx = DRES_INDEX(id);
+    
+    switch (DRES_ID_TYPE(id)) {
+    case DRES_TYPE_DRESVAR: idx += dres->nfactvar; /* fall through */
+    case DRES_TYPE_FACTVAR: idx += dres->ntarget;  /* fall through */
+    case DRES_TYPE_TARGET:  return idx;
+    default:                return -1;
+    }
+}
+
+
+/********************
+ * dres_build_depends
+ ********************/
+int
+dres_build_depends(dres_t *dres)
+{
+    /*
+     * Notes:
+     *   This is the reverse of the prerequisites of all targets: for every
+     *   target, factvar and dresvar the list of targets that directly
+     *   depend on it, indexed the same way as dres_graph_t. Whenever the
+     *   stamp of a node is bumped its dependents are marked dirty and only
+     *   dirty targets are checked during goal resolution. Dirtiness is
+     *   only ever a hint, the stamps stay the source of truth, so marking
+     *   too much is always safe. A target with no prerequisites is never
+     *   cleared as it is always updated.
+     *
+     *   All the dependent lists share a single array of IDs which is
+     *   hanging off the first node.
+     */
+
+    dres_target_t *t;
+    dres_prereq_t *depends, *prq;
+    int           *ids, n, nid, i, j, idx;
+
+    dres_free_depends(dres);
+
+    if (DRES_TST_FLAG(dres, NO_PROPAGATION))
+        return 0;
+
+    n = dres->ntarget + dres->nfactvar + dres->ndresvar;
+    
+    if (n <= 0)
+        return 0;
+
+    if ((depends = ALLOC_ARR(typeof(*depends), n)) == NULL)
+        return ENOMEM;
+
+    nid = 0;
+    for (i = 0, t = dres->targets; i < dres->ntarget; i++, t++) {
+        if (t->prereqs == NULL)
+            continue;
+        for (j = 0; j < t->prereqs->nid; j++) {
+            if ((idx = depends_idx(dres, t->prereqs->ids[j])) < 0)
+                continue;
+            depends[idx].nid++;
+            nid++;
+        }
+    }
+
+    if ((ids = ALLOC_ARR(int, nid + 1)) == NULL) {
+        FREE(depends);
+        return ENOMEM;
+    }
+    
+    for (i = 0; i < n; i++) {
+        depends[i].ids = ids;
+        ids += depends[i].nid;
+        depends[i].nid = 0;
+    }
+
+    for (i = 0, t = dres->targets; i < dres->ntarget; i++, t++) {
+        if (t->prereqs == NULL)
+            continue;
+        for (j = 0; j < t->prereqs->nid; j++) {
+            if ((idx = depends_idx(dres, t->prereqs->ids[j])) < 0)
+                continue;
+            prq = depends + idx;
+            prq->ids[prq->nid++] = t->id;
+        }
+    }
+
+    if ((dres->dirty = ALLOC_ARR(unsigned char, dres->ntarget + 1)) == NULL) {
+        FREE(depends[0].ids);
+        FREE(depends);
+        return ENOMEM;
+    }
+
+    /* we know nothing about the current state, start out all dirty */
+    memset(dres->dirty, TRUE, dres->ntarget);
+    dres->depends = depends;
+
+    return 0;
+}
+
+
+/********************
+ * dres_free_depends
+ ********************/
+void
+dres_free_depends(dres_t *dres)
+{
+    if (dres->depends != NULL) {
+        FREE(dres->depends[0].ids);
+        FREE(dres->depends);
+        dres->depends = NULL;
+    }
+    
+    FREE(dres->dirty);
+    dres->dirty = NULL;
+}
+
+
+/********************
+ * dres_mark_depends
+ ********************/
+void
+dres_mark_depends(dres_t *dres, int id)
+{
+    dres_prereq_t *prq;
+    int            idx, i;
+
+    if (dres->depends == NULL || (idx = depends_idx(dres, id)) < 0)
+        return;
+    
+    prq = dres->depends + idx;
+
+    for (i = 0; i < prq->nid; i++)
+        dres->dirty[DRES_INDEX(prq->ids[i])] = TRUE;
+}
+
+
+/********************
+ * dres_mark_dirty
+ ********************/
+void
+dres_mark_dirty(dres_t *dres, int tid)
+{
+    if (dres->dirty != NULL)
+        dres->dirty[DRES_INDEX(tid)] = TRUE;
+}
+
+
+/********************
+ * dres_clear_dirty
+ ********************/
+void
+dres_clear_dirty(dres_t *dres, int tid)
+{
+    dres_target_t *target = dres->targets + DRES_INDEX(tid);
+
+    if (dres->dirty != NULL && target->prereqs != NULL)
+        dres->dirty[DRES_INDEX(tid)] = FALSE;
+}
 
 
 
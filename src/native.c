@@ -0,0 +1,330 @@
+/*************************************************************************
+This file is part of dres the resource policy dependency resolver.
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <dlfcn.h>
+
+#include <dres/dres.h>
+#include <dres/compiler.h>
+#include "dres-debug.h"
+
+
+static int native_path(const char *file, char *buf, size_t size);
+static void emit_string(FILE *fp, const char *s);
+
+
+/*****************************************************************************
+ *                      *** ahead-of-time compiled targets ***               *
+ *****************************************************************************/
+
+/********************
+ * dres_native_open
+ ********************/
+int
+dres_native_open(dres_t *dres, const char *file)
+{
+    /*
+     * Notes:
+     *   The native module of a ruleset is looked up next to the ruleset
+     *   file as <base>.DRES_SUFFIX_NATIVE, where base is the path of the
+     *   ruleset without its suffix. DRES_NATIVE_ENV can be used to give
+     *   the path of the module explicitly or to disable native code
+     *   altogether. A missing or unusable module is not an error, we just
+     *   keep running the bytecode.
+     */
+
+    const vm_aot_module_t *mod;
+    char                   path[PATH_MAX], *env;
+    void                  *h;
+
+    if ((env = getenv(DRES_NATIVE_ENV)) != NULL && *env) {
+        if (!strcmp(env, "0") || !strcmp(env, "off") || !strcmp(env, "no"))
+            return 0;
+        if (strlen(env) >= sizeof(path))
+            return 0;
+        strcpy(path, env);
+    }
+    else {
+        if (native_path(file, path, sizeof(path)) != 0 ||
+            access(path, R_OK) != 0)
+            return 0;
+    }
+    
+    if ((h = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+        DRES_WARNING("failed to load native module %s (%s)", path, dlerror());
+        return 0;
+    }
+
+    mod = (const vm_aot_module_t *)dlsym(h, VM_AOT_SYMBOL);
+
+    if (mod == NULL || mod->abi != VM_AOT_ABI ||
+        mod->wordsize != (int)sizeof(uintptr_t)) {
+        DRES_WARNING("native module %s does not match the VM ABI, ignored",
+                     path);
+        dlclose(h);
+        return 0;
+    }
+
+    DRES_INFO("loaded native module %s", path);
+    dres->native = h;
+
+    return dres_native_bind(dres);
+}
+
+
+/********************
+ * dres_native_bind
+ ********************/
+int
+dres_native_bind(dres_t *dres)
+{
+    /*
+     * Notes:
+     *   Called once the ruleset has been loaded and again once its targets
+     *   have been compiled. Only targets whose bytecode has not been bound
+     *   yet are considered, so subsequent calls are cheap. The method and
+     *   field tables of the module are checked against the live ones as
+     *   the code refers to both by index.
+     */
+
+    const vm_aot_module_t *mod;
+    const vm_aot_target_t *nt;
+    dres_target_t         *t;
+    vm_method_t           *m;
+    const char            *f;
+    int                    i, pending, nbound;
+
+    if (dres->native == NULL)
+        return 0;
+    
+    for (i = pending = 0, t = dres->targets; i < dres->ntarget; i++, t++)
+        if (t->code != NULL && t->code->native == NULL)
+            pending++;
+
+    if (!pending)
+        return 0;
+
+    mod = (const vm_aot_module_t *)dlsym(dres->native, VM_AOT_SYMBOL);
+
+    for (i = 0; i < mod->nmethod; i++) {
+        m = vm_method_by_id(&dres->vm, i);
+        if (m == NULL || m->name == NULL || strcmp(m->name, mod->methods[i]))
+            goto mismatch;
+    }
+
+    for (i = 0; i < mod->nfield; i++) {
+        f = vm_field_name(&dres->vm, i);
+        if (f == NULL || strcmp(f, mod->fields[i]))
+            goto mismatch;
+    }
+
+    *mod->api = vm_aot_api();
+    
+    for (i = nbound = 0, nt = mod->targets; i < mod->ntarget; i++, nt++) {
+        if ((t = dres_lookup_target(dres, (char *)nt->name)) == NULL ||
+            t->code == NULL || t->code->native != NULL)
+            continue;
+
+        if (t->code->nsize != nt->nsize ||
+            vm_chunk_checksum(t->code) != nt->checksum) {
+            DRES_INFO("native code of target %s is out of date", t->name);
+            continue;
+        }
+        
+        t->code->native = nt->code;
+        nbound++;
+    }
+    
+    DRES_INFO("using native code for %d of %d targets", nbound, pending);
+
+    return 0;
+
+ mismatch:
+    DRES_WARNING("native module does not match the ruleset, ignored");
+    dres_native_close(dres);
+    return 0;
+}
+
+
+/********************
+ * dres_native_close
+ ********************/
+void
+dres_native_close(dres_t *dres)
+{
+    dres_target_t *t;
+    int            i;
+    
+    if (dres->native == NULL)
+        return;
+
+    for (i = 0, t = dres->targets; i < dres->ntarget; i++, t++)
+        if (t->code != NULL)
+            t->code->native = NULL;
+
+    dlclose(dres->native);
+    dres->native = NULL;
+}
+
+
+/********************
+ * dres_native_emit
+ ********************/
+EXPORTED int
+dres_native_emit(dres_t *dres, const char *source, FILE *fp)
+{
+    dres_target_t *t;
+    vm_state_t    *vm = &dres->vm;
+    char           fn[64];
+    int            i, err;
+
+    if (!DRES_TST_FLAG(dres, ACTIONS_FINALIZED))
+        return EINVAL;
+
+    fprintf(fp, "/*\n * Native code for the targets of %s.\n", source);
+    fprintf(fp, " * Generated by dresc --emit-c, do not edit.\n */\n\n");
+    fprintf(fp, "#include <stdio.h>\n");
+    fprintf(fp, "#include <stdint.h>\n");
+    fprintf(fp, "#include <dres/vm.h>\n\n");
+    fprintf(fp, "static const vm_aot_api_t *api;\n\n");
+    fprintf(fp,
+            "#define EXECUTE(opcode, op) do {                             \\\n"
+            "        if ((status = api->instr[opcode](vm, op)) != 0)      \\\n"
+            "            return status;                                   \\\n"
+            "    } while (0)\n\n"
+            "#define BRANCH(op, label) do {                               \\\n"
+            "        if ((status = api->instr[VM_OP_BRANCH](vm, op)) < 0) \\\n"
+            "            return status;                                   \\\n"
+            "        if (status)                                          \\\n"
+            "            goto label;                                      \\\n"
+            "    } while (0)\n\n\n");
+
+    for (i = 0, t = dres->targets; i < dres->ntarget; i++, t++) {
+        if (t->code == NULL)
+            continue;
+        
+        fprintf(fp, "/*\n * target %s\n */\n\n", t->name);
+        snprintf(fn, sizeof(fn), "target_%d", i);
+        if ((err = vm_chunk_emit_c(t->code, fn, fp)) != 0)
+            return err;
+        fprintf(fp, "\n");
+    }
+
+    fprintf(fp, "static const char * const methods[] = {\n");
+    for (i = 0; i < vm->nmethod; i++) {
+        fprintf(fp, "    ");
+        emit_string(fp, vm->methods[i].name);
+        fprintf(fp, ",\n");
+    }
+    fprintf(fp, "    NULL\n};\n\n");
+    
+    fprintf(fp, "static const char * const fields[] = {\n");
+    for (i = 0; i < vm->nfield; i++) {
+        fprintf(fp, "    ");
+        emit_string(fp, vm_field_name(vm, i));
+        fprintf(fp, ",\n");
+    }
+    fprintf(fp, "    NULL\n};\n\n");
+
+    fprintf(fp, "static const vm_aot_target_t targets[] = {\n");
+    for (i = 0, t = dres->targets; i < dres->ntarget; i++, t++) {
+        if (t->code == NULL)
+            continue;
+        fprintf(fp, "    { ");
+        emit_string(fp, t->name);
+        fprintf(fp, ", 0x%08xU, %d, target_%d },\n",
+                vm_chunk_checksum(t->code), t->code->nsize, i);
+    }
+    fprintf(fp, "    { NULL, 0, 0, NULL }\n};\n\n");
+
+    fprintf(fp, "const vm_aot_module_t %s = {\n", VM_AOT_SYMBOL);
+    fprintf(fp, "    .abi      = VM_AOT_ABI,\n");
+    fprintf(fp, "    .wordsize = sizeof(uintptr_t),\n");
+    fprintf(fp, "    .methods  = methods,\n");
+    fprintf(fp, "    .nmethod  = sizeof(methods) / sizeof(methods[0]) - 1,\n");
+    fprintf(fp, "    .fields   = fields,\n");
+    fprintf(fp, "    .nfield   = sizeof(fields) / sizeof(fields[0]) - 1,\n");
+    fprintf(fp, "    .targets  = targets,\n");
+    fprintf(fp, "    .ntarget  = sizeof(targets) / sizeof(targets[0]) - 1,\n");
+    fprintf(fp, "    .api      = &api,\n");
+    fprintf(fp, "};\n");
+
+    return ferror(fp) ? EIO : 0;
+}
+
+
+/********************
+ * native_path
+ ********************/
+static int
+native_path(const char *file, char *buf, size_t size)
+{
+    const char *suffix;
+    size_t      len;
+    
+    len = strlen(file);
+    
+    if ((suffix = strrchr(file, '.')) != NULL && strchr(suffix, '/') == NULL &&
+        (!strcmp(suffix + 1, DRES_SUFFIX_BINARY) ||
+         !strcmp(suffix + 1, DRES_SUFFIX_PLAIN)))
+        len = suffix - file;
+
+    if (len + 1 + sizeof(DRES_SUFFIX_NATIVE) > size)
+        return EOVERFLOW;
+
+    snprintf(buf, size, "%.*s.%s", (int)len, file, DRES_SUFFIX_NATIVE);
+    
+    return 0;
+}
+
+
+/********************
+ * emit_string
+ ********************/
+static void
+emit_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for ( ; s && *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(fp, "\\%c", *s);
+        else if ((unsigned char)*s < ' ' || (unsigned char)*s >= 0x7f)
+            fprintf(fp, "\\%03o", (unsigned char)*s);
+        else
+            fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+
+/* 
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:set expandtab shiftwidth=4:
+ */
@@ -0,0 +1,282 @@
+/*************************************************************************
+This file is part of dres the resource policy dependency resolver.
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <dres/dres.h>
+#include <dres/compiler.h>
+
+
+/*****************************************************************************
+ *                         *** VM execution statistics ***                   *
+ *****************************************************************************/
+
+/********************
+ * dres_vm_stats_get
+ ********************/
+EXPORTED int
+dres_vm_stats_get(dres_t *dres, dres_vm_stats_t *stats)
+{
+    /*
+     * Notes:
+     *   Only opcodes and methods that have been executed since the last
+     *   reset are reported. The names point to VM-owned storage and stay
+     *   valid for as long as the corresponding method is not deleted. The
+     *   counter tables need to be released with dres_vm_stats_free. ENOSYS
+     *   is returned if the library has been compiled without statistics.
+     */
+
+    vm_state_t        *vm = &dres->vm;
+    vm_counter_t      *c;
+    dres_vm_counter_t *dc;
+    int                i, n;
+
+    memset(stats, 0, sizeof(*stats));
+
+    if (vm->stats == NULL)
+        return ENOSYS;
+    
+    for (i = n = 0, c = vm->stats->opcodes; i <= VM_OP_MAXCODE; i++, c++)
+        if (c->count > 0)
+            n++;
+
+    if (n > 0) {
+        if ((stats->opcodes = ALLOC_ARR(dres_vm_counter_t, n)) == NULL)
+            goto nomem;
+        
+        dc = stats->opcodes;
+        for (i = 0, c = vm->stats->opcodes; i <= VM_OP_MAXCODE; i++, c++) {
+            if (c->count > 0) {
+                dc->name  = vm_opcode_name(i) ?: "<invalid>";
+                dc->count = c->count;
+                dc->nsec  = c->nsec;
+                dc++;
+            }
+        }
+        stats->nopcode = n;
+    }
+    
+    for (i = n = 0, c = vm->stats->methods; i < vm->stats->nmethod; i++, c++)
+        if (c->count > 0 && i < vm->nmethod)
+            n++;
+    
+    if (n > 0) {
+        if ((stats->methods = ALLOC_ARR(dres_vm_counter_t, n)) == NULL)
+            goto nomem;
+        
+        dc = stats->methods;
+        for (i = 0, c = vm->stats->methods; i < vm->stats->nmethod; i++, c++) {
+            if (c->count > 0 && i < vm->nmethod) {
+                dc->name  = vm->methods[i].name ?: "<unknown>";
+                dc->count = c->count;
+                dc->nsec  = c->nsec;
+                dc++;
+            }
+        }
+        stats->nmethod = n;
+    }
+    
+    return 0;
+
+ nomem:
+    dres_vm_stats_free(stats);
+    return ENOMEM;
+}
+
+
+/********************
+ * dres_vm_stats_free
+ ********************/
+EXPORTED void
+dres_vm_stats_free(dres_vm_stats_t *stats)
+{
+    if (stats != NULL) {
+        FREE(stats->opcodes);
+        FREE(stats->methods);
+        memset(stats, 0, sizeof(*stats));
+    }
+}
+
+
+/********************
+ * dres_vm_stats_reset
+ ********************/
+EXPORTED void
+dres_vm_stats_reset(dres_t *dres)
+{
+    vm_stats_reset(&dres->vm);
+}
+
+
+/*****************************************************************************
+ *                        *** target resolution statistics ***               *
+ *****************************************************************************/
+
+/********************
+ * dres_target_stats
+ ********************/
+dres_target_stats_t *
+dres_target_stats(dres_t *dres, dres_target_t *target)
+{
+    /*
+     * Notes:
+     *   The statistics are kept in a side table indexed by the target
+     *   index. The table is allocated on first use, by which time the set
+     *   of targets is final. If the allocation fails we simply do without.
+     */
+
+    int idx = (int)(target - dres->targets);
+
+    if (dres->tstats == NULL) {
+        if (dres->ntarget <= 0)
+            return NULL;
+        if ((dres->tstats = ALLOC_ARR(dres_target_stats_t,
+                                      dres->ntarget)) == NULL)
+            return NULL;
+    }
+    
+    if (idx < 0 || idx >= dres->ntarget)
+        return NULL;
+    
+    return dres->tstats + idx;
+}
+
+
+/********************
+ * dres_target_stats_run
+ ********************/
+void
+dres_target_stats_run(dres_t *dres, dres_target_t *target,
+                      int status, unsigned long long nsec)
+{
+    dres_target_stats_t *stats;
+    int                  bucket;
+
+    if ((stats = dres_target_stats(dres, target)) == NULL)
+        return;
+
+    stats->nrun++;
+    if (status == 0)
+        stats->nfail++;
+    else if (status < 0)
+        stats->nerror++;
+    
+    stats->nsec += nsec;
+    if (nsec > stats->maxnsec)
+        stats->maxnsec = nsec;
+    
+    bucket = nsec ? 63 - __builtin_clzll(nsec) : 0;
+    if (bucket >= DRES_STATS_NBUCKET)
+        bucket = DRES_STATS_NBUCKET - 1;
+    stats->hist[bucket]++;
+}
+
+
+/********************
+ * dres_target_stats_exit
+ ********************/
+void
+dres_target_stats_exit(dres_t *dres)
+{
+    FREE(dres->tstats);
+    dres->tstats = NULL;
+}
+
+
+/********************
+ * dres_target_stats_get
+ ********************/
+EXPORTED int
+dres_target_stats_get(dres_t *dres, dres_target_stats_t **stats, int *nstat)
+{
+    /*
+     * Notes:
+     *   Only targets that have been checked or updated since the last
+     *   reset are reported. Bucket i of the histogram counts the action
+     *   runs that took [2^i, 2^(i+1)) nanoseconds, the last bucket also
+     *   counts anything longer. The returned table needs to be released
+     *   with dres_target_stats_free.
+     */
+
+    dres_target_stats_t *s, *d;
+    int                  i, n;
+
+    *stats = NULL;
+    *nstat = 0;
+
+    if (dres->tstats == NULL)
+        return 0;
+    
+    for (i = n = 0, s = dres->tstats; i < dres->ntarget; i++, s++)
+        if (s->ncheck > 0 || s->nclean > 0 || s->nrun > 0 || s->ngoal > 0)
+            n++;
+    
+    if (n == 0)
+        return 0;
+
+    if ((*stats = ALLOC_ARR(dres_target_stats_t, n)) == NULL)
+        return ENOMEM;
+    
+    for (i = 0, s = dres->tstats, d = *stats; i < dres->ntarget; i++, s++) {
+        if (s->ncheck > 0 || s->nclean > 0 || s->nrun > 0 || s->ngoal > 0) {
+            *d      = *s;
+            d->name = dres->targets[i].name;
+            d++;
+        }
+    }
+    *nstat = n;
+    
+    return 0;
+}
+
+
+/********************
+ * dres_target_stats_free
+ ********************/
+EXPORTED void
+dres_target_stats_free(dres_target_stats_t *stats)
+{
+    FREE(stats);
+}
+
+
+/********************
+ * dres_target_stats_reset
+ ********************/
+EXPORTED void
+dres_target_stats_reset(dres_t *dres)
+{
+    if (dres->tstats != NULL)
+        memset(dres->tstats, 0, dres->ntarget * sizeof(*dres->tstats));
+}
+
+
+/* 
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:set expandtab shiftwidth=4:
+ */
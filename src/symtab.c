@@ -0,0 +1,243 @@
+/*************************************************************************
+This file is part of dres the resource policy dependency resolver.
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include <dres/dres.h>
+#include "dres-debug.h"
+
+#define SYMTAB_MIN_SIZE 16                  /* initial table size */
+
+#define SYMTAB_NAME(base, size, offs, idx)                              \
+    (*(char **)((char *)(base) + (idx) * (size) + (offs)))
+
+
+/*****************************************************************************
+ *                       *** hash-indexed symbol tables ***                  *
+ *****************************************************************************/
+
+/********************
+ * symtab_hash
+ ********************/
+static inline unsigned int
+symtab_hash(const char *name)
+{
+    unsigned int h = 2166136261U;                  /* 32-bit FNV-1a */
+
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+
+/********************
+ * symtab_insert
+ ********************/
+static void
+symtab_insert(dres_symbol_t *symbols, int nsymbol, char *name, int idx)
+{
+    unsigned int mask, i;
+
+    mask = nsymbol - 1;
+    for (i = symtab_hash(name) & mask; symbols[i].name; i = (i + 1) & mask)
+        ;
+
+    symbols[i].name = name;
+    symbols[i].idx  = idx;
+}
+
+
+/********************
+ * dres_symtab_add
+ ********************/
+int
+dres_symtab_add(dres_symtab_t *st, char *name, int idx)
+{
+    /*
+     * Notes:
+     *   The table is open-addressed with linear probing and is kept at
+     *   most half full, doubling its size when necessary. Symbols only
+     *   point to the names, which are owned by the target or variable
+     *   the symbol stands for.
+     */
+
+    dres_symbol_t *symbols;
+    int            nsymbol, i;
+
+    if (2 * (st->nused + 1) > st->nsymbol) {
+        nsymbol = st->nsymbol ? 2 * st->nsymbol : SYMTAB_MIN_SIZE;
+
+        if ((symbols = ALLOC_ARR(dres_symbol_t, nsymbol)) == NULL)
+            return ENOMEM;
+
+        for (i = 0; i < st->nsymbol; i++)
+            if (st->symbols[i].name != NULL)
+                symtab_insert(symbols, nsymbol,
+                              st->symbols[i].name, st->symbols[i].idx);
+
+        FREE(st->symbols);
+        st->symbols = symbols;
+        st->nsymbol = nsymbol;
+    }
+
+    symtab_insert(st->symbols, st->nsymbol, name, idx);
+    st->nused++;
+
+    return 0;
+}
+
+
+/********************
+ * dres_symtab_lookup
+ ********************/
+int
+dres_symtab_lookup(dres_symtab_t *st, const char *name)
+{
+    dres_symbol_t *s;
+    unsigned int   mask, i;
+
+    if (name == NULL || st->nsymbol == 0)
+        return -1;
+
+    mask = st->nsymbol - 1;
+    for (i = symtab_hash(name) & mask; ; i = (i + 1) & mask) {
+        s = st->symbols + i;
+        if (s->name == NULL)
+            return -1;
+        if (!strcmp(s->name, name))
+            return s->idx;
+    }
+}
+
+
+/********************
+ * dres_symtab_free
+ ********************/
+void
+dres_symtab_free(dres_symtab_t *st)
+{
+    FREE(st->symbols);
+    st->symbols = NULL;
+    st->nsymbol = 0;
+    st->nused   = 0;
+}
+
+
+/********************
+ * dres_symtab_save
+ ********************/
+int
+dres_symtab_save(dres_symtab_t *st, dres_buf_t *buf)
+{
+    /*
+     * Notes:
+     *   We save the table as is, as an array of indices in network byte
+     *   order, -1 for empty slots, padded for alignment. Names are not
+     *   saved, they get bound from the loaded targets or variables, so
+     *   loading does not need to hash or compare anything.
+     */
+
+    int32_t *idx;
+    int      size, i;
+
+    dres_buf_ws32(buf, st->nsymbol);
+    dres_buf_ws32(buf, st->nused);
+
+    if (st->nsymbol == 0)
+        return buf->error;
+
+    size = DRES_ALIGN_TO(st->nsymbol * sizeof(*idx), DRES_ALIGNMENT);
+
+    if ((idx = dres_buf_alloc(buf, size)) == NULL)
+        return ENOMEM;
+
+    memset(idx, 0, size);
+    for (i = 0; i < st->nsymbol; i++)
+        idx[i] = htonl(st->symbols[i].name ? st->symbols[i].idx : -1);
+
+    buf->header.nsymbol += st->nsymbol;
+
+    return buf->error;
+}
+
+
+/********************
+ * dres_symtab_load
+ ********************/
+int
+dres_symtab_load(dres_symtab_t *st, dres_buf_t *buf,
+                 void *base, int nentry, size_t size, size_t offs)
+{
+    int32_t *idx;
+    int      i, n;
+
+    st->symbols = NULL;
+    st->nsymbol = dres_buf_rs32(buf);
+    st->nused   = dres_buf_rs32(buf);
+
+    if (st->nsymbol == 0)
+        return buf->error;
+
+    /* make sure a corrupt file cannot send lookups off the rails */
+    if (st->nsymbol & (st->nsymbol - 1) || 2 * st->nused > st->nsymbol)
+        return EINVAL;
+
+    n   = DRES_ALIGN_TO(st->nsymbol * sizeof(*idx), DRES_ALIGNMENT);
+    idx = (int32_t *)dres_buf_rbuf(buf, n);
+
+    if (idx == NULL)
+        return buf->error ? buf->error : ENOMEM;
+
+    st->symbols = dres_buf_alloc(buf, st->nsymbol * sizeof(*st->symbols));
+
+    if (st->symbols == NULL)
+        return ENOMEM;
+
+    for (i = 0; i < st->nsymbol; i++) {
+        n = ntohl(idx[i]);
+        
+        if (n >= nentry)
+            return EINVAL;
+        
+        st->symbols[i].idx  = n;
+        st->symbols[i].name = n < 0 ? NULL : SYMTAB_NAME(base, size, offs, n);
+    }
+
+    return buf->error;
+}
+
+
+/* 
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:set expandtab shiftwidth=4:
+ */
@@ -22,6 +22,7 @@ USA.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <errno.h>
 #include <arpa/inet.h>
@@ -42,22 +43,35 @@ int
 dres_add_target(dres_t *dres, char *name)
 {
     dres_target_t *target;
-    int            id;
+    int            id, n;
 
     /* don't create new vars if we resolve or run a precompiled file */
     if (DRES_TST_FLAG(dres, TARGETS_FINALIZED) || DRES_TST_FLAG(dres, COMPILED))
         return DRES_ID_NONE;
     
-    if (REALLOC_ARR(dres->targets, dres->ntarget, dres->ntarget + 1) == NULL)
-        return DRES_ID_NONE;
+    if (dres->ntarget >= dres->maxtarget) {
+        n = dres->maxtarget ? 2 * dres->maxtarget : DRES_ALLOC_MIN;
+        if (REALLOC_ARR(dres->targets, dres->maxtarget, n) == NULL)
+            return DRES_ID_NONE;
+        dres->maxtarget = n;
+    }
 
-    id     = dres->ntarget++;
+    id     = dres->ntarget;
     target = dres->targets + id;
     
-    target->id   = DRES_UNDEFINED(DRES_TARGET(id));
-    target->name = STRDUP(name);
+    if ((target->name = STRDUP(name)) == NULL)
+        return DRES_ID_NONE;
 
-    return target->name ? target->id : DRES_ID_NONE;
+    if (dres_symtab_add(&dres->tsymtab, target->name, id) != 0) {
+        FREE(target->name);
+        target->name = NULL;
+        return DRES_ID_NONE;
+    }
+
+    dres->ntarget++;
+    target->id = DRES_UNDEFINED(DRES_TARGET(id));
+
+    return target->id;
 }
 
 
@@ -67,14 +81,10 @@ dres_add_target(dres_t *dres, char *name)
 int
 dres_target_id(dres_t *dres, char *name)
 {
-    dres_target_t *target;
-    int            i;
+    int idx;
 
-    if (name != NULL)
-        for (i = 0, target = dres->targets; i < dres->ntarget; i++, target++) {
-            if (!strcmp(name, target->name))
-                return target->id;
-        }
+    if ((idx = dres_symtab_lookup(&dres->tsymtab, name)) >= 0)
+        return dres->targets[idx].id;
     
     return dres_add_target(dres, name);
 }
@@ -86,14 +96,12 @@ dres_target_id(dres_t *dres, char *name)
 dres_target_t *
 dres_lookup_target(dres_t *dres, char *name)
 {
-    dres_target_t *target;
-    int            i, id;
+    int idx, id;
     
-    for (i = 0, target = dres->targets; i < dres->ntarget; i++, target++)
-        if (!strcmp(name, target->name))
-            return target;
+    if ((idx = dres_symtab_lookup(&dres->tsymtab, name)) >= 0)
+        return dres->targets + idx;
     
-    if ((id = dres_target_id(dres, name)) == DRES_ID_NONE)
+    if ((id = dres_add_target(dres, name)) == DRES_ID_NONE)
         return NULL;
     else
         return dres->targets + DRES_INDEX(id);
@@ -118,8 +126,11 @@ dres_free_targets(dres_t *dres)
     }
 
     FREE(dres->targets);
-    dres->targets = NULL;
-    dres->ntarget = 0;
+    dres->targets   = NULL;
+    dres->ntarget   = 0;
+    dres->maxtarget = 0;
+
+    dres_symtab_free(&dres->tsymtab);
 }
 
 
@@ -199,16 +210,20 @@ dres_dump_targets(dres_t *dres)
 int
 dres_check_target(dres_t *dres, int tid)
 {
-    dres_target_t *target, *t;
-    dres_prereq_t *prq;
-    int            i, id, update, status;
-    char           buf[32];
+    dres_target_t       *target, *t;
+    dres_target_stats_t *stats;
+    dres_prereq_t       *prq;
+    int                  i, id, update, status;
+    char                 buf[32];
 
     DEBUG(DBG_RESOLVE, "checking target %s",
           dres_name(dres, tid, buf, sizeof(buf)));
 
     target = dres->targets + DRES_INDEX(tid);
     
+    if ((stats = dres_target_stats(dres, target)) != NULL)
+        stats->ncheck++;
+
     if ((prq = target->prereqs) == NULL) {
         DEBUG(DBG_RESOLVE, "no prereqs (always update)");
         update = TRUE;
@@ -250,7 +265,12 @@ dres_check_target(dres_t *dres, int tid)
     else {
         DEBUG(DBG_RESOLVE, "=> %s already up-to-date", target->name);
         status = TRUE;
+        if (stats != NULL)
+            stats->nskip++;
     }
+
+    if (status > 0)
+        dres_clear_dirty(dres, tid);
     
     return status;
 }
@@ -290,6 +310,7 @@ dres_save_targets(dres_t *dres, dres_buf_t *buf)
         else {
             dres_buf_ws32(buf, t->code->ninstr);
             dres_buf_ws32(buf, t->code->nsize);
+            dres_buf_ws32(buf, t->code->maxdepth);
             
 #if 1
             dres_buf_wbuf(buf, (char *)t->code->instrs, t->code->nsize);
@@ -316,6 +337,9 @@ dres_save_targets(dres_t *dres, dres_buf_t *buf)
         }
     }
 
+    if (dres_symtab_save(&dres->tsymtab, buf) != 0)
+        return buf->error ? buf->error : ENOMEM;
+
     return buf->error;
 }
 
@@ -376,8 +400,9 @@ dres_load_targets(dres_t *dres, dres_buf_t *buf)
             if (t->code == NULL)
                 return ENOMEM;
 
-            t->code->ninstr = n;
-            t->code->nsize  = dres_buf_rs32(buf);
+            t->code->ninstr   = n;
+            t->code->nsize    = dres_buf_rs32(buf);
+            t->code->maxdepth = dres_buf_rs32(buf);
             
 #if 1 /* XXX TODO: this is broken wrt. endianness */
             t->code->instrs = (uintptr_t *)dres_buf_rbuf(buf,t->code->nsize);
@@ -409,7 +434,12 @@ dres_load_targets(dres_t *dres, dres_buf_t *buf)
         }
     }
 
-    return buf->error;
+    if (buf->error)
+        return buf->error;
+    
+    return dres_symtab_load(&dres->tsymtab, buf, dres->targets, dres->ntarget,
+                            sizeof(*dres->targets),
+                            offsetof(dres_target_t, name));
 }
 
 
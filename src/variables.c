@@ -35,6 +35,10 @@ USA.
 #include "dres-debug.h"
 
 
+static void fact_changed(OhmFactStore *fs, OhmFact *fact, gpointer data);
+static void fact_updated(gpointer data, OhmFact *fact);
+
+
 /********************
  * dres_store_init
  ********************/
@@ -47,14 +51,24 @@ dres_store_init(dres_t *dres)
     if ((fs = ohm_get_fact_store()) == NULL)
         return ENOENT;
     
-    if ((ht = g_hash_table_new_full(g_str_hash,g_str_equal,NULL,NULL)) == NULL)
+    if ((ht = g_hash_table_new(g_direct_hash, g_direct_equal)) == NULL)
         return ENOMEM;
     
-    dres->store.fs   = fs;
-    dres->store.ht   = ht;
-    dres->store.view = NULL;
+    dres->store.fs      = fs;
+    dres->store.ht      = ht;
+    dres->store.view    = NULL;
+    dres->store.gen     = 1;
+    dres->store.checked = 0;
 
     g_object_ref(fs);
+
+    if (vm_global_cache_init(&dres->vm) != 0)
+        return ENOMEM;
+
+    g_signal_connect(G_OBJECT(fs), "inserted", G_CALLBACK(fact_changed), dres);
+    g_signal_connect(G_OBJECT(fs), "removed" , G_CALLBACK(fact_changed), dres);
+    g_signal_connect_swapped(G_OBJECT(fs), "updated",
+                             G_CALLBACK(fact_updated), dres);
     
     return 0;
 }
@@ -94,9 +108,69 @@ dres_store_free(dres_t *dres)
     }
     
     if (store->fs) {
+        g_signal_handlers_disconnect_by_func(G_OBJECT(store->fs),
+                                             G_CALLBACK(fact_changed), dres);
+        g_signal_handlers_disconnect_by_func(G_OBJECT(store->fs),
+                                             G_CALLBACK(fact_updated), dres);
         g_object_unref(store->fs);
         store->fs = NULL;
     }
+
+    vm_global_cache_exit(&dres->vm);
+
+    FREE(dres->touched);
+    dres->touched    = NULL;
+    dres->ntouched   = 0;
+    dres->maxtouched = 0;
+}
+
+
+/********************
+ * fact_changed
+ ********************/
+static void
+fact_changed(OhmFactStore *fs, OhmFact *fact, gpointer data)
+{
+    dres_t     *dres = (dres_t *)data;
+    const char *name = ohm_structure_get_name(OHM_STRUCTURE(fact));
+
+    (void)fs;
+    
+    dres->store.gen++;
+    vm_global_cache_invalidate(&dres->vm, name);
+}
+
+
+/********************
+ * fact_updated
+ ********************/
+static void
+fact_updated(gpointer data, OhmFact *fact)
+{
+    /*
+     * Notes:
+     *   Connected swapped, we only care about the updated fact and
+     *   reset all of the indexes of facts with the same name.
+     */
+
+    dres_t     *dres = (dres_t *)data;
+    const char *name = ohm_structure_get_name(OHM_STRUCTURE(fact));
+
+    dres->store.gen++;
+    vm_index_reset(&dres->vm, name, 0);
+}
+
+
+/********************
+ * dres_cache_stats
+ ********************/
+EXPORTED void
+dres_cache_stats(dres_t *dres, unsigned int *nhit, unsigned int *nmiss)
+{
+    if (nhit != NULL)
+        *nhit = dres->vm.nglobalhit;
+    if (nmiss != NULL)
+        *nmiss = dres->vm.nglobalmiss;
 }
 
 
@@ -129,7 +203,9 @@ dres_store_track(dres_t *dres)
 
         ohm_fact_store_view_add(store->view, OHM_STRUCTURE(pattern));
         g_object_unref(pattern);
-        g_hash_table_insert(store->ht, (gpointer)name, GINT_TO_POINTER(id));
+        g_hash_table_insert(store->ht,
+                            GUINT_TO_POINTER(g_quark_from_string(name)),
+                            GINT_TO_POINTER(id));
     }
 
     return 0;
@@ -142,9 +218,23 @@ dres_store_track(dres_t *dres)
 int
 dres_store_check(dres_t *dres)
 {
+    /*
+     * Notes:
+     *   Any change to a tracked fact also goes through one of our fact
+     *   store signal handlers, which bump store->gen. If it has not moved
+     *   since our last check the view cannot have any changes for us and
+     *   we can skip asking for them. This is the common case for nested
+     *   resolutions.
+     *
+     *   Changes are mapped to factvars by the quark of the fact name, with
+     *   a single entry cache in front of the hash table for bursts of
+     *   changes to the same fact. Each factvar is stamped only once per
+     *   check, subsequent changes to it find it already up-to-date.
+     */
+
     dres_store_t    *store = &dres->store;
     dres_variable_t *var;
-    const char      *name;
+    GQuark           qname, qlast;
     int              id, idx, updated;
     GSList          *changes, *l;
     OhmFact         *fact;
@@ -153,9 +243,16 @@ dres_store_check(dres_t *dres)
 
     if (store->view == NULL)
         return ENOENT;
+
+    if (store->checked == store->gen)
+        return FALSE;
+    
+    store->checked = store->gen;
     
     updated = FALSE;
     if ((changes = ohm_view_get_changes(store->view)) != NULL) {
+        qlast = 0;
+        id    = 0;
         for (l = changes; l != NULL; l = g_slist_next(l)) {
             if (!OHM_PATTERN_IS_MATCH(l->data)) {
                 DRES_ERROR("%s: invalid data from view", __FUNCTION__);
@@ -164,32 +261,39 @@ dres_store_check(dres_t *dres)
             
             match = OHM_PATTERN_MATCH(l->data);
             fact  = ohm_pattern_match_get_fact(match);
-            name  = ohm_structure_get_name(OHM_STRUCTURE(fact));
-            id    = GPOINTER_TO_INT(g_hash_table_lookup(store->ht, name));
+            qname = ohm_structure_get_qname(OHM_STRUCTURE(fact));
+
+            if (qname != qlast) {
+                id    = GPOINTER_TO_INT(g_hash_table_lookup(store->ht,
+                                                  GUINT_TO_POINTER(qname)));
+                qlast = qname;
+            }
 
 #if 0
-            DRES_INFO("variable '%s' has changed", name);
+            DRES_INFO("variable '%s' has changed", g_quark_to_string(qname));
 #endif
 
             if (!id) {
-                DRES_ERROR("%s: unkown variable %s", __FUNCTION__, name);
+                DRES_ERROR("%s: unkown variable %s", __FUNCTION__,
+                           g_quark_to_string(qname));
                 continue;
             }
 
             if (DRES_ID_TYPE(id) != DRES_TYPE_FACTVAR) {
                 DRES_ERROR("%s: got invalid type for variable %s (0x%x)",
-                           __FUNCTION__, name, id);
+                           __FUNCTION__, g_quark_to_string(qname), id);
                 continue;
             }
             
             if ((idx = DRES_INDEX(id)) >= dres->nfactvar) {
                 DRES_ERROR("%s: invalid index %d for variable %s",
-                           __FUNCTION__, idx, name);
+                           __FUNCTION__, idx, g_quark_to_string(qname));
                 continue;
             }
             
             var = dres->factvars + idx;
-            dres_update_var_stamp(dres, var);
+            if (var->stamp != dres->stamp)
+                dres_update_var_stamp(dres, var);
             
             updated = TRUE;
         }
@@ -201,11 +305,20 @@ dres_store_check(dres_t *dres)
 }
 
 
+/********************
+ * dres_store_tx_new
+ ********************/
 int
 dres_store_tx_new(dres_t *dres)
 {
     dres_store_t *store = &dres->store;
 
+    dres->ntouched = 0;
+    if (dres_store_tx_savepoint(dres) < 0)
+        return FALSE;
+
+    DRES_CLR_FLAG(dres, TRANSACTION_FAILED);
+
     ohm_fact_store_transaction_push(store->fs);
     DRES_SET_FLAG(dres, TRANSACTION_ACTIVE);
 
@@ -215,6 +328,9 @@ dres_store_tx_new(dres_t *dres)
 }
 
 
+/********************
+ * dres_store_tx_commit
+ ********************/
 int
 dres_store_tx_commit(dres_t *dres)
 {
@@ -222,6 +338,7 @@ dres_store_tx_commit(dres_t *dres)
     
     ohm_fact_store_transaction_pop(store->fs, FALSE);
     DRES_CLR_FLAG(dres, TRANSACTION_ACTIVE);
+    dres->ntouched = 0;
 
     DEBUG(DBG_VAR, "committed transaction");
 
@@ -229,24 +346,37 @@ dres_store_tx_commit(dres_t *dres)
 }
 
 
+/********************
+ * dres_store_tx_rollback
+ ********************/
 int
 dres_store_tx_rollback(dres_t *dres)
 {
-    dres_store_t    *store = &dres->store;
-    dres_target_t   *t;
-    dres_variable_t *var;
-    int              i;
+    dres_store_t  *store = &dres->store;
+    dres_target_t *target;
+    int            i;
 
     ohm_fact_store_transaction_pop(store->fs, TRUE);
     DRES_CLR_FLAG(dres, TRANSACTION_ACTIVE);
 
-    for (i = 0, t = dres->targets; i < dres->ntarget; i++, t++)
-        if (t->txid == dres->txid)
-            t->stamp = t->txstamp;
-
-    for (i = 0, var = dres->dresvars; i < dres->ndresvar; i++, var++)
-        if (var->txid == dres->txid)
-            var->stamp = var->txstamp;
+    /* rollback reinstates facts behind our back, forget what we've seen */
+    vm_global_cache_flush(&dres->vm);
+    store->gen++;
+
+    dres_store_tx_rollback_to(dres, 0);
+
+    /*
+     * Notes:
+     *   If a stamp change could not be logged we cannot restore it, so we
+     *   make every target outdated instead to have them all rechecked.
+     */
+    if (DRES_TST_FLAG(dres, TRANSACTION_FAILED)) {
+        for (i = 0, target = dres->targets; i < dres->ntarget; i++, target++) {
+            target->stamp = 0;
+            dres_mark_dirty(dres, target->id);
+        }
+        DRES_CLR_FLAG(dres, TRANSACTION_FAILED);
+    }
 
     DEBUG(DBG_VAR, "rolled back transaction");
     
@@ -254,6 +384,98 @@ dres_store_tx_rollback(dres_t *dres)
 }
 
 
+/********************
+ * dres_store_tx_savepoint
+ ********************/
+int
+dres_store_tx_savepoint(dres_t *dres)
+{
+    /*
+     * Notes:
+     *   A savepoint is just a position in the touched list and a fresh
+     *   txid. Every target and dresvar is logged at most once per txid,
+     *   the first time its stamp changes, with the stamp and txid it had
+     *   before. Rolling back to a savepoint undoes the entries after it
+     *   in reverse order. Releasing one needs nothing, its entries simply
+     *   become part of the enclosing transaction or savepoint.
+     *
+     *   We reserve room for logging all targets and dresvars up front so
+     *   that logging itself can never fail.
+     */
+
+    int n = dres->ntouched + dres->ntarget + dres->ndresvar;
+
+    if (n > dres->maxtouched) {
+        if (REALLOC_ARR(dres->touched, dres->maxtouched, n) == NULL)
+            return -1;
+        dres->maxtouched = n;
+    }
+    
+    dres->txid++;
+
+    return dres->ntouched;
+}
+
+
+/********************
+ * dres_store_tx_touch
+ ********************/
+void
+dres_store_tx_touch(dres_t *dres, int id, int stamp, int txid)
+{
+    dres_touched_t *t;
+
+    if (!DRES_TST_FLAG(dres, TRANSACTION_ACTIVE))
+        return;
+
+    /* room is reserved by dres_store_tx_savepoint, running out is a bug */
+    if (dres->ntouched >= dres->maxtouched) {
+        DRES_ERROR("BUG: no room to log the stamp of 0x%x, "
+                   "failing transaction", id);
+        DRES_SET_FLAG(dres, TRANSACTION_FAILED);
+        return;
+    }
+    
+    t = dres->touched + dres->ntouched++;
+    t->id    = id;
+    t->stamp = stamp;
+    t->txid  = txid;
+}
+
+
+/********************
+ * dres_store_tx_rollback_to
+ ********************/
+void
+dres_store_tx_rollback_to(dres_t *dres, int savepoint)
+{
+    dres_touched_t  *t;
+    dres_target_t   *target;
+    dres_variable_t *var;
+    
+    while (dres->ntouched > savepoint) {
+        t = dres->touched + --dres->ntouched;
+
+        switch (DRES_ID_TYPE(t->id)) {
+        case DRES_TYPE_TARGET:
+            /* a target with a reinstated stamp might be outdated again */
+            target        = dres->targets + DRES_INDEX(t->id);
+            target->stamp = t->stamp;
+            target->txid  = t->txid;
+            dres_mark_dirty(dres, t->id);
+            break;
+            
+        case DRES_TYPE_DRESVAR:
+            var        = dres->dresvars + DRES_INDEX(t->id);
+            var->stamp = t->stamp;
+            var->txid  = t->txid;
+            dres_mark_depends(dres, t->id);
+            break;
+        }
+    }
+}
+
+
 
 /* 
  * Local Variables:
@@ -0,0 +1,227 @@
+/*************************************************************************
+This file is part of dres the resource policy dependency resolver.
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <dres/mm.h>
+#include <dres/vm.h>
+
+
+int vm_instr_push   (vm_state_t *vm, vm_op_t *op);
+int vm_instr_pop    (vm_state_t *vm, vm_op_t *op);
+int vm_instr_filter (vm_state_t *vm, vm_op_t *op);
+int vm_instr_update (vm_state_t *vm, vm_op_t *op);
+int vm_instr_set    (vm_state_t *vm, vm_op_t *op);
+int vm_instr_get    (vm_state_t *vm, vm_op_t *op);
+int vm_instr_create (vm_state_t *vm, vm_op_t *op);
+int vm_instr_call   (vm_state_t *vm, vm_op_t *op);
+int vm_instr_cmp    (vm_state_t *vm, vm_op_t *op);
+int vm_instr_branch (vm_state_t *vm, vm_op_t *op);
+int vm_instr_debug  (vm_state_t *vm, vm_op_t *op);
+int vm_instr_replace(vm_state_t *vm, vm_op_t *op);
+int vm_instr_load   (vm_state_t *vm, vm_op_t *op);
+
+
+static const vm_aot_api_t aot_api = {
+    .abi   = VM_AOT_ABI,
+    .instr = {
+        [VM_OP_PUSH]    = vm_instr_push,
+        [VM_OP_POP]     = vm_instr_pop,
+        [VM_OP_FILTER]  = vm_instr_filter,
+        [VM_OP_UPDATE]  = vm_instr_update,
+        [VM_OP_SET]     = vm_instr_set,
+        [VM_OP_GET]     = vm_instr_get,
+        [VM_OP_CREATE]  = vm_instr_create,
+        [VM_OP_CALL]    = vm_instr_call,
+        [VM_OP_CMP]     = vm_instr_cmp,
+        [VM_OP_BRANCH]  = vm_instr_branch,
+        [VM_OP_DEBUG]   = vm_instr_debug,
+        [VM_OP_REPLACE] = vm_instr_replace,
+        [VM_OP_LOAD]    = vm_instr_load,
+    },
+};
+
+
+static const char *opcodes[VM_AOT_NINSTR] = {
+    [VM_OP_PUSH]    = "VM_OP_PUSH",
+    [VM_OP_POP]     = "VM_OP_POP",
+    [VM_OP_FILTER]  = "VM_OP_FILTER",
+    [VM_OP_UPDATE]  = "VM_OP_UPDATE",
+    [VM_OP_SET]     = "VM_OP_SET",
+    [VM_OP_GET]     = "VM_OP_GET",
+    [VM_OP_CREATE]  = "VM_OP_CREATE",
+    [VM_OP_CALL]    = "VM_OP_CALL",
+    [VM_OP_CMP]     = "VM_OP_CMP",
+    [VM_OP_BRANCH]  = "VM_OP_BRANCH",
+    [VM_OP_DEBUG]   = "VM_OP_DEBUG",
+    [VM_OP_HALT]    = "VM_OP_HALT",
+    [VM_OP_REPLACE] = "VM_OP_REPLACE",
+    [VM_OP_LOAD]    = "VM_OP_LOAD",
+};
+
+
+/********************
+ * vm_aot_api
+ ********************/
+const vm_aot_api_t *
+vm_aot_api(void)
+{
+    return &aot_api;
+}
+
+
+/********************
+ * vm_chunk_checksum
+ ********************/
+unsigned int
+vm_chunk_checksum(vm_chunk_t *c)
+{
+    /* a 32-bit FNV-1a hash of the bytecode */
+
+    unsigned char *p;
+    unsigned int   hash;
+    int            i;
+
+    hash = 2166136261U;
+    for (i = 0, p = (unsigned char *)c->instrs; i < c->nsize; i++, p++) {
+        hash ^= *p;
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+
+/********************
+ * vm_chunk_emit_c
+ ********************/
+int
+vm_chunk_emit_c(vm_chunk_t *c, const char *fn, FILE *fp)
+{
+    /*
+     * Notes:
+     *   The chunk is emitted as three pieces: a copy of the bytecode that
+     *   strings and LOAD selectors keep pointing into, a table of decoded
+     *   operations and the function fn itself. The function relies on the
+     *   EXECUTE and BRANCH macros provided by the caller in the prologue of
+     *   the generated file. Labels are only generated for branch targets.
+     */
+
+    vm_op_t   *op;
+    char      *base, *end;
+    int       *label, nop, i, err;
+
+    if (c->ops == NULL && (err = vm_chunk_decode(c)) != 0)
+        return err;
+
+    for (nop = 0, op = c->ops; op->size != 0; op++)
+        nop++;
+
+    if ((label = ALLOC_ARR(int, nop + 1)) == NULL)
+        return ENOMEM;
+
+    for (i = 0, op = c->ops; i < nop; i++, op++)
+        if (op->code == VM_OP_BRANCH)
+            label[op->imm.branch - c->ops] = TRUE;
+
+    base = (char *)c->instrs;
+    end  = base + c->nsize;
+
+    fprintf(fp, "static uintptr_t %s_code[] = {", fn);
+    for (i = 0; i < (int)(c->nsize / sizeof(uintptr_t)); i++)
+        fprintf(fp, "%s%s0x%" PRIxPTR, i ? "," : "", i % 4 ? " " : "\n    ",
+                c->instrs[i]);
+    fprintf(fp, "\n};\n\n");
+    
+    fprintf(fp, "static vm_op_t %s_ops[] = {\n", fn);
+    for (i = 0, op = c->ops; i < nop; i++, op++) {
+        fprintf(fp, "    { .code = %s, .type = %d, .arg = %d, .size = %d",
+                opcodes[op->code], op->type, op->arg, op->size);
+        
+        switch (op->code) {
+        case VM_OP_BRANCH:
+            break;
+        case VM_OP_PUSH:
+            if (op->type == VM_TYPE_INTEGER) {
+                fprintf(fp, ", .imm.i = %d", op->imm.i);
+                break;
+            }
+            if (op->type == VM_TYPE_DOUBLE) {
+                fprintf(fp, ", .imm.d = %a", op->imm.d);
+                break;
+            }
+            /* fall through */
+        default:
+            if (base <= op->imm.s && op->imm.s < end)
+                fprintf(fp, ", .imm.s = (char *)%s_code + %d",
+                        fn, (int)(op->imm.s - base));
+        }
+        
+        fprintf(fp, " },\n");
+    }
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "static int\n%s(vm_state_t *vm)\n{\n", fn);
+    fprintf(fp, "    int status;\n\n");
+    fprintf(fp, "    (void)status;\n\n");
+    
+    for (i = 0, op = c->ops; i < nop; i++, op++) {
+        if (label[i])
+            fprintf(fp, " L%d:\n", i);
+        
+        switch (op->code) {
+        case VM_OP_BRANCH:
+            fprintf(fp, "    BRANCH(%s_ops + %d, L%d);\n", fn, i,
+                    (int)(op->imm.branch - c->ops));
+            break;
+        case VM_OP_HALT:
+            fprintf(fp, "    return VM_STATUS_OK;\n");
+            break;
+        default:
+            fprintf(fp, "    EXECUTE(%s, %s_ops + %d);\n",
+                    opcodes[op->code], fn, i);
+        }
+    }
+
+    if (label[nop])
+        fprintf(fp, " L%d:\n", nop);
+    if (label[nop] || !nop || c->ops[nop - 1].code != VM_OP_HALT)
+        fprintf(fp, "    return VM_STATUS_OK;\n");
+    fprintf(fp, "}\n\n");
+
+    FREE(label);
+    
+    return ferror(fp) ? EIO : 0;
+}
+
+
+/* 
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:set expandtab shiftwidth=4:
+ */
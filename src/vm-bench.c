@@ -0,0 +1,351 @@
+/*************************************************************************
+This file is part of dres the resource policy dependency resolver.
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+/*
+ * A microbenchmark for the fixed per-invocation overhead of vm_exec. It
+ * times a few tiny chunks that do next to nothing, so the results are
+ * dominated by entering and leaving the VM, including the error path of
+ * a silently failing method call. It also times keyed assignments (UPDATE
+ * and REPLACE) of 10, 100 and 1000 facts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <ohm/ohm-fact.h>
+
+#include <dres/mm.h>
+#include <dres/vm.h>
+
+
+#define STACK_SIZE   16
+#define DEFAULT_LOOP 1000000
+
+#define ASSIGN_SRC   "bench.src"              /* assignment source facts */
+#define ASSIGN_DST   "bench.dst"              /* assignment destination */
+
+#define fatal(ec, fmt, args...) do {                                        \
+        fprintf(stderr, "%s: fatal error: "fmt"\n", __FUNCTION__, ## args); \
+        exit(ec);                                                           \
+    } while (0)
+
+
+int DBG_GRAPH, DBG_VAR, DBG_RESOLVE, DBG_ACTION, DBG_VM;
+
+static int verify;                            /* run verified chunks */
+
+
+/********************
+ * succeed, fail
+ ********************/
+static int
+succeed(void *data, char *name,
+        vm_stack_entry_t *args, int narg, vm_stack_entry_t *rv)
+{
+    rv->type = VM_TYPE_INTEGER;
+    rv->v.i  = 1;
+
+    return TRUE;
+
+    (void)data; (void)name; (void)args; (void)narg;
+}
+
+
+static int
+fail(void *data, char *name,
+     vm_stack_entry_t *args, int narg, vm_stack_entry_t *rv)
+{
+    return FALSE;
+
+    (void)data; (void)name; (void)args; (void)narg; (void)rv;
+}
+
+
+/********************
+ * chunk_halt
+ ********************/
+static vm_chunk_t *
+chunk_halt(vm_state_t *vm)
+{
+    vm_chunk_t *c;
+    int         err;
+
+    if ((c = vm_chunk_new(4)) == NULL)
+        fatal(1, "failed to allocate chunk");
+
+    VM_INSTR_HALT(c, fail, err);
+    return c;
+
+ fail:
+    fatal(1, "code generation failed (%d)", err);
+    (void)vm;
+}
+
+
+/********************
+ * chunk_cmp
+ ********************/
+static vm_chunk_t *
+chunk_cmp(vm_state_t *vm)
+{
+    vm_chunk_t *c;
+    int         err, br;
+
+    if ((c = vm_chunk_new(16)) == NULL)
+        fatal(1, "failed to allocate chunk");
+
+    VM_INSTR_PUSH_INT(c, fail, err, 1);
+    VM_INSTR_PUSH_INT(c, fail, err, 2);
+    VM_INSTR_CMP(c, fail, err, VM_RELOP_LT);
+    br = VM_INSTR_BRANCH(c, fail, err, VM_BRANCH_NE, 0);
+    VM_INSTR_PUSH_INT(c, fail, err, 3);
+    VM_INSTR_POP_DISCARD(c, fail, err);
+    VM_BRANCH_PATCH(c, br, fail, err, VM_BRANCH_NE, VM_CHUNK_OFFSET(c) - br);
+    VM_INSTR_HALT(c, fail, err);
+    return c;
+
+ fail:
+    fatal(1, "code generation failed (%d)", err);
+    (void)vm;
+}
+
+
+/********************
+ * chunk_call
+ ********************/
+static vm_chunk_t *
+chunk_call(vm_state_t *vm, const char *method)
+{
+    vm_chunk_t *c;
+    int         err, id;
+
+    if ((c = vm_chunk_new(16)) == NULL)
+        fatal(1, "failed to allocate chunk");
+
+    if ((id = vm_method_id(vm, (char *)method)) < 0)
+        fatal(1, "unknown method %s", method);
+
+    VM_INSTR_PUSH_INT(c, fail, err, 1);
+    VM_INSTR_PUSH_INT(c, fail, err, id);
+    VM_INSTR_CALL(c, fail, err, 1);
+    VM_INSTR_POP_DISCARD(c, fail, err);
+    VM_INSTR_HALT(c, fail, err);
+    return c;
+
+ fail:
+    fatal(1, "code generation failed (%d)", err);
+}
+
+
+/********************
+ * bench
+ ********************/
+static void
+bench(vm_state_t *vm, const char *name, vm_chunk_t *c, int expected, int n)
+{
+    struct timespec start, end;
+    double          ns;
+    int             i, status;
+
+    if (vm_chunk_decode(c) != 0)
+        fatal(1, "failed to decode chunk for %s", name);
+
+    if (verify && vm_chunk_verify(vm, c, NULL) != 0)
+        fatal(1, "failed to verify chunk for %s", name);
+
+    if ((status = vm_exec(vm, c)) != expected)  /* warm up, check result */
+        fatal(1, "%s: unexpected status %d", name, status);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < n; i++)
+        vm_exec(vm, c);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    ns  = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    printf("%-12s %-8s %8.1f ns/exec (%d runs, stack %d)\n", name,
+           vm->mode == VM_EXEC_JIT ? "jit" : (verify ? "verified" : "checked"),
+           ns / n, n, vm->stack->nentry);
+
+    vm_chunk_del(c);
+}
+
+
+/********************
+ * assign_facts
+ ********************/
+static void
+assign_facts(const char *name, int nfact, int value)
+{
+    OhmFactStore *store = ohm_fact_store_get_fact_store();
+    OhmFact      *fact;
+    GSList       *l;
+    char          key[32];
+    int           i;
+
+    while ((l = ohm_fact_store_get_facts_by_name(store, name)) != NULL)
+        ohm_fact_store_remove(store, (OhmFact *)l->data);
+    
+    for (i = 0; i < nfact; i++) {
+        if ((fact = ohm_fact_new(name)) == NULL)
+            fatal(1, "failed to create fact %s", name);
+        snprintf(key, sizeof(key), "key%d", i % 7);
+        ohm_fact_set(fact, "id"   , ohm_value_from_int(i));
+        ohm_fact_set(fact, "key"  , ohm_value_from_string(key));
+        ohm_fact_set(fact, "value", ohm_value_from_int(value + i));
+        ohm_fact_store_insert(store, fact);
+    }
+}
+
+
+/********************
+ * chunk_assign
+ ********************/
+static vm_chunk_t *
+chunk_assign(vm_state_t *vm, int replace)
+{
+    vm_chunk_t *c;
+    int         err;
+
+    if ((c = vm_chunk_new(16)) == NULL)
+        fatal(1, "failed to allocate chunk");
+
+    VM_INSTR_PUSH_GLOBAL(c, fail, err, ASSIGN_SRC);
+    VM_INSTR_PUSH_GLOBAL(c, fail, err, ASSIGN_DST);
+    VM_INSTR_PUSH_FIELD(c, fail, err, vm_field_add(vm, "key"));
+    VM_INSTR_PUSH_FIELD(c, fail, err, vm_field_add(vm, "id"));
+    if (replace)
+        VM_INSTR_REPLACE(c, fail, err, 2);
+    else
+        VM_INSTR_UPDATE(c, fail, err, 2, TRUE);
+    VM_INSTR_HALT(c, fail, err);
+    return c;
+
+ fail:
+    fatal(1, "code generation failed (%d)", err);
+}
+
+
+/********************
+ * bench_assign
+ ********************/
+static void
+bench_assign(vm_state_t *vm, int replace, int nfact, int n)
+{
+    struct timespec start, end;
+    vm_chunk_t     *c;
+    double          ns;
+    int             i;
+
+    /*
+     * Notes:
+     *   Every source fact matches exactly one destination, so repeated
+     *   runs neither insert nor remove facts and time the same work.
+     */
+
+    assign_facts(ASSIGN_DST, nfact, 0);
+    assign_facts(ASSIGN_SRC, nfact, nfact);
+    
+    c = chunk_assign(vm, replace);
+
+    if (vm_chunk_decode(c) != 0)
+        fatal(1, "failed to decode assignment chunk");
+
+    if (vm_exec(vm, c) != TRUE)
+        fatal(1, "%s of %d facts failed", replace ? "replace" : "update",
+              nfact);
+    
+    if ((n /= nfact) < 1)
+        n = 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < n; i++)
+        vm_exec(vm, c);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    ns  = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    printf("%-12s %-8d %8.1f us/exec (%d runs)\n",
+           replace ? "replace" : "update", nfact, ns / n / 1000.0, n);
+
+    vm_chunk_del(c);
+}
+
+
+/********************
+ * main
+ ********************/
+int
+main(int argc, char *argv[])
+{
+    vm_state_t vm;
+    int        n, i;
+
+    n = argc > 1 ? atoi(argv[1]) : DEFAULT_LOOP;
+
+    if (n <= 0)
+        fatal(1, "invalid number of iterations %s", argv[1]);
+
+    g_type_init();
+
+    memset(&vm, 0, sizeof(vm));
+    if (vm_init(&vm, STACK_SIZE) != 0)
+        fatal(1, "failed to initialize VM");
+
+    vm_method_add(&vm, "succeed", succeed, NULL);
+    vm_method_add(&vm, "fail"   , fail   , NULL);
+
+    for (verify = FALSE; verify <= TRUE; verify++) {
+        bench(&vm, "halt"       , chunk_halt(&vm)           , TRUE , n);
+        bench(&vm, "compare"    , chunk_cmp(&vm)            , TRUE , n);
+        bench(&vm, "call"       , chunk_call(&vm, "succeed"), TRUE , n);
+        bench(&vm, "call (fail)", chunk_call(&vm, "fail")   , FALSE, n);
+    }
+    
+    if (vm_set_exec_mode(&vm, VM_EXEC_JIT) == 0) {
+        verify = FALSE;
+        bench(&vm, "halt"       , chunk_halt(&vm)           , TRUE , n);
+        bench(&vm, "compare"    , chunk_cmp(&vm)            , TRUE , n);
+        bench(&vm, "call"       , chunk_call(&vm, "succeed"), TRUE , n);
+        bench(&vm, "call (fail)", chunk_call(&vm, "fail")   , FALSE, n);
+    }
+
+    vm_set_exec_mode(&vm, VM_EXEC_DEFAULT);
+    for (i = 10; i <= 1000; i *= 10) {
+        bench_assign(&vm, FALSE, i, n / 100);
+        bench_assign(&vm, TRUE , i, n / 100);
+    }
+
+    vm_exit(&vm);
+
+    return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:set expandtab shiftwidth=4:
+ */
@@ -52,6 +52,7 @@ int vm_dump_debug  (uintptr_t **pc, char *buf, size_t size, int indent);
 int vm_dump_halt   (uintptr_t **pc, char *buf, size_t size, int indent);
 int vm_dump_invalid(uintptr_t **pc, char *buf, size_t size, int indent);
 int vm_dump_replace(uintptr_t **pc, char *buf, size_t size, int indent);
+int vm_dump_load   (uintptr_t **pc, char *buf, size_t size, int indent);
 
 /********************
  * vm_dump_chunk
@@ -108,6 +109,7 @@ vm_dump_instr(uintptr_t **pc, char *buf, size_t size, int indent)
     case VM_OP_DEBUG:   n = vm_dump_debug(pc, buf, size, indent);   break;
     case VM_OP_HALT:    n = vm_dump_halt(pc, buf, size, indent);    break;
     case VM_OP_REPLACE: n = vm_dump_replace(pc, buf, size, indent);  break;
+    case VM_OP_LOAD:    n = vm_dump_load(pc, buf, size, indent);     break;
     default:            n = vm_dump_invalid(pc, buf, size, indent); *pc = 0x0;
     }
         
@@ -153,6 +155,11 @@ vm_dump_push(uintptr_t **pc, char *buf, size_t size, int indent)
         n += snprintf(buf, size, "push locals %lld\n", (long long int)data);
         nsize = 1;
         break;
+
+    case VM_TYPE_FIELD:
+        n += snprintf(buf, size, "push field #%lld\n", (long long int)data);
+        nsize = 1;
+        break;
         
     default:
         n += snprintf(buf, size, "<invalid push instruction 0x%" PRIxPTR ">\n", type);
@@ -252,6 +259,34 @@ vm_dump_replace(uintptr_t **pc, char *buf, size_t size, int indent)
 }
 
 
+/********************
+ * vm_dump_load
+ ********************/
+int
+vm_dump_load(uintptr_t **pc, char *buf, size_t size, int indent)
+{
+    int nselect = VM_LOAD_NSELECT(**pc);
+    int field   = VM_LOAD_FIELD(**pc);
+    int n, nsize;
+
+    INDENT(indent);
+
+    if (field < 0)
+        n += snprintf(buf, size, "load %s, %d selectors\n",
+                      (char *)(*pc + 2), nselect);
+    else
+        n += snprintf(buf, size, "load %s, %d selectors, field #%d\n",
+                      (char *)(*pc + 2), nselect, field);
+
+    if ((nsize = vm_load_size(*pc, INT_MAX)) <= 0)
+        nsize = 1;
+    
+    *pc += nsize;
+
+    return n;
+}
+
+
 /********************
  * vm_dump_set
  ********************/
@@ -29,7 +29,15 @@ USA.
 #include <dres/mm.h>
 #include <dres/vm.h>
 
-static inline int vm_field_matches(OhmFact *f, char *field, GValue *value);
+#define MIN_FIELDS 16                         /* initial field table size */
+#define MIN_HASHED 8                          /* min. keys to hash in joins */
+
+static inline int vm_field_matches(OhmFact *f, GQuark field, GValue *value);
+
+typedef struct {                              /* key of a fact in a join */
+    int      nfield;                          /* number of key fields */
+    GValue **values;                          /* key field values */
+} join_key_t;
 
 
 
@@ -67,6 +75,154 @@ vm_global_lookup(char *name, vm_global_t **gp)
 }
 
 
+/********************
+ * vm_global_cache_init
+ ********************/
+int
+vm_global_cache_init(vm_state_t *vm)
+{
+    /*
+     * Notes:
+     *   The cache maps fact names to the set of facts last looked up
+     *   from the factstore. It is up to the owner of the VM to keep it
+     *   in sync with the factstore by calling vm_global_cache_invalidate
+     *   whenever facts are inserted or removed by others than the VM
+     *   itself. Changes to the fields of cached facts need no action as
+     *   the cache only holds references to the facts themselves. However,
+     *   field indexes built from the cache need to be reset with
+     *   vm_index_reset when the value of a field changes.
+     */
+
+    if (vm->globals != NULL)
+        return 0;
+
+    vm->globals = g_hash_table_new_full(g_str_hash, g_str_equal, free,
+                                        (GDestroyNotify)vm_global_free);
+    
+    if (vm->globals == NULL)
+        return ENOMEM;
+
+    return vm_index_init(vm);
+}
+
+
+/********************
+ * vm_global_cache_exit
+ ********************/
+void
+vm_global_cache_exit(vm_state_t *vm)
+{
+    vm_index_exit(vm);
+
+    if (vm->globals != NULL) {
+        g_hash_table_destroy(vm->globals);
+        vm->globals = NULL;
+    }
+}
+
+
+/********************
+ * vm_global_cache_flush
+ ********************/
+void
+vm_global_cache_flush(vm_state_t *vm)
+{
+    vm_index_reset(vm, NULL, 0);
+
+    if (vm->globals != NULL)
+        g_hash_table_remove_all(vm->globals);
+}
+
+
+/********************
+ * vm_global_cache_invalidate
+ ********************/
+void
+vm_global_cache_invalidate(vm_state_t *vm, const char *name)
+{
+    if (vm->globals != NULL && name != NULL) {
+        vm_index_reset(vm, name, 0);
+        g_hash_table_remove(vm->globals, name);
+    }
+}
+
+
+/********************
+ * vm_global_cache_lookup
+ ********************/
+int
+vm_global_cache_lookup(vm_state_t *vm, char *name, vm_global_t **gp)
+{
+    vm_global_t *cached, *g;
+    int          status, i;
+
+    if (vm->globals == NULL)
+        return vm_global_lookup(name, gp);
+    
+    if ((cached = g_hash_table_lookup(vm->globals, name)) != NULL)
+        vm->nglobalhit++;
+    else {
+        vm->nglobalmiss++;
+
+        switch ((status = vm_global_lookup(name, &cached))) {
+        case 0:                                  /* found */
+            break;
+        case ENOENT:                             /* cache nonexisting too */
+            if ((cached = vm_global_alloc(0)) == NULL)
+                return ENOMEM;
+            break;
+        default:
+            *gp = NULL;
+            return status;
+        }
+        
+        g_hash_table_insert(vm->globals, STRDUP(name), cached);
+    }
+
+    if (cached->nfact == 0) {
+        *gp = NULL;
+        return ENOENT;
+    }
+    
+    /*
+     * Notes:
+     *   The VM instructions modify globals in place and hand them over to
+     *   method handlers, so we give out a private copy of the cached set.
+     */
+    
+    if ((g = vm_global_alloc(cached->nfact)) == NULL) {
+        *gp = NULL;
+        return ENOMEM;
+    }
+    
+    for (i = 0; i < cached->nfact; i++)
+        g->facts[i] = g_object_ref(cached->facts[i]);
+    
+    *gp = g;
+    return 0;
+}
+
+
+/********************
+ * vm_global_cache_peek
+ ********************/
+vm_global_t *
+vm_global_cache_peek(vm_state_t *vm, char *name)
+{
+    /*
+     * Notes:
+     *   Unlike vm_global_cache_lookup, this neither fills the cache nor
+     *   updates the cache statistics, and hands out the cached set itself
+     *   which must not be modified or freed by the caller.
+     */
+
+    if (vm->globals == NULL)
+        return NULL;
+    else
+        return g_hash_table_lookup(vm->globals, name);
+}
+
+
 /********************
  * vm_global_name
  ********************/
@@ -149,6 +305,73 @@ vm_global_print(FILE *fp, vm_global_t *g)
 }
 
 
+/*****************************************************************************
+ *                         *** field name handling ***                       *
+ *****************************************************************************/
+
+/********************
+ * vm_field_add
+ ********************/
+int
+vm_field_add(vm_state_t *vm, const char *name)
+{
+    /*
+     * Notes:
+     *   Field names are interned once at compile (or load) time. Code
+     *   refers to them by their index in the field table and the VM
+     *   pushes the corresponding quark, so none of the fact accessors
+     *   needs to look up field names by string at runtime.
+     */
+
+    GQuark q;
+    int    nslot, i;
+
+    if (name == NULL || (q = g_quark_from_string(name)) == 0)
+        return -1;
+
+    for (i = 0; i < vm->nfield; i++)
+        if (vm->fields[i] == q)
+            return i;
+    
+    if (vm->nfield >= vm->nfieldslot) {
+        nslot = vm->nfieldslot ? 2 * vm->nfieldslot : MIN_FIELDS;
+        if (REALLOC_ARR(vm->fields, vm->nfieldslot, nslot) == NULL)
+            return -1;
+        vm->nfieldslot = nslot;
+    }
+
+    vm->fields[vm->nfield] = q;
+    
+    return vm->nfield++;
+}
+
+
+/********************
+ * vm_field_name
+ ********************/
+const char *
+vm_field_name(vm_state_t *vm, int id)
+{
+    if (0 <= id && id < vm->nfield)
+        return g_quark_to_string(vm->fields[id]);
+    else
+        return NULL;
+}
+
+
+/********************
+ * vm_free_fields
+ ********************/
+void
+vm_free_fields(vm_state_t *vm)
+{
+    FREE(vm->fields);
+    vm->fields     = NULL;
+    vm->nfield     = 0;
+    vm->nfieldslot = 0;
+}
+
+
 /*****************************************************************************
  *                            *** fact handling ***                          *
  *****************************************************************************/
@@ -169,14 +392,14 @@ vm_fact_lookup(char *name)
 void
 vm_fact_reset(OhmFact *fact)
 {
-    GSList     *l, *next;
-    const char *field;
+    GSList *l, *next;
+    GQuark  field;
 
     for (l = ohm_fact_get_fields(fact); l != NULL; l = next) {
         next  = l->next;
-        field = g_quark_to_string(GPOINTER_TO_INT(l->data));
-        if (field != NULL)
-            ohm_fact_set(fact, field, NULL);             /* invalidates l */
+        field = GPOINTER_TO_INT(l->data);
+        if (field != 0)                                  /* invalidates l */
+            ohm_structure_qset(OHM_STRUCTURE(fact), field, NULL);
         else
             fprintf(stderr, "*** NULL field name in fact\n");
     }
@@ -191,7 +414,6 @@ vm_fact_dup(OhmFact *src, char *name)
 {
     OhmFact *dst = ohm_fact_new(name);
     GSList  *l   = (GSList *)ohm_fact_get_fields(src);
-    char    *field;
     GValue  *value;
     GQuark   q;
 
@@ -201,9 +423,8 @@ vm_fact_dup(OhmFact *src, char *name)
     
     for ( ; l != NULL; l = g_slist_next(l)){
         q     = GPOINTER_TO_INT(l->data);
-        field = (char *)g_quark_to_string(q);
-        value = ohm_copy_value(ohm_fact_get(src, field));
-        ohm_fact_set(dst, field, value);
+        value = ohm_copy_value(ohm_structure_qget(OHM_STRUCTURE(src), q));
+        ohm_structure_qset(OHM_STRUCTURE(dst), q, value);
     }
 
     return dst;
@@ -216,29 +437,40 @@ vm_fact_dup(OhmFact *src, char *name)
 OhmFact *
 vm_fact_copy(OhmFact *dst, OhmFact *src)
 {
-    GSList *p, *n;
+    /*
+     * Notes:
+     *   Rather than resetting dst and copying all of src over it, we
+     *   only remove the fields src does not have and only set the ones
+     *   that differ in type or value. Every field set triggers a change
+     *   notification, so copying a fact over an identical one should not
+     *   touch it at all.
+     */
+
+    GSList *l, *next;
+    GValue *value;
     GQuark  q;
     
-    if (dst != src)
-        vm_fact_reset(dst);
+    if (dst == src)
+        return dst;
+
+    for (l = (GSList *)ohm_fact_get_fields(dst); l != NULL; l = next) {
+        next = l->next;
+        q    = GPOINTER_TO_INT(l->data);
+        if (q != 0 && ohm_structure_qget(OHM_STRUCTURE(src), q) == NULL)
+            ohm_structure_qset(OHM_STRUCTURE(dst), q, NULL); /* invalidates l */
+    }
+    
+    for (l = (GSList *)ohm_fact_get_fields(src); l != NULL; l = l->next) {
+        q     = GPOINTER_TO_INT(l->data);
+        value = ohm_structure_qget(OHM_STRUCTURE(src), q);
 
-    p = (GSList *)ohm_fact_get_fields(src);
-    while (p != NULL) {
-        char   *field;
-        GValue *value;
-        
-        n = p->next;
-        
-        q     = GPOINTER_TO_INT(p->data);
-        field = (char *)g_quark_to_string(q);
-        value = ohm_copy_value(ohm_fact_get(src, field));
+        if (vm_field_matches(dst, q, value))
+            continue;
         
-        if (value == NULL)
+        if ((value = ohm_copy_value(value)) == NULL)
             return NULL;
         
-        ohm_fact_set(dst, field, value);
-        
-        p = n;
+        ohm_structure_qset(OHM_STRUCTURE(dst), q, value);
     }
     
     return dst;
@@ -255,20 +487,18 @@ vm_fact_update(OhmFact *dst, OhmFact *src)
     GQuark  q;
     
     for ( ; l != NULL; l = g_slist_next(l)) {
-        char   *field;
         GValue *value;
         
         q     = GPOINTER_TO_INT(l->data);
-        field = (char *)g_quark_to_string(q);
-        value = ohm_fact_get(src, field);
+        value = ohm_structure_qget(OHM_STRUCTURE(src), q);
 
-        if (vm_field_matches(dst, field, value))
+        if (vm_field_matches(dst, q, value))
             continue;
         
         if ((value = ohm_copy_value(value)) == NULL)
             return NULL;
         
-        ohm_fact_set(dst, field, value);
+        ohm_structure_qset(OHM_STRUCTURE(dst), q, value);
     }
 
     return dst;
@@ -322,26 +552,48 @@ vm_fact_insert(OhmFact *fact)
  * vm_fact_set_field
  ********************/
 int
-vm_fact_set_field(vm_state_t *vm, OhmFact *fact, char *field,
+vm_fact_set_field(vm_state_t *vm, OhmFact *fact, GQuark field,
                   int type, vm_value_t *value)
 {
-    GValue *gval;
+    /*
+     * Notes:
+     *   Like the other vm_fact_*_field functions, this returns a negative
+     *   exception status raised with VM_RAISE on errors.
+     */
+    
+    GValue     *gval;
+    const char *s;
     
+    /* leave the field alone if it already has the same type and value */
+    if ((gval = ohm_structure_qget(OHM_STRUCTURE(fact), field)) != NULL) {
+        switch (type) {
+        case VM_TYPE_INTEGER:
+            if (G_VALUE_TYPE(gval) == G_TYPE_INT &&
+                g_value_get_int(gval) == value->i)
+                return 1;
+            break;
+        case VM_TYPE_DOUBLE:
+            if (G_VALUE_TYPE(gval) == G_TYPE_DOUBLE &&
+                g_value_get_double(gval) == value->d)
+                return 1;
+            break;
+        case VM_TYPE_STRING:
+            if (G_VALUE_TYPE(gval) == G_TYPE_STRING &&
+                (s = g_value_get_string(gval)) != NULL && !strcmp(s, value->s))
+                return 1;
+            break;
+        }
+    }
+
     switch (type) {
     case VM_TYPE_INTEGER: gval = ohm_value_from_int(value->i);    break;
     case VM_TYPE_DOUBLE:  gval = ohm_value_from_double(value->d); break;
     case VM_TYPE_STRING:  gval = ohm_value_from_string(value->s); break;
-    default: VM_RAISE(vm, EINVAL,
-                      "invalid type 0x%x for field %s", type, field);
+    default: VM_RAISE(vm, EINVAL, "invalid type 0x%x for field %s",
+                      type, g_quark_to_string(field));
     }
 
-    if (vm_field_matches(fact, field, gval)) {
-        g_value_unset(gval);
-        g_free(gval);
-        return 1;
-    }
-
-    ohm_fact_set(fact, field, gval);
+    ohm_structure_qset(OHM_STRUCTURE(fact), field, gval);
     return 1;
 
     (void)vm;
@@ -352,7 +604,7 @@ vm_fact_set_field(vm_state_t *vm, OhmFact *fact, char *field,
  * vm_fact_match_field
  ********************/
 int
-vm_fact_match_field(vm_state_t *vm, OhmFact *fact, char *field,
+vm_fact_match_field(vm_state_t *vm, OhmFact *fact, GQuark field,
                     GValue *gval, int type, vm_value_t *value)
 {
     int         i;
@@ -367,7 +619,8 @@ vm_fact_match_field(vm_state_t *vm, OhmFact *fact, char *field,
         case G_TYPE_LONG:  i = g_value_get_long(gval);  break;
         case G_TYPE_ULONG: i = g_value_get_ulong(gval); break;
         default: VM_RAISE(vm, EINVAL,
-                          "integer type expected for field %s", field);
+                          "integer type expected for field %s",
+                          g_quark_to_string(field));
         }
         return i == value->i;
 
@@ -376,7 +629,8 @@ vm_fact_match_field(vm_state_t *vm, OhmFact *fact, char *field,
         case G_TYPE_DOUBLE: d = g_value_get_double(gval);    break;
         case G_TYPE_FLOAT:  d = 1.0*g_value_get_float(gval); break;
         default: VM_RAISE(vm, EINVAL,
-                          "double type expected for field %s", field);
+                          "double type expected for field %s",
+                          g_quark_to_string(field));
         }
         return d == value->d;
 
@@ -384,7 +638,8 @@ vm_fact_match_field(vm_state_t *vm, OhmFact *fact, char *field,
         switch (G_VALUE_TYPE(gval)) {
         case G_TYPE_STRING: s = g_value_get_string(gval); break;
         default: VM_RAISE(vm, EINVAL,
-                          "string type expected for field %s", field);
+                          "string type expected for field %s",
+                          g_quark_to_string(field));
         }
         return !strcmp(s, value->s);
 
@@ -403,9 +658,10 @@ vm_fact_match_field(vm_state_t *vm, OhmFact *fact, char *field,
  * vm_fact_get_field
  ********************/
 int
-vm_fact_get_field(vm_state_t *vm, OhmFact *fact, char *field, vm_value_t *value)
+vm_fact_get_field(vm_state_t *vm, OhmFact *fact, GQuark field,
+                  vm_value_t *value)
 {
-    GValue *gval = ohm_fact_get(fact, field);
+    GValue *gval = ohm_structure_qget(OHM_STRUCTURE(fact), field);
 
     if (gval == NULL)
         return VM_TYPE_UNKNOWN;
@@ -427,7 +683,8 @@ vm_fact_get_field(vm_state_t *vm, OhmFact *fact, char *field, vm_value_t *value)
         return VM_TYPE_STRING;
 
     default:
-        VM_RAISE(vm, EINVAL, "unexpected field type field %s", field);
+        VM_RAISE(vm, EINVAL, "unexpected field type field %s",
+                 g_quark_to_string(field));
     }
     
     return VM_TYPE_UNKNOWN;
@@ -439,12 +696,13 @@ vm_fact_get_field(vm_state_t *vm, OhmFact *fact, char *field, vm_value_t *value)
  * vm_fact_collect_fields
  ********************/
 int
-vm_fact_collect_fields(OhmFact *f, char **fields, int nfield, GValue **values)
+vm_fact_collect_fields(OhmFact *f, GQuark *fields, int nfield, GValue **values)
 {
     int i;
     
     for (i = 0; i < nfield; i++)
-        if ((values[i] = ohm_fact_get(f, fields[i])) == NULL)
+        if ((values[i] = ohm_structure_qget(OHM_STRUCTURE(f),
+                                            fields[i])) == NULL)
             return -i;
     
     return 0;
@@ -452,19 +710,14 @@ vm_fact_collect_fields(OhmFact *f, char **fields, int nfield, GValue **values)
 
 
 /********************
- * vm_field_matches
+ * vm_value_matches
  ********************/
 static inline int
-vm_field_matches(OhmFact *f, char *field, GValue *value)
+vm_value_matches(GValue *v, GValue *value)
 {
 #define GV(v, t) g_value_get_##t(v)
 #define CMP(s, d, t) (GV(s, t) == GV(d, t))
     
-    GValue *v;
-    
-    if ((v = ohm_fact_get(f, field)) == NULL)
-        return 0;
-    
     if (G_VALUE_TYPE(v) != G_VALUE_TYPE(value))
         return 0;
 
@@ -489,11 +742,26 @@ vm_field_matches(OhmFact *f, char *field, GValue *value)
 }
 
 
+/********************
+ * vm_field_matches
+ ********************/
+static inline int
+vm_field_matches(OhmFact *f, GQuark field, GValue *value)
+{
+    GValue *v;
+    
+    if ((v = ohm_structure_qget(OHM_STRUCTURE(f), field)) == NULL)
+        return 0;
+    
+    return vm_value_matches(v, value);
+}
+
+
 /********************
  * vm_fact_matches
  ********************/
 int
-vm_fact_matches(OhmFact *f, char **fields, GValue **values, int nfield)
+vm_fact_matches(OhmFact *f, GQuark *fields, GValue **values, int nfield)
 {
     int i;
     
@@ -522,7 +790,8 @@ vm_fact_print(FILE *fp, OhmFact *fact)
  * vm_global_find_first
  ********************/
 int
-vm_global_find_first(vm_global_t *g, char **fields, GValue **values, int nfield)
+vm_global_find_first(vm_global_t *g, GQuark *fields, GValue **values,
+                     int nfield)
 {
     int i;
 
@@ -541,7 +810,7 @@ vm_global_find_first(vm_global_t *g, char **fields, GValue **values, int nfield)
  ********************/
 int
 vm_global_find_next(vm_global_t *g, int idx,
-                    char **fields, GValue **values, int nfield)
+                    GQuark *fields, GValue **values, int nfield)
 {
     int i;
 
@@ -555,6 +824,290 @@ vm_global_find_next(vm_global_t *g, int idx,
 }
 
 
+/********************
+ * join_collect
+ ********************/
+static int
+join_collect(OhmFact *f, GQuark *fields, int nfield, GValue **values)
+{
+    int i;
+    
+    for (i = 0; i < nfield; i++)
+        if ((values[i] = ohm_structure_qget(OHM_STRUCTURE(f),
+                                            fields[i])) == NULL)
+            return i;
+    
+    return -1;
+}
+
+
+/********************
+ * join_hash
+ ********************/
+static guint
+join_hash(gconstpointer ptr)
+{
+    const join_key_t *key = (const join_key_t *)ptr;
+    GValue           *v;
+    const char       *s;
+    guint             h, x;
+    int               i;
+    union {
+        double  d;
+        float   f;
+        guint32 w[2];
+    } u;
+
+    /*
+     * Notes:
+     *   Values only ever match values of the same type (see
+     *   vm_value_matches), so we do not need to hash equal numbers
+     *   of different types to the same bucket.
+     */
+    
+    h = 0;
+    for (i = 0; i < key->nfield; i++) {
+        v = key->values[i];
+
+        switch (G_VALUE_TYPE(v)) {
+        case G_TYPE_INT:   x = (guint)g_value_get_int(v);   break;
+        case G_TYPE_UINT:  x = (guint)g_value_get_uint(v);  break;
+        case G_TYPE_LONG:  x = (guint)g_value_get_long(v);  break;
+        case G_TYPE_ULONG: x = (guint)g_value_get_ulong(v); break;
+        case G_TYPE_DOUBLE:
+            memset(&u, 0, sizeof(u));
+            u.d = g_value_get_double(v);
+            if (u.d == 0.0)                       /* -0.0 == 0.0 */
+                u.d = 0.0;
+            x = u.w[0] ^ u.w[1];
+            break;
+        case G_TYPE_FLOAT:
+            memset(&u, 0, sizeof(u));
+            u.f = g_value_get_float(v);
+            if (u.f == 0.0)
+                u.f = 0.0;
+            x = u.w[0];
+            break;
+        case G_TYPE_STRING:
+            s = g_value_get_string(v);
+            x = s ? g_str_hash(s) : 0;
+            break;
+        default:
+            x = 0;
+        }
+
+        h = (h << 5) - h + x;
+    }
+
+    return h;
+}
+
+
+/********************
+ * join_equal
+ ********************/
+static gboolean
+join_equal(gconstpointer ptr1, gconstpointer ptr2)
+{
+    const join_key_t *k1 = (const join_key_t *)ptr1;
+    const join_key_t *k2 = (const join_key_t *)ptr2;
+    int               i;
+    
+    for (i = 0; i < k1->nfield; i++)
+        if (!vm_value_matches(k1->values[i], k2->values[i]))
+            return FALSE;
+    
+    return TRUE;
+}
+
+
+/********************
+ * join_lookup
+ ********************/
+static inline int
+join_lookup(GHashTable *ht, join_key_t **groups, int ngroup, join_key_t *key)
+{
+    int g;
+
+    if (ht != NULL)
+        return GPOINTER_TO_INT(g_hash_table_lookup(ht, key)) - 1;
+
+    for (g = 0; g < ngroup; g++)
+        if (join_equal(groups[g], key))
+            return g;
+
+    return -1;
+}
+
+
+/********************
+ * join_append
+ ********************/
+static inline void
+join_append(vm_join_t *join, int *last, int group, int dst)
+{
+    if (join->first[group] < 0)
+        join->first[group] = dst;
+    else
+        join->next[last[group]] = dst;
+
+    last[group] = dst;
+}
+
+
+/********************
+ * vm_global_join
+ ********************/
+int
+vm_global_join(vm_global_t *src, vm_global_t *dst, GQuark *fields, int nfield,
+               vm_join_t *join)
+{
+    /*
+     * Notes:
+     *   This groups the facts of src and dst by the values of the given
+     *   key fields. It hashes the keys of the smaller one of the globals
+     *   and probes the hash table with the keys of the other one. If
+     *   there are only a few keys to hash, they are simply compared one
+     *   by one instead. The
+     *   result is, for every source fact, the group it belongs to, and
+     *   for every group, the list of matching destination facts in the
+     *   same order as they appear in dst. This is the same set and order
+     *   of matches vm_global_find_first/next would produce for every
+     *   source fact.
+     *
+     *   Source facts that lack any of the key fields are marked with
+     *   VM_JOIN_NOFIELD, destination facts that lack any of them match
+     *   nothing.
+     */
+
+    GHashTable  *ht;
+    join_key_t  *keys, probe, *key, **groups;
+    GValue     **values;
+    vm_global_t *hg, *pg;
+    int          nsrc, ndst, nkey, hashsrc, ngroup, *last;
+    int          i, g, m;
+
+    memset(join, 0, sizeof(*join));
+
+    nsrc    = src->nfact;
+    ndst    = dst->nfact;
+    hashsrc = nsrc < ndst;
+    hg      = hashsrc ? src : dst;
+    pg      = hashsrc ? dst : src;
+    nkey    = hg->nfact;
+    
+    if (nkey > MIN_HASHED) {
+        if ((ht = g_hash_table_new(join_hash, join_equal)) == NULL)
+            return ENOMEM;
+    }
+    else
+        ht = NULL;
+    
+    keys   = ALLOC_ARR(join_key_t, nkey + 1);
+    groups = ALLOC_ARR(join_key_t *, nkey + 1);
+    values = ALLOC_ARR(GValue *, (nkey + 1) * nfield + 1);
+
+    join->group = ALLOC_ARR(int, nsrc + ndst + 2 * nkey + 1);
+    
+    if (keys == NULL || groups == NULL || values == NULL || join->group == NULL)
+        goto nomem;
+    
+    join->next  = join->group + nsrc;
+    join->first = join->next  + ndst;
+    last        = join->first + nkey;
+
+    for (i = 0; i < nsrc; i++)
+        join->group[i] = VM_JOIN_NOMATCH;
+    for (i = 0; i < ndst; i++)
+        join->next[i] = -1;
+    
+    ngroup = 0;
+    for (i = 0; i < nkey; i++) {
+        key         = keys + i;
+        key->nfield = nfield;
+        key->values = values + i * nfield;
+
+        if (hg->facts[i] == NULL)
+            continue;
+        
+        m = join_collect(hg->facts[i], fields, nfield, key->values);
+        if (m >= 0) {
+            if (hashsrc)
+                join->group[i] = VM_JOIN_NOFIELD(m);
+            continue;
+        }
+        
+        if ((g = join_lookup(ht, groups, ngroup, key)) < 0) {
+            g = ngroup++;
+            groups[g]      = key;
+            join->first[g] = -1;
+            if (ht != NULL)
+                g_hash_table_insert(ht, key, GINT_TO_POINTER(g + 1));
+        }
+
+        if (hashsrc)
+            join->group[i] = g;
+        else
+            join_append(join, last, g, i);
+    }
+
+    probe.nfield = nfield;
+    probe.values = values + nkey * nfield;
+
+    for (i = 0; i < pg->nfact; i++) {
+        if (pg->facts[i] == NULL)
+            continue;
+
+        m = join_collect(pg->facts[i], fields, nfield, probe.values);
+        if (m >= 0) {
+            if (!hashsrc)
+                join->group[i] = VM_JOIN_NOFIELD(m);
+            continue;
+        }
+
+        g = join_lookup(ht, groups, ngroup, &probe);
+        
+        if (!hashsrc)
+            join->group[i] = g;
+        else
+            if (g >= 0)
+                join_append(join, last, g, i);
+    }
+
+    if (ht != NULL)
+        g_hash_table_destroy(ht);
+    FREE(keys);
+    FREE(groups);
+    FREE(values);
+
+    return 0;
+
+ nomem:
+    if (ht != NULL)
+        g_hash_table_destroy(ht);
+    FREE(keys);
+    FREE(groups);
+    FREE(values);
+    vm_join_free(join);
+
+    return ENOMEM;
+}
+
+
+/********************
+ * vm_join_free
+ ********************/
+void
+vm_join_free(vm_join_t *join)
+{
+    FREE(join->group);
+
+    join->group = NULL;
+    join->first = NULL;
+    join->next  = NULL;
+}
+
+
 /* 
  * Local Variables:
  * c-basic-offset: 4
@@ -0,0 +1,411 @@
+/*************************************************************************
+This file is part of dres the resource policy dependency resolver.
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <dres/mm.h>
+#include <dres/vm.h>
+
+
+/*
+ * a bucket of facts with the same field value
+ */
+
+typedef struct {
+    int     nfact;                            /* number of facts */
+    GSList *facts;                            /* positions in the global */
+} vm_bucket_t;
+
+
+static void index_free(gpointer ptr);
+static void index_clear(vm_index_t *idx);
+
+
+/********************
+ * vm_index_init
+ ********************/
+int
+vm_index_init(vm_state_t *vm)
+{
+    /*
+     * Notes:
+     *   Indexes are built from the facts in the global cache, so they
+     *   are only available if the cache is. They are invalidated along
+     *   with the cache, and by vm_index_reset for changes to the fields
+     *   of cached facts.
+     */
+
+    if (vm->indexes != NULL)
+        return 0;
+
+    vm->indexes = g_hash_table_new_full(g_str_hash, g_str_equal, free,
+                                        index_free);
+    
+    return vm->indexes != NULL ? 0 : ENOMEM;
+}
+
+
+/********************
+ * vm_index_exit
+ ********************/
+void
+vm_index_exit(vm_state_t *vm)
+{
+    if (vm->indexes != NULL) {
+        g_hash_table_destroy(vm->indexes);
+        vm->indexes = NULL;
+    }
+}
+
+
+/********************
+ * index_free
+ ********************/
+static void
+index_free(gpointer ptr)
+{
+    vm_index_t *idx, *next;
+
+    for (idx = (vm_index_t *)ptr; idx != NULL; idx = next) {
+        next = idx->next;
+        index_clear(idx);
+        FREE(idx);
+    }
+}
+
+
+/********************
+ * bucket_free
+ ********************/
+static void
+bucket_free(gpointer ptr)
+{
+    vm_bucket_t *b = (vm_bucket_t *)ptr;
+
+    g_slist_free(b->facts);
+    FREE(b);
+}
+
+
+/********************
+ * index_clear
+ ********************/
+static void
+index_clear(vm_index_t *idx)
+{
+    if (idx->values != NULL) {
+        g_hash_table_destroy(idx->values);
+        idx->values = NULL;
+    }
+    
+    idx->global = NULL;
+    idx->type   = VM_TYPE_UNKNOWN;
+}
+
+
+/********************
+ * index_find
+ ********************/
+static vm_index_t *
+index_find(vm_state_t *vm, const char *name, GQuark field, int create)
+{
+    vm_index_t *head, *idx;
+
+    head = g_hash_table_lookup(vm->indexes, name);
+
+    for (idx = head; idx != NULL; idx = idx->next)
+        if (idx->field == field)
+            return idx;
+
+    if (!create || ALLOC_OBJ(idx) == NULL)
+        return NULL;
+
+    idx->field = field;
+    idx->type  = VM_TYPE_UNKNOWN;
+
+    if (head != NULL) {
+        idx->next  = head->next;              /* keep the head in place */
+        head->next = idx;
+    }
+    else
+        g_hash_table_insert(vm->indexes, STRDUP(name), idx);
+    
+    return idx;
+}
+
+
+/********************
+ * index_key
+ ********************/
+static int
+index_key(GValue *gval, gpointer *key)
+{
+    const char *s;
+
+    switch (G_VALUE_TYPE(gval)) {
+    case G_TYPE_INT:   *key = GINT_TO_POINTER(g_value_get_int(gval));   break;
+    case G_TYPE_UINT:  *key = GINT_TO_POINTER(g_value_get_uint(gval));  break;
+    case G_TYPE_LONG:  *key = GINT_TO_POINTER(g_value_get_long(gval));  break;
+    case G_TYPE_ULONG: *key = GINT_TO_POINTER(g_value_get_ulong(gval)); break;
+    case G_TYPE_STRING:
+        if ((s = g_value_get_string(gval)) == NULL)
+            return VM_TYPE_UNKNOWN;
+        *key = (gpointer)s;
+        return VM_TYPE_STRING;
+    default:
+        return VM_TYPE_UNKNOWN;
+    }
+
+    return VM_TYPE_INTEGER;
+}
+
+
+/********************
+ * index_build
+ ********************/
+static int
+index_build(vm_index_t *idx, vm_global_t *g)
+{
+    /*
+     * Notes:
+     *   Only fields with integer or string values of the same type in
+     *   all facts are indexed. For anything else the index is left
+     *   empty and lookups fall back to scanning, which also takes care
+     *   of raising the usual type mismatch exceptions.
+     *
+     *   String keys point to the field values of the cached facts. This
+     *   is safe as changing the value of an indexed field resets the
+     *   index.
+     */
+
+    vm_bucket_t *b;
+    GValue      *gval;
+    gpointer     key;
+    int          type, t, i;
+
+    idx->global = g;
+    idx->type   = VM_TYPE_UNKNOWN;
+
+    type = VM_TYPE_UNKNOWN;
+    for (i = 0; i < g->nfact; i++) {
+        gval = ohm_structure_qget(OHM_STRUCTURE(g->facts[i]), idx->field);
+        if (gval == NULL)
+            continue;
+        if ((t = index_key(gval, &key)) == VM_TYPE_UNKNOWN)
+            return 0;
+        if (type != VM_TYPE_UNKNOWN && t != type)
+            return 0;
+        type = t;
+    }
+
+    if (type == VM_TYPE_STRING)
+        idx->values = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                            NULL, bucket_free);
+    else
+        idx->values = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                            NULL, bucket_free);
+    if (idx->values == NULL)
+        return ENOMEM;
+    
+    for (i = g->nfact - 1; i >= 0; i--) {     /* keep buckets in order */
+        gval = ohm_structure_qget(OHM_STRUCTURE(g->facts[i]), idx->field);
+        if (gval == NULL)
+            continue;
+
+        index_key(gval, &key);
+        
+        if ((b = g_hash_table_lookup(idx->values, key)) == NULL) {
+            if (ALLOC_OBJ(b) == NULL)
+                goto nomem;
+            g_hash_table_insert(idx->values, key, b);
+        }
+        
+        b->facts = g_slist_prepend(b->facts, GINT_TO_POINTER(i));
+        b->nfact++;
+    }
+
+    idx->type = type;
+    return 0;
+
+ nomem:
+    index_clear(idx);
+    return ENOMEM;
+}
+
+
+/********************
+ * vm_index_add
+ ********************/
+int
+vm_index_add(vm_state_t *vm, const char *name, const char *field)
+{
+    vm_index_t *idx;
+    GQuark      q;
+
+    if (vm->indexes == NULL)
+        return EOPNOTSUPP;
+
+    if (name == NULL || field == NULL || (q = g_quark_from_string(field)) == 0)
+        return EINVAL;
+    
+    if ((idx = index_find(vm, name, q, TRUE)) == NULL)
+        return ENOMEM;
+    
+    idx->nuse = VM_INDEX_MIN_USE;
+    return 0;
+}
+
+
+/********************
+ * index_reset
+ ********************/
+static void
+index_reset(gpointer key, gpointer value, gpointer data)
+{
+    vm_index_t *idx;
+
+    for (idx = (vm_index_t *)value; idx != NULL; idx = idx->next)
+        index_clear(idx);
+
+    (void)key;
+    (void)data;
+}
+
+
+/********************
+ * vm_index_reset
+ ********************/
+void
+vm_index_reset(vm_state_t *vm, const char *name, GQuark field)
+{
+    /*
+     * Notes:
+     *   Resetting drops the values indexed but keeps track of which
+     *   fields are indexed, the index is rebuilt on the next lookup.
+     *   A NULL name resets all indexes, a zero field all indexes of
+     *   the given facts.
+     */
+
+    vm_index_t *idx;
+
+    if (vm->indexes == NULL)
+        return;
+
+    if (name == NULL) {
+        g_hash_table_foreach(vm->indexes, index_reset, NULL);
+        return;
+    }
+
+    idx = g_hash_table_lookup(vm->indexes, name);
+    for ( ; idx != NULL; idx = idx->next)
+        if (field == 0 || idx->field == field)
+            index_clear(idx);
+}
+
+
+/********************
+ * vm_index_lookup
+ ********************/
+int
+vm_index_lookup(vm_state_t *vm, char *name, GQuark field, int type,
+                vm_value_t *value, vm_global_t **gp)
+{
+    /*
+     * Notes:
+     *   Returns 0 and the facts with the given field value in gp if the
+     *   field is indexed. Returns ENOENT if it is not, in which case the
+     *   caller is expected to filter the facts by scanning instead. Every
+     *   lookup counts as a use of the field for learning which fields are
+     *   worth indexing. Only facts already in the global cache are indexed
+     *   and a successful lookup counts as a cache hit.
+     */
+
+    vm_index_t  *idx;
+    vm_global_t *cached, *g;
+    vm_bucket_t *b;
+    gpointer     key;
+    GSList      *l;
+    int          status, i;
+
+    *gp = NULL;
+
+    if (vm->indexes == NULL)
+        return ENOENT;
+
+    switch (type) {
+    case VM_TYPE_INTEGER: key = GINT_TO_POINTER(value->i); break;
+    case VM_TYPE_STRING:  key = (gpointer)value->s;        break;
+    default:              return ENOENT;
+    }
+    
+    if ((idx = index_find(vm, name, field, TRUE)) == NULL)
+        return ENOMEM;
+
+    if (idx->nuse < VM_INDEX_MIN_USE)
+        if (++idx->nuse < VM_INDEX_MIN_USE)
+            return ENOENT;
+    
+    cached = vm_global_cache_peek(vm, name);
+    
+    if (cached == NULL || cached->nfact < VM_INDEX_MIN_FACTS)
+        return ENOENT;
+    
+    if (idx->global != cached) {
+        index_clear(idx);
+        if ((status = index_build(idx, cached)) != 0)
+            return status;
+    }
+    
+    if (idx->type != type)
+        return ENOENT;
+    
+    if ((b = g_hash_table_lookup(idx->values, key)) == NULL)
+        g = vm_global_alloc(0);
+    else {
+        if ((g = vm_global_alloc(b->nfact)) != NULL)
+            for (i = 0, l = b->facts; l != NULL; i++, l = l->next)
+                g->facts[i] = g_object_ref(cached->facts[
+                                               GPOINTER_TO_INT(l->data)]);
+    }
+
+    if (g == NULL)
+        return ENOMEM;
+
+    vm->nglobalhit++;
+    vm->nindexhit++;
+
+    *gp = g;
+    return 0;
+}
+
+
+/* 
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:set expandtab shiftwidth=4:
+ */
@@ -27,24 +27,35 @@ USA.
 #include <errno.h>
 #include <inttypes.h>
 
+#include <dres/compiler.h>
 #include <dres/mm.h>
 #include <dres/vm.h>
 
 #include "dres-debug.h"
 
 
-int vm_instr_push   (vm_state_t *vm);
-int vm_instr_pop    (vm_state_t *vm);
-int vm_instr_filter (vm_state_t *vm);
-int vm_instr_update (vm_state_t *vm);
-int vm_instr_set    (vm_state_t *vm);
-int vm_instr_get    (vm_state_t *vm);
-int vm_instr_create (vm_state_t *vm);
-int vm_instr_call   (vm_state_t *vm);
-int vm_instr_cmp    (vm_state_t *vm);
-int vm_instr_branch (vm_state_t *vm);
-int vm_instr_debug  (vm_state_t *vm);
-int vm_instr_replace(vm_state_t *vm);
+int vm_instr_push   (vm_state_t *vm, vm_op_t *op);
+int vm_instr_pop    (vm_state_t *vm, vm_op_t *op);
+int vm_instr_filter (vm_state_t *vm, vm_op_t *op);
+int vm_instr_update (vm_state_t *vm, vm_op_t *op);
+int vm_instr_set    (vm_state_t *vm, vm_op_t *op);
+int vm_instr_get    (vm_state_t *vm, vm_op_t *op);
+int vm_instr_create (vm_state_t *vm, vm_op_t *op);
+int vm_instr_call   (vm_state_t *vm, vm_op_t *op);
+int vm_instr_cmp    (vm_state_t *vm, vm_op_t *op);
+int vm_instr_branch (vm_state_t *vm, vm_op_t *op);
+int vm_instr_debug  (vm_state_t *vm, vm_op_t *op);
+int vm_instr_replace(vm_state_t *vm, vm_op_t *op);
+int vm_instr_load   (vm_state_t *vm, vm_op_t *op);
+
+static int vm_run_threaded(vm_state_t *vm, vm_op_t *op);
+static int vm_run_verified(vm_state_t *vm, vm_op_t *op);
+static int vm_run_bytecode(vm_state_t *vm);
+static int vm_op_decode   (uintptr_t *pc, int nsize, vm_op_t *op);
+
+static int  vm_global_select(vm_state_t *vm, vm_global_t *g, GQuark field,
+                             int neq, int type, vm_value_t *value);
+static void vm_global_pack  (vm_global_t *g, int nfact);
 
 /*****************************************************************************
  *                            *** code interpreter ***                       *
@@ -57,43 +68,950 @@ int vm_instr_replace(vm_state_t *vm);
 int
 vm_run(vm_state_t *vm)
 {
-    int status = EOPNOTSUPP;
+    /*
+     * Notes:
+     *   The trace flag is only checked once per invocation. While tracing
+     *   we run a switch-based loop that disassembles every instruction.
+     *   Otherwise chunks with ahead-of-time compiled native code are run
+     *   natively unless we are restricted to interpreting. In JIT mode
+     *   decoded chunks are translated to machine code the first time they
+     *   are run. Chunks with a decoded representation (see vm_chunk_decode)
+     *   are run by one of the direct-threaded loops, the one without any
+     *   per-instruction checks if the chunk has been verified. Others are
+     *   run by a loop decoding the bytecode as it goes.
+     */
 
-    while (vm->ninstr > 0) {
-        if (DEBUG_ON(DBG_VM)) {
-            uintptr_t    *pc = vm->pc;
-            char          instr[128];
-            int           n;
-            
-            if ((n = vm_dump_instr(&pc, instr, sizeof(instr), 0)) > 0) {
-                if (instr[n-1] == '\n')
-                    instr[n-1] = '\0';
-                DEBUG(DBG_VM, "executing %s", instr);
+    vm_chunk_t *c = vm->chunk;
+
+    if (DEBUG_ON(DBG_VM))
+        return vm_run_traced(vm);
+    
+    if (c == NULL || vm->pc != c->instrs)
+        return vm_run_bytecode(vm);
+
+    if (c->native != NULL && vm->mode != VM_EXEC_INTERPRET)
+        return c->native(vm);
+
+    if (c->ops == NULL)
+        return vm_run_bytecode(vm);
+    
+    if (vm->mode == VM_EXEC_JIT) {
+        if (c->jit == NULL && c->njit == 0)
+            vm_jit_compile(c);
+        if (c->jit != NULL)
+            return c->jit(vm);
+    }
+    
+    if (c->verified)
+        return vm_run_verified(vm, c->ops);
+    else
+        return vm_run_threaded(vm, c->ops);
+}
+
+
+/********************
+ * vm_run_threaded
+ ********************/
+static int
+vm_run_threaded(vm_state_t *vm, vm_op_t *op)
+{
+    /*
+     * Notes:
+     *   Decoded chunks are always terminated by a HALT and all branch
+     *   targets have been resolved and checked by vm_chunk_decode, so
+     *   there is no need for any end-of-code or bounds checking here.
+     *   Any non-zero status from an instruction aborts execution.
+     */
+
+    int status;
+
+#ifdef __GNUC__
+    static void *dispatch[VM_OP_MAXCODE + 1] = {
+        [VM_OP_PUSH]     = &&op_push,
+        [VM_OP_POP]      = &&op_pop,
+        [VM_OP_FILTER]   = &&op_filter,
+        [VM_OP_UPDATE]   = &&op_update,
+        [VM_OP_SET]      = &&op_set,
+        [VM_OP_GET]      = &&op_get,
+        [VM_OP_CREATE]   = &&op_create,
+        [VM_OP_CALL]     = &&op_call,
+        [VM_OP_CMP]      = &&op_cmp,
+        [VM_OP_BRANCH]   = &&op_branch,
+        [VM_OP_DEBUG]    = &&op_debug,
+        [VM_OP_HALT]     = &&op_halt,
+        [VM_OP_REPLACE]  = &&op_replace,
+        [VM_OP_LOAD]     = &&op_load,
+    };
+    int i;
+
+#define DISPATCH() goto *dispatch[op->code]
+#define EXECUTE(instr) do {                                             \
+        VM_STATS_START(start);                                          \
+        status = vm_instr_##instr(vm, op);                              \
+        VM_STATS_OPCODE(vm, op->code, start);                           \
+        if (status != VM_STATUS_OK)                                     \
+            return status;                                              \
+        op++;                                                           \
+        DISPATCH();                                                     \
+    } while (0)
+
+    /* trap all unused opcodes */
+    if (dispatch[0] == NULL)
+        for (i = 0; i <= VM_OP_MAXCODE; i++)
+            if (dispatch[i] == NULL)
+                dispatch[i] = &&op_invalid;
+
+    DISPATCH();
+
+ op_push:    EXECUTE(push);
+ op_pop:     EXECUTE(pop);
+ op_filter:  EXECUTE(filter);
+ op_update:  EXECUTE(update);
+ op_set:     EXECUTE(set);
+ op_get:     EXECUTE(get);
+ op_create:  EXECUTE(create);
+ op_call:    EXECUTE(call);
+ op_cmp:     EXECUTE(cmp);
+ op_debug:   EXECUTE(debug);
+ op_replace: EXECUTE(replace);
+ op_load:    EXECUTE(load);
+ op_branch: {
+        VM_STATS_START(start);
+        status = vm_instr_branch(vm, op);
+        VM_STATS_OPCODE(vm, VM_OP_BRANCH, start);
+        if (status < 0)
+            return status;
+        op = status ? op->imm.branch : op + 1;
+    }
+    DISPATCH();
+ op_halt:    return VM_STATUS_OK;
+ op_invalid:
+    VM_RAISE(vm, EILSEQ, "invalid decoded instruction 0x%x", op->code);
+
+#undef EXECUTE
+#undef DISPATCH
+
+#else /* !__GNUC__ */
+
+    for (;;) {
+        VM_STATS_START(start);
+
+        switch ((vm_opcode_t)op->code) {
+        case VM_OP_PUSH:    status = vm_instr_push(vm, op);    break;
+        case VM_OP_POP:     status = vm_instr_pop(vm, op);     break;
+        case VM_OP_FILTER:  status = vm_instr_filter(vm, op);  break;
+        case VM_OP_UPDATE:  status = vm_instr_update(vm, op);  break;
+        case VM_OP_SET:     status = vm_instr_set(vm, op);     break;
+        case VM_OP_GET:     status = vm_instr_get(vm, op);     break;
+        case VM_OP_CREATE:  status = vm_instr_create(vm, op);  break;
+        case VM_OP_CALL:    status = vm_instr_call(vm, op);    break;
+        case VM_OP_CMP:     status = vm_instr_cmp(vm, op);     break;
+        case VM_OP_DEBUG:   status = vm_instr_debug(vm, op);   break;
+        case VM_OP_REPLACE: status = vm_instr_replace(vm, op); break;
+        case VM_OP_LOAD:    status = vm_instr_load(vm, op);    break;
+        case VM_OP_BRANCH:
+            status = vm_instr_branch(vm, op);
+            VM_STATS_OPCODE(vm, VM_OP_BRANCH, start);
+            if (status < 0)
+                return status;
+            if (status) {
+                op = op->imm.branch;
+                continue;
+            }
+            op++;
+            continue;
+        case VM_OP_HALT:    return VM_STATUS_OK;
+        default:
+            VM_RAISE(vm, EILSEQ, "invalid decoded instruction 0x%x", op->code);
+        }
+        VM_STATS_OPCODE(vm, op->code, start);
+        if (status != VM_STATUS_OK)
+            return status;
+        op++;
+    }
+#endif
+}
+
+
+/*
+ * unchecked instructions for verified chunks
+ *
+ * vm_chunk_verify has proven that every operand these find on the stack
+ * is there and of the expected type, and vm_exec has reserved all the
+ * stack space the chunk needs. Hence stack entries are accessed directly.
+ * Less common variants and types fall back to the checked handlers, as do
+ * operands of a type unknown at verification, like method call results.
+ */
+
+#define FAST_TOP(s, idx) ((s)->entries[(s)->nentry - 1 - (idx)])
+#define FAST_POP(s)      ((s)->entries[--(s)->nentry])
+#define FAST_PUSH(s, t)  ((s)->entries[(s)->nentry++] = (t))
+
+
+static inline int
+vm_fast_push(vm_state_t *vm, vm_op_t *op)
+{
+    vm_stack_t *s = vm->stack;
+    vm_value_t  v;
+
+    switch (op->type) {
+    case VM_TYPE_INTEGER:
+        FAST_PUSH(s, VM_TAGGED(VM_TYPE_INTEGER, (uint32_t)op->imm.i));
+        return 0;
+    case VM_TYPE_DOUBLE:
+        v.d = op->imm.d;
+        FAST_PUSH(s, vm_tag(VM_TYPE_DOUBLE, v));
+        return 0;
+    case VM_TYPE_STRING:
+        FAST_PUSH(s, VM_TAGGED(VM_TYPE_STRING, (uintptr_t)op->imm.s));
+        return 0;
+    case VM_TYPE_FIELD:
+        FAST_PUSH(s, VM_TAGGED(VM_TYPE_FIELD, vm->fields[op->arg]));
+        return 0;
+    default:
+        return vm_instr_push(vm, op);
+    }
+}
+
+
+static inline int
+vm_fast_pop(vm_state_t *vm, vm_op_t *op)
+{
+    vm_tagged_t t;
+    
+    if (op->arg != VM_POP_DISCARD)
+        return vm_instr_pop(vm, op);
+
+    t = FAST_POP(vm->stack);
+    if (VM_TAGGED_TYPE(t) == VM_TYPE_GLOBAL)
+        vm_global_free(VM_TAGGED_PTR(t));
+
+    return 0;
+}
+
+
+static inline int
+vm_fast_filter(vm_state_t *vm, vm_op_t *op)
+{
+    vm_stack_t  *s = vm->stack;
+    vm_global_t *g;
+    vm_value_t   value;
+    GQuark       field;
+    int          nfact, type, neq, ndrop, i;
+    
+    if (VM_TAGGED_TYPE(FAST_TOP(s, 3 * op->arg)) != VM_TYPE_GLOBAL)
+        return vm_instr_filter(vm, op);                /* eg. call result */
+
+    g     = VM_TAGGED_PTR(FAST_TOP(s, 3 * op->arg));
+    nfact = g->nfact;
+    
+    for (i = 0; i < op->arg; i++) {
+        field = vm_pop_field(s);
+        type  = vm_untag(FAST_POP(s), &value);
+        neq   = VM_TAGGED_INT(FAST_POP(s)) == VM_RELOP_NE;
+
+        if ((ndrop = vm_global_select(vm, g, field, neq, type, &value)) < 0)
+            return ndrop;
+        nfact -= ndrop;
+    }
+
+    vm_global_pack(g, nfact);
+
+    return 0;
+}
+
+
+static inline int
+vm_fast_get(vm_state_t *vm, vm_op_t *op)
+{
+    vm_value_t value;
+    int        type;
+    
+    if ((op->arg & (VM_GET_FIELD | VM_GET_LOCAL)) != VM_GET_LOCAL)
+        return vm_instr_get(vm, op);
+
+    if ((type = vm_scope_get(vm, op->arg & ~VM_GET_LOCAL, &value)) ==
+        VM_TYPE_UNKNOWN) {
+        type    = VM_TYPE_NIL;
+        value.i = 0;
+    }
+    FAST_PUSH(vm->stack, vm_tag(type, value));
+
+    return 0;
+}
+
+
+static inline int
+vm_fast_cmp(vm_state_t *vm, vm_op_t *op)
+{
+    vm_stack_t *s = vm->stack;
+    int         arg1, arg2, result;
+
+    if (op->arg == VM_RELOP_NOT ||
+        VM_TAGGED_TYPE(FAST_TOP(s, 0)) != VM_TYPE_INTEGER ||
+        VM_TAGGED_TYPE(FAST_TOP(s, 1)) != VM_TYPE_INTEGER)
+        return vm_instr_cmp(vm, op);
+
+    arg1 = VM_TAGGED_INT(FAST_POP(s));
+    arg2 = VM_TAGGED_INT(FAST_POP(s));
+
+    switch (op->arg) {
+    case VM_RELOP_EQ: result = (arg1 == arg2); break;
+    case VM_RELOP_NE: result = (arg1 != arg2); break;
+    case VM_RELOP_LT: result = (arg1 <  arg2); break;
+    case VM_RELOP_LE: result = (arg1 <= arg2); break;
+    case VM_RELOP_GT: result = (arg1 >  arg2); break;
+    case VM_RELOP_GE: result = (arg1 >= arg2); break;
+    default:          result = FALSE;          break;
+    }
+    
+    FAST_PUSH(s, VM_TAGGED(VM_TYPE_INTEGER, (uint32_t)result));
+
+    return 0;
+}
+
+
+static inline int
+vm_fast_branch(vm_state_t *vm, vm_op_t *op)
+{
+    vm_stack_t *s = vm->stack;
+    int         branch;
+
+    if (op->type == VM_BRANCH)
+        return TRUE;
+    
+    if (VM_TAGGED_TYPE(FAST_TOP(s, 0)) != VM_TYPE_INTEGER)
+        return vm_instr_branch(vm, op);
+    
+    branch = (VM_TAGGED_INT(FAST_POP(s)) != 0);
+
+    return op->type == VM_BRANCH_NE ? !branch : branch;
+}
+
+
+/********************
+ * vm_run_verified
+ ********************/
+static int
+vm_run_verified(vm_state_t *vm, vm_op_t *op)
+{
+    /*
+     * Notes:
+     *   Like vm_run_threaded but for verified chunks. These contain no
+     *   invalid instructions so there is no trap for them, and the most
+     *   common instructions are run by the unchecked variants above.
+     */
+
+#ifdef __GNUC__
+    static void *dispatch[VM_OP_MAXCODE + 1] = {
+        [VM_OP_PUSH]     = &&op_push,
+        [VM_OP_POP]      = &&op_pop,
+        [VM_OP_FILTER]   = &&op_filter,
+        [VM_OP_UPDATE]   = &&op_update,
+        [VM_OP_SET]      = &&op_set,
+        [VM_OP_GET]      = &&op_get,
+        [VM_OP_CREATE]   = &&op_create,
+        [VM_OP_CALL]     = &&op_call,
+        [VM_OP_CMP]      = &&op_cmp,
+        [VM_OP_BRANCH]   = &&op_branch,
+        [VM_OP_DEBUG]    = &&op_debug,
+        [VM_OP_HALT]     = &&op_halt,
+        [VM_OP_REPLACE]  = &&op_replace,
+        [VM_OP_LOAD]     = &&op_load,
+    };
+    int status;
+
+#define DISPATCH() goto *dispatch[op->code]
+#define EXECUTE(instr) do {                                             \
+        VM_STATS_START(start);                                          \
+        status = instr(vm, op);                                         \
+        VM_STATS_OPCODE(vm, op->code, start);                           \
+        if (status != VM_STATUS_OK)                                     \
+            return status;                                              \
+        op++;                                                           \
+        DISPATCH();                                                     \
+    } while (0)
+
+    DISPATCH();
+
+ op_push:    EXECUTE(vm_fast_push);
+ op_pop:     EXECUTE(vm_fast_pop);
+ op_filter:  EXECUTE(vm_fast_filter);
+ op_update:  EXECUTE(vm_instr_update);
+ op_set:     EXECUTE(vm_instr_set);
+ op_get:     EXECUTE(vm_fast_get);
+ op_create:  EXECUTE(vm_instr_create);
+ op_call:    EXECUTE(vm_instr_call);
+ op_cmp:     EXECUTE(vm_fast_cmp);
+ op_debug:   EXECUTE(vm_instr_debug);
+ op_replace: EXECUTE(vm_instr_replace);
+ op_load:    EXECUTE(vm_instr_load);
+ op_branch: {
+        VM_STATS_START(start);
+        status = vm_fast_branch(vm, op);
+        VM_STATS_OPCODE(vm, VM_OP_BRANCH, start);
+        if (status < 0)
+            return status;
+        op = status ? op->imm.branch : op + 1;
+    }
+    DISPATCH();
+ op_halt:    return VM_STATUS_OK;
+
+#undef EXECUTE
+#undef DISPATCH
+
+#else /* !__GNUC__ */
+    return vm_run_threaded(vm, op);
+#endif
+}
+
+
+/********************
+ * vm_step_error
+ ********************/
+static int
+vm_step_error(vm_state_t *vm, int err, intptr_t diff)
+{
+    if (err == EOVERFLOW)
+        VM_RAISE(vm, err, "branch beyond %s of code",
+                 diff > 0 ? "end" : "beginning");
+    else
+        VM_RAISE(vm, err, "invalid instruction 0x%" PRIxPTR, *vm->pc);
+}
+
+
+/********************
+ * vm_step
+ ********************/
+static inline int
+vm_step(vm_state_t *vm, int *status)
+{
+    /*
+     * Notes:
+     *   Returns TRUE if execution should continue with the next
+     *   instruction. Otherwise *status is the final status of the run.
+     */
+
+    vm_op_t   op;
+    intptr_t  diff;
+    int       err;
+
+    if ((err = vm_op_decode(vm->pc, vm->nsize, &op)) != 0)
+        goto invalid;
+    
+    VM_STATS_START(start);
+
+    switch ((vm_opcode_t)op.code) {
+    case VM_OP_PUSH:    *status = vm_instr_push(vm, &op);    break;
+    case VM_OP_POP:     *status = vm_instr_pop(vm, &op);     break;
+    case VM_OP_FILTER:  *status = vm_instr_filter(vm, &op);  break;
+    case VM_OP_UPDATE:  *status = vm_instr_update(vm, &op);  break;
+    case VM_OP_SET:     *status = vm_instr_set(vm, &op);     break;
+    case VM_OP_GET:     *status = vm_instr_get(vm, &op);     break;
+    case VM_OP_CREATE:  *status = vm_instr_create(vm, &op);  break;
+    case VM_OP_CALL:    *status = vm_instr_call(vm, &op);    break;
+    case VM_OP_CMP:     *status = vm_instr_cmp(vm, &op);     break;
+    case VM_OP_DEBUG:   *status = vm_instr_debug(vm, &op);   break;
+    case VM_OP_REPLACE: *status = vm_instr_replace(vm, &op); break;
+    case VM_OP_LOAD:    *status = vm_instr_load(vm, &op);    break;
+    case VM_OP_HALT:    *status = VM_STATUS_OK;              return FALSE;
+
+    case VM_OP_BRANCH:
+        /*
+         * Notes:
+         *   Bookkeeping of ninstr and nsize does not work with branches
+         *   (see the notes in vm_chunk_decode). As before, branching only
+         *   moves the program counter and relies on the terminating HALT.
+         */
+        *status = vm_instr_branch(vm, &op);
+        VM_STATS_OPCODE(vm, VM_OP_BRANCH, start);
+        if (*status < 0)
+            return FALSE;
+        if (*status) {
+            diff = op.arg;
+            if (diff <= 0 || vm->nsize < (int)(diff * sizeof(uintptr_t))) {
+                *status = vm_step_error(vm, EOVERFLOW, diff);
+                return FALSE;
             }
+            vm->pc += diff;
         }
+        else
+            vm->pc++;
+        *status = VM_STATUS_OK;
+        return TRUE;
         
-        switch ((vm_opcode_t)VM_OP_CODE(*vm->pc)) {
-        case VM_OP_PUSH:    status = vm_instr_push(vm);   break;
-        case VM_OP_POP:     status = vm_instr_pop(vm);    break;
-        case VM_OP_FILTER:  status = vm_instr_filter(vm); break;
-        case VM_OP_UPDATE:  status = vm_instr_update(vm); break;
-        case VM_OP_SET:     status = vm_instr_set(vm);    break;
-        case VM_OP_GET:     status = vm_instr_get(vm);    break;
-        case VM_OP_CREATE:  status = vm_instr_create(vm); break;
-        case VM_OP_CALL:    status = vm_instr_call(vm);   break;
-        case VM_OP_CMP:     status = vm_instr_cmp(vm);    break;
-        case VM_OP_BRANCH:  status = vm_instr_branch(vm); break;
-        case VM_OP_DEBUG:   status = vm_instr_debug(vm);  break;
-        case VM_OP_HALT:    return status;
-        case VM_OP_REPLACE: status = vm_instr_replace(vm); break;
-        default: VM_RAISE(vm, EILSEQ, "invalid instruction 0x%" PRIxPTR, *vm->pc);
+    default:
+        goto invalid;
+    }
+
+    VM_STATS_OPCODE(vm, op.code, start);
+
+    if (*status != VM_STATUS_OK)
+        return FALSE;
+
+    vm->ninstr--;
+    vm->pc    += op.size;
+    vm->nsize -= op.size * sizeof(uintptr_t);
+
+    return TRUE;
+
+ invalid:
+    *status = vm_step_error(vm, err ? err : EILSEQ, 0);
+    return FALSE;
+}
+
+
+/********************
+ * vm_run_bytecode
+ ********************/
+static int
+vm_run_bytecode(vm_state_t *vm)
+{
+    int status = VM_STATUS_OK;
+
+    while (vm->ninstr > 0)
+        if (!vm_step(vm, &status))
+            break;
+    
+    return status;
+}
+
+
+/********************
+ * vm_run_traced
+ ********************/
+int
+vm_run_traced(vm_state_t *vm)
+{
+    uintptr_t *pc;
+    char       instr[128];
+    int        n, status = VM_STATUS_OK;
+
+    while (vm->ninstr > 0) {
+        pc = vm->pc;
+        if ((n = vm_dump_instr(&pc, instr, sizeof(instr), 0)) > 0) {
+            if (instr[n-1] == '\n')
+                instr[n-1] = '\0';
+            DEBUG(DBG_VM, "executing %s", instr);
         }
+        
+        if (!vm_step(vm, &status))
+            break;
     }
     
     return status;
 }
 
 
+/*****************************************************************************
+ *                         *** instruction decoding ***                      *
+ *****************************************************************************/
+
+
+/********************
+ * vm_op_decode
+ ********************/
+static int
+vm_op_decode(uintptr_t *pc, int nsize, vm_op_t *op)
+{
+    uintptr_t instr = *pc;
+    uintptr_t data;
+    int       len;
+
+    memset(op, 0, sizeof(*op));
+    op->code = VM_OP_CODE(instr);
+    op->size = 1;
+
+    switch ((vm_opcode_t)op->code) {
+    case VM_OP_PUSH:
+        op->type = VM_PUSH_TYPE(instr);
+        data     = VM_PUSH_DATA(instr);
+        switch (op->type) {
+        case VM_TYPE_INTEGER:
+            if (data)
+                op->imm.i = data - 1;
+            else {
+                op->size  = 2;
+                op->imm.i = (int)pc[1];
+            }
+            break;
+        case VM_TYPE_DOUBLE:
+            op->size  = 1 + VM_ALIGN_TO_INSTR(sizeof(double));
+            op->imm.d = *(double *)(pc + 1);
+            break;
+        case VM_TYPE_STRING:
+        case VM_TYPE_GLOBAL:
+            op->size  = 1 + VM_ALIGN_TO_INSTR(data);
+            op->imm.s = (char *)(pc + 1);
+            break;
+        case VM_TYPE_LOCAL:
+        case VM_TYPE_FIELD:
+            op->arg = data;
+            break;
+        default:
+            return EINVAL;
+        }
+        break;
+
+    case VM_OP_DEBUG:
+        len       = VM_DEBUG_LEN(instr);
+        op->size  = 1 + VM_ALIGN_TO_INSTR(len);
+        op->imm.s = (char *)(pc + 1);
+        break;
+
+    case VM_OP_UPDATE:
+        op->arg  = VM_UPDATE_NFIELD(instr);
+        op->type = VM_UPDATE_PARTIAL(instr) ? TRUE : FALSE;
+        break;
+
+    case VM_OP_BRANCH:
+        op->type = VM_BRANCH_TYPE(instr);
+        op->arg  = VM_BRANCH_DIFF(instr);
+        break;
+
+    case VM_OP_LOAD:
+        if ((len = vm_load_size(pc, nsize)) < 0)
+            return EINVAL;
+        op->size  = len;
+        op->arg   = VM_LOAD_NSELECT(instr);
+        op->type  = VM_LOAD_FIELD(instr);
+        op->imm.s = (char *)(pc + 1);
+        break;
+
+    case VM_OP_POP:
+    case VM_OP_FILTER:
+    case VM_OP_REPLACE:
+    case VM_OP_SET:
+    case VM_OP_GET:
+    case VM_OP_CREATE:
+    case VM_OP_CALL:
+    case VM_OP_CMP:
+        op->arg = VM_OP_ARGS(instr);
+        break;
+
+    case VM_OP_HALT:
+        break;
+
+    default:
+        return EILSEQ;
+    }
+
+    if ((int)(op->size * sizeof(uintptr_t)) > nsize)
+        return EINVAL;
+    
+    return 0;
+}
+
+
+/********************
+ * vm_load_size
+ ********************/
+int
+vm_load_size(uintptr_t *pc, int nsize)
+{
+    /*
+     * Notes:
+     *   Walks the inline name and selector table of a LOAD, checking
+     *   that everything is well-formed and fits within nsize bytes.
+     *   Returns the total size of the instruction in words, or -1.
+     */
+
+    int nword, nselect, offs, len, i;
+
+    nword   = nsize / sizeof(uintptr_t);
+    nselect = VM_LOAD_NSELECT(*pc);
+    offs    = 1;
+
+    if (offs >= nword || (len = (int)pc[offs]) <= 0)
+        return -1;
+    offs += 1 + VM_ALIGN_TO_INSTR(len);
+
+    for (i = 0; i < nselect; i++) {
+        if (offs >= nword)
+            return -1;
+        
+        switch (VM_SELECT_TYPE(pc[offs])) {
+        case VM_TYPE_INTEGER:
+            offs += 2;
+            break;
+        case VM_TYPE_DOUBLE:
+            offs += 1 + VM_ALIGN_TO_INSTR(sizeof(double));
+            break;
+        case VM_TYPE_STRING:
+            if (offs + 1 >= nword || (len = (int)pc[offs + 1]) <= 0)
+                return -1;
+            offs += 2 + VM_ALIGN_TO_INSTR(len);
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if (offs > nword)
+        return -1;
+
+    return offs;
+}
+
+
+/********************
+ * vm_chunk_decode
+ ********************/
+int
+vm_chunk_decode(vm_chunk_t *c)
+{
+    /*
+     * Notes:
+     *   We decode the chunk into an array of fixed-size operations with
+     *   all immediate operands unpacked, strings pointing directly into
+     *   the bytecode and branch targets resolved to absolute operations.
+     *   The array is always terminated by an extra HALT that doubles as
+     *   the target for branches to the end of the chunk. Chunks that fail
+     *   to decode are left alone and run by the bytecode interpreter which
+     *   then raises the appropriate exception if the offending instruction
+     *   is ever reached.
+     */
+
+    vm_op_t *ops, *op;
+    int     *map, nword, nop, offs, target, err;
+
+    vm_chunk_undecode(c);
+
+    nword = c->nsize / sizeof(uintptr_t);
+    ops   = ALLOC_ARR(vm_op_t, c->ninstr + 1);
+    map   = ALLOC_ARR(int, nword + 1);
+
+    if (ops == NULL || map == NULL) {
+        err = ENOMEM;
+        goto fail;
+    }
+
+    for (offs = 0; offs <= nword; offs++)
+        map[offs] = -1;
+    
+    for (offs = 0, nop = 0, op = ops; offs < nword; nop++, op++) {
+        if (nop >= c->ninstr) {
+            err = EINVAL;
+            goto fail;
+        }
+        if ((err = vm_op_decode(c->instrs + offs,
+                                (nword - offs) * sizeof(uintptr_t), op)) != 0)
+            goto fail;
+        map[offs] = nop;
+        offs     += op->size;
+    }
+    
+    op->code = VM_OP_HALT;
+    op->size = 0;
+    map[nword] = nop;
+    
+    for (offs = 0, op = ops; op->size != 0; offs += op->size, op++) {
+        if (op->code != VM_OP_BRANCH)
+            continue;
+        
+        target = offs + op->arg;
+        if (op->arg <= 0 || target > nword || map[target] < 0) {
+            err = EOVERFLOW;
+            goto fail;
+        }
+        op->imm.branch = ops + map[target];
+    }
+
+    FREE(map);
+    c->ops = ops;
+    c->nop = nop;
+
+    return 0;
+
+ fail:
+    FREE(ops);
+    FREE(map);
+    return err;
+}
+
+
+/********************
+ * vm_op_effect
+ ********************/
+static int
+vm_op_effect(vm_op_t *op)
+{
+    /*
+     * Notes:
+     *   Returns the net effect of op on the depth of the stack. None of
+     *   the instructions ever goes above its net effect, or above the
+     *   initial depth if the net effect is negative, while being run.
+     */
+
+    switch ((vm_opcode_t)op->code) {
+    case VM_OP_PUSH:
+        return op->type == VM_TYPE_LOCAL ? -2 * op->arg : 1;
+    case VM_OP_POP:
+        return op->arg == VM_POP_DISCARD ? -1 : 0;
+    case VM_OP_FILTER:
+        return -3 * op->arg;
+    case VM_OP_UPDATE:
+    case VM_OP_REPLACE:
+        return -(op->arg + 2);
+    case VM_OP_LOAD:
+        return 1;
+    case VM_OP_CREATE:
+        return 1 - 2 * op->arg;
+    case VM_OP_SET:
+        return op->arg & VM_SET_FIELD ? -3 : -2;
+    case VM_OP_GET:
+        return op->arg & VM_GET_FIELD ? -1 : 1;
+    case VM_OP_CALL:
+        return -op->arg;
+    case VM_OP_CMP:
+        return op->arg == VM_RELOP_NOT ? 0 : -1;
+    case VM_OP_BRANCH:
+        return op->type == VM_BRANCH ? 0 : -1;
+    default:
+        return 0;
+    }
+}
+
+
+/********************
+ * vm_chunk_depth
+ ********************/
+int
+vm_chunk_depth(vm_chunk_t *c)
+{
+    /*
+     * Notes:
+     *   Calculates the maximum depth the stack can reach while executing
+     *   the chunk, or -1 if the chunk cannot be analysed. The compiler
+     *   only ever branches forward so a single pass over the code is
+     *   enough: the depth at each instruction is the maximum of the depth
+     *   falling through from the previous one and the depths of all the
+     *   branches already seen to it.
+     */
+
+    vm_op_t  op;
+    int     *depth, nword, offs, target, d, max;
+
+    nword = c->nsize / sizeof(uintptr_t);
+    
+    if ((depth = ALLOC_ARR(int, nword + 1)) == NULL)
+        return -1;
+
+    for (offs = 0; offs <= nword; offs++)
+        depth[offs] = -1;
+    
+    d   = 0;
+    max = 0;
+    for (offs = 0; offs < nword; offs += op.size) {
+        if (depth[offs] > d)
+            d = depth[offs];
+        if (d < 0)
+            d = 0;                       /* dead code, never executed */
+
+        if (vm_op_decode(c->instrs + offs,
+                         (nword - offs) * sizeof(uintptr_t), &op) != 0)
+            goto fail;
+
+        if ((d += vm_op_effect(&op)) < 0)
+            d = 0;                       /* underflow is a runtime error */
+        if (d > max)
+            max = d;
+
+        if (op.code == VM_OP_BRANCH) {
+            target = offs + op.arg;
+            if (op.arg <= 0 || target > nword)
+                goto fail;
+            if (depth[target] < d)
+                depth[target] = d;
+            if (op.type == VM_BRANCH)
+                d = -1;                  /* only reachable via branches */
+        }
+        else if (op.code == VM_OP_HALT)
+            d = -1;
+    }
+
+    FREE(depth);
+    return max;
+
+ fail:
+    FREE(depth);
+    return -1;
+}
+
+
+/********************
+ * vm_chunk_undecode
+ ********************/
+void
+vm_chunk_undecode(vm_chunk_t *c)
+{
+    if (c != NULL) {
+        vm_jit_free(c);
+        FREE(c->ops);
+        c->verified = FALSE;
+        c->ops = NULL;
+        c->nop = 0;
+    }
+}
+
+
+/********************
+ * vm_chunk_remap_methods
+ ********************/
+int
+vm_chunk_remap_methods(vm_chunk_t *c, int *map, int nmap)
+{
+    /*
+     * Notes:
+     *   Method calls are compiled to PUSH INTEGER <id>, CALL <narg>.
+     *   Here we rewrite <id> for every such call according to map. The
+     *   encoded size of the PUSH is kept intact so the new ID needs to
+     *   fit in the original encoding.
+     */
+
+    vm_op_t    op;
+    uintptr_t *pc, *end, *push;
+    int        id, err;
+
+    if (c == NULL)
+        return 0;
+
+    vm_chunk_undecode(c);
+    
+    push = NULL;
+    id   = -1;
+    end  = c->instrs + c->nsize / sizeof(uintptr_t);
+    for (pc = c->instrs; pc < end; pc += op.size) {
+        if ((err = vm_op_decode(pc, (end - pc) * sizeof(uintptr_t), &op)) != 0)
+            return err;
+        
+        if (op.code == VM_OP_CALL && push != NULL) {
+            if (id < 0 || id >= nmap)
+                return ENOENT;
+            
+            id = map[id];
+            
+            if (VM_PUSH_DATA(*push) != 0) {
+                if (id < 0 || id >= 0xfffe)
+                    return EOVERFLOW;
+                *push = VM_PUSH_INSTR(VM_TYPE_INTEGER, id + 1);
+            }
+            else
+                push[1] = id;
+        }
+
+        if (op.code == VM_OP_PUSH && op.type == VM_TYPE_INTEGER) {
+            push = pc;
+            id   = op.imm.i;
+        }
+        else
+            push = NULL;
+    }
+    
+    return 0;
+}
+
+
 
 /*
  * PUSH
@@ -104,83 +1022,70 @@ vm_run(vm_state_t *vm)
  * vm_instr_push
  ********************/
 int
-vm_instr_push(vm_state_t *vm)
+vm_instr_push(vm_state_t *vm, vm_op_t *op)
 {
-#define CHECK_AND_GROW(t, nbyte) do {                                    \
-        if (vm->nsize - sizeof(uintptr_t) < nbyte)                       \
-            VM_RAISE(vm, EINVAL, "PUSH "#t": not enough data");          \
-        if (vm_stack_grow(vm->stack, VM_ALIGN_TO_INSTR(nbyte)))          \
-            VM_RAISE(vm, ENOMEM, "PUSH "#t": failed to grow the stack"); \
-    } while (0)
+    /*
+     * Notes:
+     *   vm_exec reserves enough stack for the whole chunk up front so
+     *   none of the pushes here need to check for or grow the space.
+     */
 
     vm_global_t  *g;
     vm_value_t    v;
-
-    uintptr_t     type = VM_PUSH_TYPE(*vm->pc);
-    uintptr_t     data = VM_PUSH_DATA(*vm->pc);
-    uintptr_t     i;
     char         *name;
-    int           nsize, id;
+    int           i, type, id;
     
 
-    switch (type) {
+    switch (op->type) {
     case VM_TYPE_INTEGER:
-        CHECK_AND_GROW(int, sizeof(int));
-        vm_push_int(vm->stack, data ? data - 1 : *(vm->pc + 1));
-        nsize = data ? 1 : 2;
+        vm_push_int(vm->stack, op->imm.i);
         break;
 
     case VM_TYPE_DOUBLE:
-        CHECK_AND_GROW(double, sizeof(double));
-        vm_push_double(vm->stack, *(double *)(vm->pc + 1));
-        nsize = 1 + VM_ALIGN_TO_INSTR(sizeof(double));
+        vm_push_double(vm->stack, op->imm.d);
         break;
 
     case VM_TYPE_STRING:
-        CHECK_AND_GROW(char *, data);
-        vm_push_string(vm->stack, (char *)(vm->pc + 1));
-        nsize = 1 + VM_ALIGN_TO_INSTR(data);
+        vm_push_string(vm->stack, op->imm.s);
         break;
 
     case VM_TYPE_GLOBAL:
-        CHECK_AND_GROW(char *, data);
-        name = (char *)(vm->pc + 1);
-        if (vm_global_lookup(name, &g) == ENOENT)
+        name = op->imm.s;
+        if (vm_global_cache_lookup(vm, name, &g) == ENOENT)
             g = vm_global_name(name);
         if (g == NULL)
             VM_RAISE(vm, ENOENT, "PUSH GLOBAL: failed to look up %s", name);
         vm_push_global(vm->stack, g);
-        nsize = 1 + VM_ALIGN_TO_INSTR(data);
         break;
 
     case VM_TYPE_LOCAL:
         /*
          * Notes:
-         *   VM_TRY takes care of popping locals off the scope stack in
+         *   vm_exec takes care of popping locals off the scope stack in
          *   case of an exception.
          */
         if (vm_scope_push(vm) != 0)
             VM_RAISE(vm, ENOMEM, "PUSH LOCALS: failed to push new scope");
-        for (i = 0; i < data; i++) {
+        for (i = 0; i < op->arg; i++) {
             if (vm_type(vm->stack) != VM_TYPE_INTEGER)
                 VM_RAISE(vm, EINVAL, "PUSH LOCALS: expecting integer ID");
             id   = vm_pop_int(vm->stack);
             type = vm_pop(vm->stack, &v);
-            if (vm_scope_set(vm->scope, id, type, v) != 0)
+            if (vm_scope_set(vm, id, type, v) != 0)
                 VM_RAISE(vm, EINVAL,
                              "PUSH LOCALS: failed to set local #0x%x", id);
         }
-        nsize = 1;
+        break;
+
+    case VM_TYPE_FIELD:
+        if (op->arg < 0 || op->arg >= vm->nfield)
+            VM_RAISE(vm, EINVAL, "PUSH FIELD: invalid field #%d", op->arg);
+        vm_push_field(vm->stack, vm->fields[op->arg]);
         break;
         
-    default: VM_RAISE(vm, EINVAL, "invalid type 0x%" PRIxPTR " to push", type);
+    default: VM_RAISE(vm, EINVAL, "invalid type 0x%x to push", op->type);
     }
 
-        
-    vm->ninstr--;
-    vm->pc    += nsize;
-    vm->nsize -= nsize * sizeof(uintptr_t);
-    
     return 0;
 }
 
@@ -193,9 +1098,9 @@ vm_instr_push(vm_state_t *vm)
  * vm_instr_pop
  ********************/
 int
-vm_instr_pop(vm_state_t *vm)
+vm_instr_pop(vm_state_t *vm, vm_op_t *op)
 {
-    int        kind = VM_OP_ARGS(*vm->pc);
+    int        kind = op->arg;
     int        type;
     vm_value_t value;
     
@@ -215,10 +1120,6 @@ vm_instr_pop(vm_state_t *vm)
         VM_RAISE(vm, EINVAL, "POP: invalid POP type 0x%x", kind);
     }
     
-    vm->ninstr--;
-    vm->pc    += 1;
-    vm->nsize -= sizeof(uintptr_t);
-
     return 0;
 }
 
@@ -228,21 +1129,81 @@ vm_instr_pop(vm_state_t *vm)
  */
 
 
+/********************
+ * vm_global_select
+ ********************/
+static int
+vm_global_select(vm_state_t *vm, vm_global_t *g, GQuark field, int neq,
+                 int type, vm_value_t *value)
+{
+    OhmFact *fact;
+    GValue  *gval;
+    int      j, match, ndrop;
+
+    /*
+     * Notes:
+     *   Returns the number of facts dropped, or a negative exception
+     *   status if matching a fact failed.
+     */
+
+    ndrop = 0;
+    for (j = 0; j < g->nfact; j++) {
+        if ((fact = g->facts[j]) == NULL)
+            continue;
+
+        if ((gval = ohm_structure_qget(OHM_STRUCTURE(fact), field)) == NULL)
+            match = FALSE;
+        else
+            match = vm_fact_match_field(vm, fact, field, gval, type, value);
+
+        if (match < 0)
+            return match;                     /* exception already raised */
+            
+        if ((!match && !neq) || (match && neq)) {
+            g_object_unref(fact);
+            g->facts[j] = NULL;
+            ndrop++;
+        }
+    }
+
+    return ndrop;
+}
+
+
+/********************
+ * vm_global_pack
+ ********************/
+static void
+vm_global_pack(vm_global_t *g, int nfact)
+{
+    int i, j;
+    
+    if (nfact != g->nfact) {
+        for (i = 0, j = 0; j < nfact; i++) {       /* pack facts tightly */
+            if (g->facts[i] != NULL)
+                g->facts[j++] = g->facts[i];
+        }
+    }
+    
+    g->nfact = nfact;
+}
+
+
 /********************
  * vm_instr_filter
  ********************/
 int
-vm_instr_filter(vm_state_t *vm)
+vm_instr_filter(vm_state_t *vm, vm_op_t *op)
 {
     vm_global_t *g = NULL;
     int          nfield, nfact;
-    char        *field;
+    GQuark       field;
     vm_value_t   value;
-    int          type, neq;
-    int          i, j, match;
+    int          type, neq, ndrop;
+    int          i;
     
     
-    nfield = VM_FILTER_NFIELD(*vm->pc);
+    nfield = op->arg;
     
     if (vm_peek(vm->stack, 3*nfield, &value) != VM_TYPE_GLOBAL)
         VM_RAISE(vm, ENOENT, "FILTER: no global found in stack");
@@ -252,48 +1213,168 @@ vm_instr_filter(vm_state_t *vm)
     
     for (i = 0; i < nfield; i++) {
 
-        if (vm_type(vm->stack) != VM_TYPE_STRING)
-            VM_RAISE(vm, EINVAL, "FILTER: invalid field name, string expected");
+        if ((field = vm_pop_field(vm->stack)) == 0)
+            VM_RAISE(vm, EINVAL, "FILTER: invalid field name, field expected");
         
-        field = vm_pop_string(vm->stack);
         type  = vm_pop(vm->stack, &value);
         neq   = vm_pop_int(vm->stack) == VM_RELOP_NE;
 
-        for (j = 0; j < g->nfact; j++) {
-            OhmFact    *fact;
-            GValue     *gval;
-            
-            if ((fact = g->facts[j]) == NULL)
-                continue;
+        if ((ndrop = vm_global_select(vm, g, field, neq, type, &value)) < 0)
+            return ndrop;
+        nfact -= ndrop;
+    }
 
-            if ((gval = ohm_fact_get(fact, field)) == NULL)
-                match = FALSE;
-            else
-                match = vm_fact_match_field(vm, fact, field, gval, type,&value);
-            
-            if ((!match && !neq) || (match && neq)) {
-                g_object_unref(fact);
-                g->facts[j] = NULL;
-                nfact--;
-            }
+    vm_global_pack(g, nfact);
+
+    return 0;
+}
+
+
+/*
+ * LOAD
+ */
+
+
+/********************
+ * vm_load_selector
+ ********************/
+static inline uintptr_t *
+vm_load_selector(uintptr_t *p, int *relop, int *type, int *field,
+                 vm_value_t *value)
+{
+    int len;
+    
+    *relop = VM_SELECT_RELOP(*p);
+    *type  = VM_SELECT_TYPE(*p);
+    *field = VM_SELECT_FIELD(*p);
+    p++;
+    
+    switch (*type) {
+    case VM_TYPE_INTEGER:
+        value->i = (int)*p;
+        p++;
+        break;
+    case VM_TYPE_DOUBLE:
+        value->d = *(double *)p;
+        p += VM_ALIGN_TO_INSTR(sizeof(double));
+        break;
+    case VM_TYPE_STRING:
+        len      = (int)*p;
+        value->s = (char *)(p + 1);
+        p += 1 + VM_ALIGN_TO_INSTR(len);
+        break;
+    default:
+        return NULL;
+    }
+
+    return p;
+}
+
+
+/********************
+ * vm_instr_load
+ ********************/
+int
+vm_instr_load(vm_state_t *vm, vm_op_t *op)
+{
+#define FAIL(err, fmt, args...) do {            \
+        if (g)                                  \
+            vm_global_free(g);                  \
+        VM_RAISE(vm, err, fmt, ## args);        \
+    } while (0)
+
+    /*
+     * Notes:
+     *   The global is pushed before filtering so that vm_exec cleans it
+     *   up if matching raises an exception, just like with FILTER.
+     */
+
+    uintptr_t   *p = (uintptr_t *)op->imm.s, *next;
+    vm_global_t *g = NULL, *top;
+    char        *name;
+    vm_value_t   value;
+    int          nfact, ndrop, len, relop, type, field, i;
+
+    len  = (int)*p;
+    name = (char *)(p + 1);
+    p   += 1 + VM_ALIGN_TO_INSTR(len);
+
+    /*
+     * Notes:
+     *   If the first selector is an equality we try selecting by a field
+     *   index first, any remaining selectors are then applied only to the
+     *   facts found by the index.
+     */
+
+    top = NULL;
+    i   = 0;
+    
+    if (op->arg > 0 && VM_SELECT_RELOP(*p) == VM_RELOP_EQ) {
+        next = vm_load_selector(p, &relop, &type, &field, &value);
+
+        if (next != NULL && field >= 0 && field < vm->nfield &&
+            vm_index_lookup(vm, name, vm->fields[field], type, &value,
+                            &top) == 0) {
+            p = next;
+            i = 1;
         }
     }
 
-    if (nfact != g->nfact) {
-        for (i = 0, j = 0; j < nfact; i++) {       /* pack facts tightly */
-            if (g->facts[i] != NULL)
-                g->facts[j++] = g->facts[i];
+    if (top == NULL && vm_global_cache_lookup(vm, name, &top) == ENOENT)
+        top = vm_global_name(name);
+    if (top == NULL)
+        VM_RAISE(vm, ENOENT, "LOAD: failed to look up %s", name);
+    vm_push_global(vm->stack, top);
+    
+    if (op->arg > i) {
+        nfact = top->nfact;
+
+        for ( ; i < op->arg; i++) {
+            p = vm_load_selector(p, &relop, &type, &field, &value);
+            if (p == NULL)
+                VM_RAISE(vm, EINVAL, "LOAD: invalid selector type 0x%x", type);
+
+            if (field < 0 || field >= vm->nfield)
+                VM_RAISE(vm, EINVAL, "LOAD: invalid field #%d", field);
+            
+            ndrop = vm_global_select(vm, top, vm->fields[field],
+                                     relop == VM_RELOP_NE, type, &value);
+            if (ndrop < 0)
+                return ndrop;
+            nfact -= ndrop;
         }
+
+        vm_global_pack(top, nfact);
     }
+
+    if ((field = op->type) < 0)
+        return 0;
     
-    g->nfact = nfact;
+    g = vm_pop_global(vm->stack);
+    
+    if (field < 0 || field >= vm->nfield)
+        FAIL(EINVAL, "LOAD: invalid field #%d", field);
     
+    if (g->nfact < 1)
+        FAIL(ENOENT, "LOAD: nonexisting global %s", name);
 
-    vm->ninstr--;
-    vm->pc++;
-    vm->nsize -= sizeof(uintptr_t);
+    if (g->nfact > 1)
+        FAIL(EINVAL, "LOAD: cannot get field of multiple globals");
+
+    type = vm_fact_get_field(vm, g->facts[0], vm->fields[field], &value);
+    if (type < 0) {
+        vm_global_free(g);
+        return type;
+    }
+    if (type == VM_TYPE_UNKNOWN)
+        FAIL(ENOENT, "LOAD: global has no field %s",
+             g_quark_to_string(vm->fields[field]));
+
+    vm_push(vm->stack, type, value);
+    vm_global_free(g);
 
     return 0;
+#undef FAIL
 }
 
 
@@ -306,11 +1387,12 @@ vm_instr_filter(vm_state_t *vm)
  * vm_instr_update
  ********************/
 int
-vm_instr_update(vm_state_t *vm)
+vm_instr_update(vm_state_t *vm, vm_op_t *op)
 {
 #define FAIL(err, fmt, args...) do {                                    \
         if (src) vm_global_free(src);                                   \
         if (dst) vm_global_free(dst);                                   \
+        vm_join_free(&join);                                            \
         VM_RAISE(vm, err, fmt, ## args);                                \
     } while (0)
 
@@ -318,17 +1400,19 @@ vm_instr_update(vm_state_t *vm)
     int          nsrc;
     vm_value_t   sval, dval;
     OhmFact     *sfact, *dfact;
-    int          partial, nfield, i, j, success;
+    int          partial, nfield, i, j, g, success;
     int          match;
+    vm_join_t    join;
     
     src     = NULL;
     dst     = NULL;
-    nfield  = VM_UPDATE_NFIELD(*vm->pc);
-    partial = VM_UPDATE_PARTIAL(*vm->pc);
+    nfield  = op->arg;
+    partial = op->type;
+
+    memset(&join, 0, sizeof(join));
 
     {
-        char   *fields[nfield];
-        GValue *values[nfield];
+        GQuark  fields[nfield];
         
         if (vm_peek(vm->stack, nfield, &dval) != VM_TYPE_GLOBAL)
             FAIL(ENOENT, "UPDATE: no global destination found in stack");
@@ -337,7 +1421,7 @@ vm_instr_update(vm_state_t *vm)
             FAIL(ENOENT, "UPDATE: no global source found in stack");
     
         for (i = 0; i < nfield; i++)
-            if ((fields[i] = vm_pop_string(vm->stack)) == NULL)
+            if ((fields[i] = vm_pop_field(vm->stack)) == 0)
                 FAIL(ENOENT, "UPDATE: expected #%d field name not in stack", i);
     
         dst  = dval.g;
@@ -347,15 +1431,17 @@ vm_instr_update(vm_state_t *vm)
         vm_pop_global(vm->stack);                    /* pop destination */
         vm_pop_global(vm->stack);                    /* pop source */
         
+        if (vm_global_join(src, dst, fields, nfield, &join) != 0)
+            FAIL(ENOMEM, "UPDATE: failed to match source and destination");
+
         for (i = 0; i < nsrc; i++) {
             sfact = src->facts[i];
-            if ((j = vm_fact_collect_fields(sfact, fields, nfield, values)) < 0)
-                FAIL(ENOENT, "UPDATE: source has no field %s", fields[-j]);
+            if ((g = join.group[i]) < VM_JOIN_NOMATCH)
+                FAIL(ENOENT, "UPDATE: source has no field %s",
+                     g_quark_to_string(fields[VM_JOIN_FIELD(g)]));
             
             match = FALSE;
-            for (j = vm_global_find_first(dst, fields, values, nfield);
-                 j >= 0;
-                 j = vm_global_find_next(dst, j, fields, values, nfield)) {
+            for (j = g >= 0 ? join.first[g] : -1; j >= 0; j = join.next[j]) {
                 match = TRUE;
                 
                 dfact = dst->facts[j];
@@ -365,6 +1451,9 @@ vm_instr_update(vm_state_t *vm)
                     success = (vm_fact_copy(dfact, sfact) != NULL);
                 if (!success)
                     FAIL(EINVAL, "UPDATE: failed to update source fact #%d", i);
+
+                vm_index_reset(vm, ohm_structure_get_name(OHM_STRUCTURE(dfact)),
+                               0);
             }
             
             if (!match)
@@ -375,6 +1464,8 @@ vm_instr_update(vm_state_t *vm)
             src->facts[i] = NULL;
             src->nfact--;
         }
+        vm_join_free(&join);
+
         for (j = 0; j < dst->nfact; j++) {
             g_object_unref(dst->facts[j]);
             dst->facts[j] = NULL;
@@ -387,10 +1478,6 @@ vm_instr_update(vm_state_t *vm)
     if (dst)
         vm_global_free(dst);
 
-    vm->ninstr--;
-    vm->pc++;
-    vm->nsize -= sizeof(uintptr_t);
-
     return 0;
 #undef FAIL
 }
@@ -404,11 +1491,12 @@ vm_instr_update(vm_state_t *vm)
  * vm_instr_replace
  ********************/
 int
-vm_instr_replace(vm_state_t *vm)
+vm_instr_replace(vm_state_t *vm, vm_op_t *op)
 {
 #define FAIL(err, fmt, args...) do {                                    \
         if (src) vm_global_free(src);                                   \
         if (dst) vm_global_free(dst);                                   \
+        vm_join_free(&join);                                            \
         VM_RAISE(vm, err, fmt, ## args);                                \
     } while (0)
 
@@ -416,13 +1504,16 @@ vm_instr_replace(vm_state_t *vm)
     int          nsrc;
     vm_value_t   sval, dval;
     OhmFact     *sfact, *dfact;
-    int          nfield, i, j, cnt;
+    int          nfield, i, j, g, cnt;
     int          match, success;
     char         name[256];
+    vm_join_t    join;
     
     src     = NULL;
     dst     = NULL;
-    nfield  = VM_REPLACE_NFIELD(*vm->pc);
+    nfield  = op->arg;
+
+    memset(&join, 0, sizeof(join));
     
     if (vm_peek(vm->stack, nfield, &dval) != VM_TYPE_GLOBAL)
         FAIL(ENOENT, "REPLACE: no global destination found in stack");
@@ -449,12 +1540,11 @@ vm_instr_replace(vm_state_t *vm)
     }
     
     {
-        char    *fields[nfield];
-        GValue  *values[nfield];
+        GQuark   fields[nfield];
         
         if (nfield > 0) {
             for (i = 0; i < nfield; i++)
-                if ((fields[i] = vm_pop_string(vm->stack)) == NULL)
+                if ((fields[i] = vm_pop_field(vm->stack)) == 0)
                     FAIL(ENOENT, "REPLACE: #%d field name not in stack", i);
         }
     
@@ -462,19 +1552,29 @@ vm_instr_replace(vm_state_t *vm)
         vm_pop_global(vm->stack);                        /* pop source */
             
         if (nfield > 0) {
+            if (vm_global_join(src, dst, fields, nfield, &join) != 0)
+                FAIL(ENOMEM, "REPLACE: failed to match source and destination");
+
             for (i = 0; i < nsrc; i++) {
                 sfact = src->facts[i];
-                if ((j = vm_fact_collect_fields(sfact,
-                                                fields, nfield, values)) < 0)
-                    FAIL(ENOENT, "REPLACE: source has no field %s", fields[-j]);
+                if ((g = join.group[i]) < VM_JOIN_NOMATCH)
+                    FAIL(ENOENT, "REPLACE: source has no field %s",
+                         g_quark_to_string(fields[VM_JOIN_FIELD(g)]));
                 
+                /*
+                 * Notes:
+                 *   A destination is consumed by the first source that
+                 *   matches it, the rest of the sources with the same
+                 *   key are inserted as new facts.
+                 */
+
                 match = FALSE;
-                for (j = vm_global_find_first(dst, fields, values, nfield);
-                     j >= 0;
-                     j = vm_global_find_next(dst, j, fields, values, nfield)) {
+                j = g >= 0 ? join.first[g] : -1;
+                for ( ; j >= 0; j = join.next[j]) {
+                    if ((dfact = dst->facts[j]) == NULL)
+                        continue;
+                    
                     match = TRUE;
-                
-                    dfact = dst->facts[j];
                     success = (vm_fact_update(dfact, sfact) != NULL);
                     if (!success)
                         FAIL(EINVAL, "REPLACE: failed to update fact #%d", i);
@@ -490,6 +1590,8 @@ vm_instr_replace(vm_state_t *vm)
                     src->nfact--;
                 }
             }
+
+            vm_join_free(&join);
         }
         
         /* remove leftover destinations */
@@ -527,16 +1629,14 @@ vm_instr_replace(vm_state_t *vm)
         }
 
     }
+
+    vm_global_cache_invalidate(vm, name);
     
     if (src)
         vm_global_free(src);
     if (dst)
         vm_global_free(dst);
 
-    vm->ninstr--;
-    vm->pc++;
-    vm->nsize -= sizeof(uintptr_t);
-
     return 0;
 #undef FAIL
 }
@@ -551,7 +1651,7 @@ vm_instr_replace(vm_state_t *vm)
  * vm_instr_set_var
  ********************/
 int
-vm_instr_set_var(vm_state_t *vm)
+vm_instr_set_var(vm_state_t *vm, vm_op_t *op)
 {
     OhmFactStore *store = ohm_fact_store_get_fact_store();
     OhmFact      *fact;
@@ -588,6 +1688,8 @@ vm_instr_set_var(vm_state_t *vm)
                              "SET: failed to insert fact to factstore");
             }
         }
+        
+        vm_global_cache_invalidate(vm, dst->name);
     }
     else {
         if (src->nfact != dst->nfact)
@@ -595,19 +1697,20 @@ vm_instr_set_var(vm_state_t *vm)
                          "SET: argument dimensions do not match (%d != %d)",
                          src->nfact, dst->nfact);
         
-        for (i = 0; i < src->nfact; i++)
-            if (vm_fact_copy(dst->facts[i], src->facts[i]) == NULL)
+        for (i = 0; i < src->nfact; i++) {
+            fact = dst->facts[i];
+            if (vm_fact_copy(fact, src->facts[i]) == NULL)
                 VM_RAISE(vm, EINVAL, "SET: failed to copy fact");
+            vm_index_reset(vm, ohm_structure_get_name(OHM_STRUCTURE(fact)), 0);
+        }
     }
     
     vm_global_free(src);
     vm_global_free(dst);
-    
-    vm->ninstr--;
-    vm->pc++;
-    vm->nsize -= sizeof(uintptr_t);
-    
+        
     return 0;
+
+    (void)op;
 }
 
 
@@ -615,7 +1718,7 @@ vm_instr_set_var(vm_state_t *vm)
  * vm_instr_set_field
  ********************/
 int
-vm_instr_set_field(vm_state_t *vm)
+vm_instr_set_field(vm_state_t *vm, vm_op_t *op)
 {
 #define FAIL(err, fmt, args...) do {            \
         if (g)                                  \
@@ -625,17 +1728,15 @@ vm_instr_set_field(vm_state_t *vm)
 
     OhmFactStore *store = ohm_fact_store_get_fact_store();
     vm_global_t  *g = NULL;
-    char         *field;
+    GQuark        field;
     vm_value_t   value;
-    int          type;
+    int          type, status;
 
     if (store == NULL)
         FAIL(EINVAL, "SET FIELD: could not determine fact store");
 
-    if (vm_type(vm->stack) != VM_TYPE_STRING)
-        FAIL(EINVAL, "SET FIELD: invalid field name, string expected");
-
-    field = vm_pop_string(vm->stack);
+    if ((field = vm_pop_field(vm->stack)) == 0)
+        FAIL(EINVAL, "SET FIELD: invalid field name, field expected");
 
     if (vm_type(vm->stack) != VM_TYPE_GLOBAL)
         FAIL(EINVAL, "SET FIELD: destination, global expected");
@@ -649,14 +1750,17 @@ vm_instr_set_field(vm_state_t *vm)
     if (g->nfact > 1)
         FAIL(EINVAL, "SET FIELD: cannot set field of multiple globals");
     
-    vm_fact_set_field(vm, g->facts[0], field, type, &value);
+    status = vm_fact_set_field(vm, g->facts[0], field, type, &value);
+    vm_index_reset(vm, ohm_structure_get_name(OHM_STRUCTURE(g->facts[0])),
+                   field);
     vm_global_free(g);
-    
-    vm->ninstr--;
-    vm->pc++;
-    vm->nsize -= sizeof(uintptr_t);
-    
+
+    if (status < 0)
+        return status;
+        
     return 0;
+
+    (void)op;
 }
 
 
@@ -664,12 +1768,12 @@ vm_instr_set_field(vm_state_t *vm)
  * vm_instr_set
  ********************/
 int
-vm_instr_set(vm_state_t *vm)
+vm_instr_set(vm_state_t *vm, vm_op_t *op)
 {
-    if (!VM_OP_ARGS(*vm->pc) & VM_SET_FIELD)
-        return vm_instr_set_var(vm);
+    if (!(op->arg & VM_SET_FIELD))
+        return vm_instr_set_var(vm, op);
     else
-        return vm_instr_set_field(vm);
+        return vm_instr_set_field(vm, op);
 }
 
 
@@ -682,7 +1786,7 @@ vm_instr_set(vm_state_t *vm)
  * vm_instr_get_field
  ********************/
 int
-vm_instr_get_field(vm_state_t *vm)
+vm_instr_get_field(vm_state_t *vm, vm_op_t *op)
 {
 #define FAIL(err, fmt, args...) do {            \
         if (g)                                  \
@@ -692,17 +1796,15 @@ vm_instr_get_field(vm_state_t *vm)
 
     OhmFactStore *store = ohm_fact_store_get_fact_store();
     vm_global_t  *g = NULL;
-    char         *field;
+    GQuark        field;
     vm_value_t   value;
     int          type;
 
     if (store == NULL)
         FAIL(EINVAL, "GET FIELD: could not determine fact store");
 
-    if (vm_type(vm->stack) != VM_TYPE_STRING)
-        FAIL(EINVAL, "GET FIELD: invalid field name, string expected");
-
-    field = vm_pop_string(vm->stack);
+    if ((field = vm_pop_field(vm->stack)) == 0)
+        FAIL(EINVAL, "GET FIELD: invalid field name, field expected");
 
     if (vm_type(vm->stack) != VM_TYPE_GLOBAL)
         FAIL(EINVAL, "GET FIELD: destination, global expected");
@@ -716,17 +1818,20 @@ vm_instr_get_field(vm_state_t *vm)
         FAIL(EINVAL, "GET FIELD: cannot get field of multiple globals");
 
     type = vm_fact_get_field(vm, g->facts[0], field, &value);
+    if (type < 0) {
+        vm_global_free(g);
+        return type;
+    }
     if (type == VM_TYPE_UNKNOWN)
-        FAIL(ENOENT, "GET FIELD: global has no field %s", field);
+        FAIL(ENOENT, "GET FIELD: global has no field %s",
+             g_quark_to_string(field));
 
     vm_push(vm->stack, type, value);
     vm_global_free(g);
-    
-    vm->ninstr--;
-    vm->pc++;
-    vm->nsize -= sizeof(uintptr_t);
-    
+        
     return 0;
+
+    (void)op;
 }
 
 
@@ -734,13 +1839,13 @@ vm_instr_get_field(vm_state_t *vm)
  * vm_instr_get_local
  ********************/
 int
-vm_instr_get_local(vm_state_t *vm)
+vm_instr_get_local(vm_state_t *vm, vm_op_t *op)
 {
     vm_value_t value;
     int        type, err;
-    int        idx = VM_OP_ARGS(*vm->pc) & ~VM_GET_LOCAL;
+    int        idx = op->arg & ~VM_GET_LOCAL;
     
-    if ((type = vm_scope_get(vm->scope, idx, &value)) == VM_TYPE_UNKNOWN) {
+    if ((type = vm_scope_get(vm, idx, &value)) == VM_TYPE_UNKNOWN) {
         type    = VM_TYPE_NIL;
         value.i = 0;
     }
@@ -748,10 +1853,6 @@ vm_instr_get_local(vm_state_t *vm)
     if ((err = vm_push(vm->stack, type, value)) != 0)
         VM_RAISE(vm, ENOMEM,
                      "GET LOCAL: failed to push value of #0x%x", idx);
-
-    vm->ninstr--;
-    vm->pc++;
-    vm->nsize -= sizeof(uintptr_t);
     
     return 0;
 }
@@ -762,7 +1863,7 @@ vm_instr_get_local(vm_state_t *vm)
  * vm_instr_get_var
  ********************/
 int
-vm_instr_get_var(vm_state_t *vm)
+vm_instr_get_var(vm_state_t *vm, vm_op_t *op)
 {
     /*
      * XXX TODO implement me: fetch named local variable and push its
@@ -778,6 +1879,7 @@ vm_instr_get_var(vm_state_t *vm)
     return EOPNOTSUPP; /* not reached */
 
     (void)vm;
+    (void)op;
 }
 
 
@@ -786,14 +1888,14 @@ vm_instr_get_var(vm_state_t *vm)
  * vm_instr_get
  ********************/
 int
-vm_instr_get(vm_state_t *vm)
+vm_instr_get(vm_state_t *vm, vm_op_t *op)
 {
-    if (VM_OP_ARGS(*vm->pc) & VM_GET_FIELD)
-        return vm_instr_get_field(vm);
-    else if (VM_OP_ARGS(*vm->pc) & VM_GET_LOCAL)
-        return vm_instr_get_local(vm);
+    if (op->arg & VM_GET_FIELD)
+        return vm_instr_get_field(vm, op);
+    else if (op->arg & VM_GET_LOCAL)
+        return vm_instr_get_local(vm, op);
     else
-        return vm_instr_get_var(vm);
+        return vm_instr_get_var(vm, op);
 }
 
 
@@ -806,7 +1908,7 @@ vm_instr_get(vm_state_t *vm)
  * vm_instr_create
  ********************/
 int
-vm_instr_create(vm_state_t *vm)
+vm_instr_create(vm_state_t *vm, vm_op_t *op)
 {
 #define FAIL(err, fmt, args...) do {            \
         if (g)                                  \
@@ -817,12 +1919,12 @@ vm_instr_create(vm_state_t *vm)
     vm_global_t *g = NULL;
     OhmFact     *fact;
     int          nfield;
-    char        *field;
+    GQuark       field;
     vm_value_t   value;
-    int          type;
+    int          type, status;
     int          i;
     
-    nfield = VM_CREATE_NFIELD(*vm->pc);    
+    nfield = op->arg;
 
     if (ALLOC_VAROBJ(g, nfield, facts) == NULL)
         FAIL(ENOMEM, "CREATE: failed to allocate memory for new global");
@@ -831,24 +1933,24 @@ vm_instr_create(vm_state_t *vm)
         FAIL(ENOMEM, "CREATE: failed to allocate fact for new global");
     
     for (i = 0; i < nfield; i++) {
-        if (vm_type(vm->stack) != VM_TYPE_STRING)
-            FAIL(EINVAL, "invalid field name, string expected");
+        if ((field = vm_pop_field(vm->stack)) == 0)
+            FAIL(EINVAL, "invalid field name, field expected");
         
-        field = vm_pop_string(vm->stack);
         type  = vm_pop(vm->stack, &value);
 
-        if (!vm_fact_set_field(vm, fact, field, type, &value))
-            FAIL(ENOMEM, "failed to add field %s", field);
+        if ((status = vm_fact_set_field(vm, fact, field, type, &value)) < 0) {
+            g_object_unref(fact);
+            vm_global_free(g);
+            return status;
+        }
+        if (status == 0)
+            FAIL(ENOMEM, "failed to add field %s", g_quark_to_string(field));
     }
 
     g->facts[0] = fact;
     g->nfact    = 1;
     vm_push_global(vm->stack, g);
     
-    vm->ninstr--;
-    vm->pc++;
-    vm->nsize -= sizeof(uintptr_t);
-
     return 0;
 #undef FAIL
 }
@@ -863,11 +1965,11 @@ vm_instr_create(vm_state_t *vm)
  * vm_instr_call
  ********************/
 int
-vm_instr_call(vm_state_t *vm)
+vm_instr_call(vm_state_t *vm, vm_op_t *op)
 {
     vm_value_t   id;
     vm_method_t *m;
-    int          narg = VM_OP_ARGS(*vm->pc);
+    int          narg = op->arg;
     int          type, status;
     char        *name;
 
@@ -877,10 +1979,6 @@ vm_instr_call(vm_state_t *vm)
     default: VM_RAISE(vm, EINVAL, "CALL: unknown method ID type 0x%x",type);
     }
     
-    if (vm_stack_grow(vm->stack, narg))
-        VM_RAISE(vm, ENOMEM,
-                     "CALL: failed to grow the stack by %d entries", narg);
-
     status = vm_method_call(vm, name, m, narg);
 
     if (status < 0)
@@ -888,11 +1986,7 @@ vm_instr_call(vm_state_t *vm)
                  "CALL: method '%s' failed (error %d)", name, status);
     else if (status == 0)
         VM_FAIL(vm, "CALL: method '%s' failed without an error", name);
-    
-    vm->ninstr--;
-    vm->pc++;
-    vm->nsize -= sizeof(uintptr_t);
-    
+        
     return 0;
 }
 
@@ -905,7 +1999,7 @@ vm_instr_call(vm_state_t *vm)
  * vm_instr_cmp
  ********************/
 int
-vm_instr_cmp(vm_state_t *vm)
+vm_instr_cmp(vm_state_t *vm, vm_op_t *op)
 {
 #define FAIL(err, fmt, args...) do {                                    \
         if (type1 == VM_TYPE_GLOBAL) vm_global_free(arg1.g);            \
@@ -913,17 +2007,17 @@ vm_instr_cmp(vm_state_t *vm)
         VM_RAISE(vm, err, fmt, ## args);                                \
     } while (0)
 
-    vm_relop_t op;
+    vm_relop_t relop;
     vm_value_t arg1, arg2;
     uintptr_t  type1, type2, result;
     
-    op = VM_CMP_RELOP(*vm->pc);
+    relop = (vm_relop_t)op->arg;
 
     type1 = type2 = VM_TYPE_UNKNOWN;
     if ((type1 = vm_pop(vm->stack, &arg1)) == VM_TYPE_UNKNOWN)
         FAIL(ENOENT, "CMP: could not POP expected argument #1");
     
-    if (op != VM_RELOP_NOT) {
+    if (relop != VM_RELOP_NOT) {
         if ((type2 = vm_pop(vm->stack, &arg2)) == VM_TYPE_UNKNOWN)
             FAIL(ENOENT, "CMP: could not POP expected argument #2");
         
@@ -943,7 +2037,7 @@ vm_instr_cmp(vm_state_t *vm)
         }                                                                  \
     } while (0)
     
-    switch (op) {
+    switch (relop) {
     case VM_RELOP_EQ:  COMPARE(arg1, ==, arg2); break;
     case VM_RELOP_NE:  COMPARE(arg1, !=, arg2); break;
     case VM_RELOP_LT:  COMPARE(arg1, < , arg2); break;
@@ -966,10 +2060,6 @@ vm_instr_cmp(vm_state_t *vm)
  push_result:
     vm_push_int(vm->stack, result);
     
-    vm->ninstr--;
-    vm->pc++;
-    vm->nsize -= sizeof(uintptr_t);
-
     if (type1 == VM_TYPE_GLOBAL)
         vm_global_free(arg1.g);
     if (type2 == VM_TYPE_GLOBAL)
@@ -988,16 +2078,20 @@ vm_instr_cmp(vm_state_t *vm)
  * vm_instr_branch
  ********************/
 int
-vm_instr_branch (vm_state_t *vm)
+vm_instr_branch(vm_state_t *vm, vm_op_t *op)
 {
-    uintptr_t  brtype, brdiff, branch;
-    uintptr_t  type;
-    vm_value_t value;
+    /*
+     * Notes:
+     *   Returns TRUE if the branch is to be taken. Moving the program
+     *   counter is left to the caller. The decoded interpreter simply
+     *   follows the pre-resolved target while the bytecode interpreter
+     *   needs to check and apply the encoded relative offset.
+     */
 
-    brtype = VM_BRANCH_TYPE(*vm->pc);
-    brdiff = VM_BRANCH_DIFF(*vm->pc);
+    int        branch, type;
+    vm_value_t value;
 
-    switch ((vm_branch_t)brtype) {
+    switch ((vm_branch_t)op->type) {
     case VM_BRANCH:
         branch = TRUE;
         break;
@@ -1013,10 +2107,10 @@ vm_instr_branch (vm_state_t *vm)
         case VM_TYPE_STRING:  branch = (value.s && *value.s); break;
         case VM_TYPE_GLOBAL:  branch = (value.g->nfact > 0 ); break;
         default:
-            VM_RAISE(vm, EINVAL, "BRANCH: argument of invalid type 0x%" PRIxPTR, type);
+            VM_RAISE(vm, EINVAL, "BRANCH: argument of invalid type 0x%x", type);
         }
         
-        if (brtype == VM_BRANCH_NE)
+        if (op->type == VM_BRANCH_NE)
             branch = !branch;
 
         if (type == VM_TYPE_GLOBAL)      /* free/unref tested globals */
@@ -1025,54 +2119,10 @@ vm_instr_branch (vm_state_t *vm)
         break;
         
     default:
-        VM_RAISE(vm, EINVAL, "BRANCH: invalid branch type 0x%" PRIxPTR, brtype);
+        VM_RAISE(vm, EINVAL, "BRANCH: invalid branch type 0x%x", op->type);
     }
 
-
-    /*
-     * Notes:
-     *   In hindsight, bookeeping of ninstr and nize and using ninstr > 0 as
-     *   the terminating condition for running the VM was arguably a bad idea.
-     *   It was originally designed for an assignment-only language with
-     *   strictly linear execution.
-     *
-     *   With the introduction of branching it all falls nicely apart as there
-     *   is no reasonable (= O(1)) way of determining the new values for
-     *   ninstr and nsize when we do branch. Of course we could go into the
-     *   trouble of calculating both ninstr and nsize diffs during compilation
-     *   encode then into the instruction itself but it would be rather
-     *   pointless.
-     *
-     *   The halt instruction was introduced to solve this problem: simply run
-     *   the VM until executing a halt instruction. However, the rest of the
-     *   VM execution still updates ninstr and nsize. The main driving loop
-     *   still uses ninstr (incorrectly; consider branches backwards with
-     *   negative diffs) in addition to the halt instruction. It needs to be
-     *   corrected to only use halt.
-     */
-    
-#if 0
-    vm->ninstr--;
-    vm->nsize -= sizeof(uintptr_t);
-    vm->pc++;
-#endif
-    
-    if (branch) {
-        if (brdiff > 0) {
-            if (vm->nsize < (int)(brdiff * sizeof(uintptr_t)))
-                VM_RAISE(vm, EOVERFLOW, "branch beyond end of code");
-        }
-        else {
-            if ((uintptr_t)(brdiff * sizeof(uintptr_t)) > vm->nsize)
-                VM_RAISE(vm, EOVERFLOW, "branch beyond beginning of code");
-        }
-        
-        vm->pc += brdiff;
-    }
-    else
-        vm->pc++;
-    
-    return 0;
+    return branch;
 }
 
 
@@ -1085,18 +2135,10 @@ vm_instr_branch (vm_state_t *vm)
  * vm_instr_debug
  ********************/
 int
-vm_instr_debug(vm_state_t *vm)
+vm_instr_debug(vm_state_t *vm, vm_op_t *op)
 {
-    char *info  = (char *)(vm->pc + 1);
-    int   len   = VM_DEBUG_LEN(*vm->pc);
-    int   nsize = 1 + VM_ALIGN_TO_INSTR(len);
-    
-    DEBUG(DBG_VM, "%s", info);
-    vm->info = info;
-
-    vm->ninstr--;
-    vm->pc    += nsize;
-    vm->nsize -= nsize * sizeof(uintptr_t);
+    DEBUG(DBG_VM, "%s", op->imm.s);
+    vm->info = op->imm.s;
     
     return 0;
 }
@@ -1122,9 +2164,10 @@ vm_chunk_new(int ninstr)
             return NULL;
         }
 
-    chunk->ninstr = 0;
-    chunk->nsize  = 0;
-    chunk->nleft  = ninstr * sizeof(uintptr_t);
+    chunk->ninstr   = 0;
+    chunk->nsize    = 0;
+    chunk->nleft    = ninstr * sizeof(uintptr_t);
+    chunk->maxdepth = -1;
 
     return chunk;
 }
@@ -1137,6 +2180,7 @@ void
 vm_chunk_del(vm_chunk_t *chunk)
 {
     if (chunk) {
+        vm_chunk_undecode(chunk);
         FREE(chunk->instrs);
         FREE(chunk);
     }
@@ -1178,6 +2222,9 @@ vm_chunk_add(vm_chunk_t *c, uintptr_t *code, int ninstr, int nsize)
     if (cp == NULL)
         return ENOMEM;
 
+    vm_chunk_undecode(c);                    /* decoding is now stale */
+    c->maxdepth = -1;                        /* and so is the depth */
+
     memcpy(cp, code, nsize);
     c->ninstr += ninstr;
     c->nsize  += nsize;
@@ -0,0 +1,303 @@
+/*************************************************************************
+This file is part of dres the resource policy dependency resolver.
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <dres/mm.h>
+#include <dres/vm.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+#  include <sys/mman.h>
+#  define JIT_X86_64 1
+#endif
+
+
+#ifdef JIT_X86_64
+
+/*
+ * x86-64 instruction templates
+ *
+ * The generated code keeps vm in %rbx for the duration of the call and
+ * calls the instruction handler of every operation with vm and the
+ * decoded operation as arguments, leaving the returned status in %eax.
+ * A non-zero status from an ordinary instruction, or a negative one from
+ * a branch, jumps to the common exit which returns it.
+ */
+
+#define JIT_PROLOGUE_SIZE 4                   /* push %rbx; mov %rdi,%rbx */
+#define JIT_CALL_SIZE     25                  /* vm, op, handler, call */
+#define JIT_EXEC_SIZE     (JIT_CALL_SIZE + 8) /* call, test, jne exit */
+#define JIT_BRANCH_SIZE   (JIT_EXEC_SIZE + 6) /* call, test, js exit, jne */
+#define JIT_JUMP_SIZE     5                   /* jmp */
+#define JIT_HALT_SIZE     4                   /* xor %eax,%eax; pop; ret */
+#define JIT_EXIT_SIZE     2                   /* pop %rbx; ret */
+#define JIT_SLACK         64                  /* > any one template */
+
+typedef struct {
+    unsigned char *buf;                       /* code buffer */
+    unsigned char *p;                         /* emit pointer */
+} jit_t;
+
+
+static inline void
+emit_bytes(jit_t *j, const unsigned char *bytes, int n)
+{
+    memcpy(j->p, bytes, n);
+    j->p += n;
+}
+
+
+static inline void
+emit_u64(jit_t *j, uint64_t v)
+{
+    memcpy(j->p, &v, sizeof(v));
+    j->p += sizeof(v);
+}
+
+
+static inline void
+emit_rel32(jit_t *j, int target)
+{
+    int32_t rel = (int32_t)(target - (j->p + 4 - j->buf));
+    
+    memcpy(j->p, &rel, sizeof(rel));
+    j->p += sizeof(rel);
+}
+
+
+static void
+emit_call(jit_t *j, vm_op_t *op, vm_instr_t handler)
+{
+    static const unsigned char mov_vm[]  = { 0x48, 0x89, 0xdf };
+    static const unsigned char mov_op[]  = { 0x48, 0xbe };
+    static const unsigned char mov_fn[]  = { 0x48, 0xb8 };
+    static const unsigned char call_fn[] = { 0xff, 0xd0 };
+    static const unsigned char test[]    = { 0x85, 0xc0 };
+
+    emit_bytes(j, mov_vm, sizeof(mov_vm));      /* mov    %rbx, %rdi   */
+    emit_bytes(j, mov_op, sizeof(mov_op));      /* movabs $op, %rsi    */
+    emit_u64(j, (uintptr_t)op);
+    emit_bytes(j, mov_fn, sizeof(mov_fn));      /* movabs $fn, %rax    */
+    emit_u64(j, (uintptr_t)handler);
+    emit_bytes(j, call_fn, sizeof(call_fn));    /* call   *%rax        */
+    emit_bytes(j, test, sizeof(test));          /* test   %eax, %eax   */
+}
+
+
+static void
+emit_jcc(jit_t *j, unsigned char cc, int target)
+{
+    unsigned char jcc[] = { 0x0f, cc };
+
+    emit_bytes(j, jcc, sizeof(jcc));
+    emit_rel32(j, target);
+}
+
+#define JCC_JNE 0x85
+#define JCC_JS  0x88
+
+
+/********************
+ * jit_size
+ ********************/
+static int
+jit_size(vm_op_t *op)
+{
+    switch (op->code) {
+    case VM_OP_HALT:
+        return JIT_HALT_SIZE;
+    case VM_OP_BRANCH:
+        return op->type == VM_BRANCH ? JIT_JUMP_SIZE : JIT_BRANCH_SIZE;
+    default:
+        return JIT_EXEC_SIZE;
+    }
+}
+
+#endif /* JIT_X86_64 */
+
+
+/********************
+ * vm_jit_available
+ ********************/
+int
+vm_jit_available(void)
+{
+#ifdef JIT_X86_64
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+
+/********************
+ * vm_jit_compile
+ ********************/
+int
+vm_jit_compile(vm_chunk_t *c)
+{
+    /*
+     * Notes:
+     *   Translates a decoded chunk to machine code by stitching together
+     *   the templates above. Branch targets are resolved to relative
+     *   offsets from the precomputed offsets of all operations, the extra
+     *   HALT terminating the decoded chunk included. The code refers to
+     *   the decoded operations for all immediate operands so it must be
+     *   freed whenever those are (see vm_chunk_undecode). A chunk that we
+     *   fail to translate is marked as such and left to the interpreter.
+     *
+     *   The buffer is sized from the template sizes above. To catch these
+     *   getting out of sync with the emitters, we check the emitted size
+     *   after every operation. The buffer has some slack at its end so a
+     *   single template overrunning its size stays within the mapping.
+     */
+
+#ifdef JIT_X86_64
+    static const unsigned char prologue[] = { 0x53, 0x48, 0x89, 0xfb };
+    static const unsigned char halt[]     = { 0x31, 0xc0, 0x5b, 0xc3 };
+    static const unsigned char epilogue[] = { 0x5b, 0xc3 };
+    static const unsigned char jmp[]      = { 0xe9 };
+
+    const vm_aot_api_t *api = vm_aot_api();
+    vm_op_t            *op;
+    jit_t               j;
+    int                *offs, size, exit, i, target;
+    void               *code;
+
+    if (c->jit != NULL)
+        return 0;
+    
+    if (c->ops == NULL)
+        return EINVAL;
+    
+    if ((offs = ALLOC_ARR(int, c->nop + 1)) == NULL)
+        return ENOMEM;
+    
+    size = JIT_PROLOGUE_SIZE;
+    for (i = 0, op = c->ops; i <= c->nop; i++, op++) {
+        if (op->code != VM_OP_HALT && api->instr[op->code] == NULL) {
+            FREE(offs);
+            c->njit = -1;
+            return EILSEQ;
+        }
+        offs[i] = size;
+        size   += jit_size(op);
+    }
+    exit  = size;
+    size += JIT_EXIT_SIZE;
+    
+    code = mmap(NULL, size + JIT_SLACK, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    
+    if (code == MAP_FAILED) {
+        FREE(offs);
+        c->njit = -1;
+        return errno;
+    }
+
+    j.buf = j.p = code;
+    emit_bytes(&j, prologue, sizeof(prologue)); /* push %rbx; mov %rdi,%rbx */
+
+    for (i = 0, op = c->ops; i <= c->nop; i++, op++) {
+        if (j.p - j.buf != offs[i])
+            goto mismatch;
+        
+        switch (op->code) {
+        case VM_OP_HALT:
+            emit_bytes(&j, halt, sizeof(halt));
+            break;
+        case VM_OP_BRANCH:
+            target = offs[op->imm.branch - c->ops];
+            if (op->type == VM_BRANCH) {
+                emit_bytes(&j, jmp, sizeof(jmp));
+                emit_rel32(&j, target);
+            }
+            else {
+                emit_call(&j, op, api->instr[VM_OP_BRANCH]);
+                emit_jcc(&j, JCC_JS, exit);
+                emit_jcc(&j, JCC_JNE, target);
+            }
+            break;
+        default:
+            emit_call(&j, op, api->instr[op->code]);
+            emit_jcc(&j, JCC_JNE, exit);
+        }
+    }
+    if (j.p - j.buf != exit)
+        goto mismatch;
+    emit_bytes(&j, epilogue, sizeof(epilogue));
+
+    if (j.p - j.buf != size)
+        goto mismatch;
+
+    FREE(offs);
+
+    if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, size + JIT_SLACK);
+        c->njit = -1;
+        return errno;
+    }
+    
+    c->jit  = (vm_native_t)code;
+    c->njit = size + JIT_SLACK;
+    
+    return 0;
+
+ mismatch:
+    VM_ERROR("JIT: template sizes out of sync with emitted code");
+    munmap(code, size + JIT_SLACK);
+    FREE(offs);
+    c->njit = -1;
+    return EFAULT;
+#else
+    c->njit = -1;
+    return EOPNOTSUPP;
+#endif
+}
+
+
+/********************
+ * vm_jit_free
+ ********************/
+void
+vm_jit_free(vm_chunk_t *c)
+{
+#ifdef JIT_X86_64
+    if (c->jit != NULL)
+        munmap((void *)c->jit, c->njit);
+#endif
+    
+    c->jit  = NULL;
+    c->njit = 0;
+}
+
+
+/* 
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:set expandtab shiftwidth=4:
+ */
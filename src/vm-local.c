@@ -77,16 +77,36 @@ vm_free_varnames(vm_state_t *vm)
 int
 vm_scope_push(vm_state_t *vm)
 {
-    vm_scope_t *scope = NULL;
+    /*
+     * Notes:
+     *   Pushing a scope only records the current length of the undo log.
+     *   The variable table is (re)sized here lazily as the number of locals
+     *   is only known once the rules have been loaded or compiled. Once the
+     *   tables have grown large enough no allocation takes place here.
+     */
+
+    vm_scope_t   *scope = &vm->scope;
+    unsigned int  i;
+    int           n;
     
-    if (ALLOC_VAROBJ(scope, vm->nlocal, variables) == NULL)
-        return ENOMEM;
-
-    scope->nvariable = vm->nlocal;
-
-    scope->parent = vm->scope;
-    vm->scope     = scope;
+    if (scope->nvariable < (unsigned int)vm->nlocal) {
+        if (REALLOC_ARR(scope->variables,
+                        scope->nvariable, vm->nlocal) == NULL)
+            return ENOMEM;
+        for (i = scope->nvariable; i < (unsigned int)vm->nlocal; i++)
+            scope->variables[i] = VM_TAGGED_UNKNOWN;
+        scope->nvariable = vm->nlocal;
+    }
+    
+    if (scope->depth >= scope->nmarkslot) {
+        n = scope->nmarkslot ? 2 * scope->nmarkslot : 8;
+        if (REALLOC_ARR(scope->marks, scope->nmarkslot, n) == NULL)
+            return ENOMEM;
+        scope->nmarkslot = n;
+    }
 
+    scope->marks[scope->depth++] = scope->nundo;
+    
     return 0;
 }
 
@@ -97,45 +117,78 @@ vm_scope_push(vm_state_t *vm)
 int
 vm_scope_pop(vm_state_t *vm)
 {
-    vm_scope_t *scope;
+    vm_scope_t *scope = &vm->scope;
+    vm_undo_t  *u;
+    int         mark;
 
-    if (vm->scope == NULL)
+    if (scope->depth <= 0)
         return ENOENT;
     
-    scope     = vm->scope;
-    vm->scope = vm->scope->parent;
+    mark = scope->marks[--scope->depth];
     
-    FREE(scope);
+    while (scope->nundo > mark) {
+        u = scope->undo + --scope->nundo;
+        scope->variables[u->idx] = u->value;
+    }
     
     return 0;
 }
 
 
+/********************
+ * vm_scope_exit
+ ********************/
+void
+vm_scope_exit(vm_state_t *vm)
+{
+    vm_scope_t *scope = &vm->scope;
+
+    FREE(scope->variables);
+    FREE(scope->undo);
+    FREE(scope->marks);
+    memset(scope, 0, sizeof(*scope));
+}
+
+
 /********************
  * vm_scope_set
  ********************/
 int
-vm_scope_set(vm_scope_t *scope, int id, int type, vm_value_t value)
+vm_scope_set(vm_state_t *vm, int id, int type, vm_value_t value)
 {
-    unsigned int idx = VM_LOCAL_INDEX(id);
+    vm_scope_t   *scope = &vm->scope;
+    unsigned int  idx   = VM_LOCAL_INDEX(id);
+    vm_undo_t    *u;
+    int           n;
 
-    if (scope->nvariable <= idx)
+    if (scope->depth <= 0 || scope->nvariable <= idx)
         return ENOENT;
 
-    if (scope->variables == NULL)
-        return ENOMEM;
-
     switch (type) {
     case VM_TYPE_INTEGER:
     case VM_TYPE_DOUBLE:
     case VM_TYPE_STRING:
-        scope->variables[idx].type = type;
-        scope->variables[idx].v    = value;
+        break;
     case VM_TYPE_NIL: /* happens when setting to the value of an unset local */
         return 0;
     default:
         return EINVAL;
     }
+
+    if (scope->nundo >= scope->nundoslot) {
+        n = scope->nundoslot ? 2 * scope->nundoslot : 16;
+        if (REALLOC_ARR(scope->undo, scope->nundoslot, n) == NULL)
+            return ENOMEM;
+        scope->nundoslot = n;
+    }
+    
+    u        = scope->undo + scope->nundo++;
+    u->idx   = idx;
+    u->value = scope->variables[idx];
+    
+    scope->variables[idx] = vm_tag(type, value);
+    
+    return 0;
 }
 
 
@@ -143,40 +196,30 @@ vm_scope_set(vm_scope_t *scope, int id, int type, vm_value_t value)
  * vm_scope_get
  ********************/
 int
-vm_scope_get(vm_scope_t *scope, int id, vm_value_t *value)
+vm_scope_get(vm_state_t *vm, int id, vm_value_t *value)
 {
-    unsigned int idx = VM_LOCAL_INDEX(id);
-    int          type;
+    /*
+     * Notes:
+     *   Values set in enclosing scopes stay in the table until the scope
+     *   that set them is popped, so there is no need to look further
+     *   when the innermost scope has not set a variable.
+     */
 
-    if (scope == NULL || scope->nvariable <= idx || scope->variables == NULL)
+    vm_scope_t   *scope = &vm->scope;
+    unsigned int  idx   = VM_LOCAL_INDEX(id);
+    int           type;
+
+    if (scope->nvariable <= idx)
         return VM_TYPE_UNKNOWN;
     
-    switch ((type = scope->variables[idx].type)) {
+    switch ((type = vm_untag(scope->variables[idx], value))) {
     case VM_TYPE_INTEGER:
     case VM_TYPE_DOUBLE:
     case VM_TYPE_STRING:
-        *value = scope->variables[idx].v;
-        break;
-
-#undef  DISABLE_NESTED_SCOPING
-#ifndef DISABLE_NESTED_SCOPING
-    case VM_TYPE_UNKNOWN: {
-        vm_scope_t *p = scope->parent;
-        while (p != NULL && type == VM_TYPE_UNKNOWN) {
-            type   = p->variables[idx].type;
-            *value = p->variables[idx].v;
-
-            p = p->parent;
-        }
-    }
-        break;
-#endif        
-        
+        return type;
     default:
-        type = VM_TYPE_UNKNOWN;
+        return VM_TYPE_UNKNOWN;
     }
-        
-    return type;
 }
 
 
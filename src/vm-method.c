@@ -24,10 +24,13 @@ USA.
 #include <stdlib.h>
 #include <errno.h>
 
+#include <dres/compiler.h>
 #include <dres/mm.h>
 #include <dres/vm.h>
 
-#define UNKNOWN_ID 0xefffffff
+#define UNKNOWN_ID  0xefffffff
+#define MIN_METHODS 16                        /* initial method table size */
+#define VM_INLINE_ARGS 8                      /* unpacked on the C stack */
 
 static int vm_unknown_handler(void *data, char *name,
                               vm_stack_entry_t *args, int narg,
@@ -47,16 +50,35 @@ static vm_method_t default_method = {
 int
 vm_method_add(vm_state_t *vm, char *name, vm_action_t handler, void *data)
 {
+    /*
+     * Notes:
+     *   Method IDs are indices to the method table and stay stable for the
+     *   lifetime of the VM. Compiled code refers to methods by ID so once
+     *   a method is added, registering or unregistering a handler for it
+     *   always just patches the same slot.
+     */
+
     vm_method_t *m;
+    int          nslot;
     
     if ((m = vm_method_lookup(vm, name)) != &default_method) {
         if (m->handler != NULL)
             return EEXIST;
     }
     else {
-        if (REALLOC_ARR(vm->methods, vm->nmethod, vm->nmethod + 1) == NULL)
-            return ENOMEM;
+        if (vm->nmethod >= vm->nmethodslot) {
+            nslot = vm->nmethodslot ? 2 * vm->nmethodslot : MIN_METHODS;
+            if (REALLOC_ARR(vm->methods, vm->nmethodslot, nslot) == NULL)
+                return ENOMEM;
+            vm->nmethodslot = nslot;
+        }
 
+        if (vm->methodtbl == NULL) {
+            vm->methodtbl = g_hash_table_new(g_str_hash, g_str_equal);
+            if (vm->methodtbl == NULL)
+                return ENOMEM;
+        }
+        
         m = vm->methods + vm->nmethod;
         
         m->name = STRDUP(name);
@@ -65,6 +87,7 @@ vm_method_add(vm_state_t *vm, char *name, vm_action_t handler, void *data)
         if (m->name == NULL)
             return ENOMEM;
         
+        g_hash_table_insert(vm->methodtbl, m->name, GINT_TO_POINTER(m->id+1));
         vm->nmethod++;
     }
 
@@ -85,7 +108,7 @@ vm_method_del(vm_state_t *vm, char *name, vm_action_t handler)
 {
     vm_method_t *m;
     
-    if ((m = vm_method_lookup(vm, name)) != &default_method)
+    if ((m = vm_method_lookup(vm, name)) == &default_method)
         return ENOENT;
     
     if (m->handler != handler)
@@ -123,13 +146,17 @@ vm_method_set(vm_state_t *vm, char *name, vm_action_t handler, void *data)
 vm_method_t *
 vm_method_lookup(vm_state_t *vm, char *name)
 {
-    int i;
-    
-    for (i = 0; i < vm->nmethod; i++)
-        if (!strcmp(name, vm->methods[i].name))
-            return vm->methods + i;
+    int id;
     
-    return &default_method;
+    if (vm->methodtbl == NULL)
+        return &default_method;
+
+    id = GPOINTER_TO_INT(g_hash_table_lookup(vm->methodtbl, name));
+
+    if (id > 0)
+        return vm->methods + id - 1;
+    else
+        return &default_method;
 }
 
 
@@ -191,21 +218,46 @@ vm_method_default(vm_state_t *vm, vm_action_t handler, void **data)
 int
 vm_method_call(vm_state_t *vm, char *name, vm_method_t *m, int narg)
 {
+    /*
+     * Notes:
+     *   Handlers get their arguments unpacked from the tagged stack
+     *   entries. The common case of a few arguments is served from a
+     *   buffer on the C stack.
+     */
+
     vm_action_t       handler;
     void             *data;
-    vm_stack_entry_t *args = vm_args(vm->stack, narg);
+    vm_tagged_t      *tagged = vm_args(vm->stack, narg);
+    vm_stack_entry_t  argbuf[VM_INLINE_ARGS], *args;
     vm_stack_entry_t  retval;
-    int               status;
+    int               status, i;
 
-    if (args == NULL && narg > 0)
+    if (tagged == NULL && narg > 0)
         VM_RAISE(vm, ENOENT,
                  "CALL: failed to pop %d args for %s", narg, m->name);
     
+    if (narg <= VM_INLINE_ARGS)
+        args = argbuf;
+    else
+        if ((args = ALLOC_ARR(vm_stack_entry_t, narg)) == NULL)
+            VM_RAISE(vm, ENOMEM,
+                     "CALL: failed to allocate %d args for %s", narg, m->name);
+    
+    for (i = 0; i < narg; i++)
+        args[i].type = vm_untag(tagged[i], &args[i].v);
+
     handler = m->handler ? m->handler : default_method.handler;
     data    = m->handler ? m->data    : default_method.data;
-    status  = handler(data, name, args, narg, &retval);
+    {
+        VM_STATS_START(start);
+        status = handler(data, name, args, narg, &retval);
+        VM_STATS_METHOD(vm, m->id, start);
+    }
     vm_stack_cleanup(vm->stack, narg);
     
+    if (args != argbuf)
+        FREE(args);
+
     if (status > 0)
         vm_push(vm->stack, retval.type, retval.v);
 
@@ -222,13 +274,19 @@ vm_free_methods(vm_state_t *vm)
     int          i;
     vm_method_t *m;
     
+    if (vm->methodtbl != NULL) {
+        g_hash_table_destroy(vm->methodtbl);
+        vm->methodtbl = NULL;
+    }
+
     for (i = 0, m = vm->methods; i < vm->nmethod; i++, m++)
         FREE(m->name);
     
     FREE(vm->methods);
     
-    vm->methods = NULL;
-    vm->nmethod = 0;
+    vm->methods     = NULL;
+    vm->nmethod     = 0;
+    vm->nmethodslot = 0;
 }
 
 
@@ -42,13 +42,9 @@ USA.
 #define STACK_ENTRY(s, idx)                                             \
     (((idx) < 0 || (s)->nentry <= (idx)) ? NULL : (STACK_TOP(s) - (idx)))
 
-#define STACK_TYPE(s)                                   \
-    ((s)->nentry <= (s)->nalloc && (s)->nentry > 0 ?    \
-     (s)->entries[(s)->nentry-1].type : VM_TYPE_UNKNOWN)
-
-#define STACK_POP(s, v)                                         \
+#define STACK_TYPE(s)                                           \
     ((s)->nentry <= (s)->nalloc && (s)->nentry > 0 ?            \
-     (s)->entries[(s)->nentry--].type : VM_TYPE_UNKNOWN)
+     VM_TAGGED_TYPE((s)->entries[(s)->nentry-1]) : VM_TYPE_UNKNOWN)
 
 
 
@@ -69,7 +65,7 @@ vm_stack_new(int size)
         return NULL;
 
     if (size > 0)
-        if ((stack->entries = ALLOC_ARR(vm_stack_entry_t, size)) == NULL) {
+        if ((stack->entries = ALLOC_ARR(vm_tagged_t, size)) == NULL) {
             FREE(stack);
             return NULL;
         }
@@ -158,13 +154,12 @@ vm_stack_cleanup(vm_stack_t *s, int narg)
 int
 vm_push_int(vm_stack_t *s, int i)
 {
-    vm_stack_entry_t *e = STACK_PUSH(s);
+    vm_tagged_t *e = STACK_PUSH(s);
     
     if (e == NULL)
         return ENOMEM;
     
-    e->type = VM_TYPE_INTEGER;
-    e->v.i  = i;
+    *e = VM_TAGGED(VM_TYPE_INTEGER, (uint32_t)i);
     
     return 0;
 }
@@ -176,13 +171,14 @@ vm_push_int(vm_stack_t *s, int i)
 int
 vm_push_double(vm_stack_t *s, double d)
 {
-    vm_stack_entry_t *e = STACK_PUSH(s);
+    vm_tagged_t *e = STACK_PUSH(s);
+    vm_value_t   v;
 
     if (e == NULL)
         return ENOMEM;
 
-    e->type = VM_TYPE_DOUBLE;
-    e->v.d  = d;
+    v.d = d;
+    *e  = vm_tag(VM_TYPE_DOUBLE, v);
 
     return 0;
 }
@@ -194,13 +190,12 @@ vm_push_double(vm_stack_t *s, double d)
 int
 vm_push_string(vm_stack_t *s, char *str)
 {
-    vm_stack_entry_t *e = STACK_PUSH(s);
+    vm_tagged_t *e = STACK_PUSH(s);
 
     if (e == NULL)
         return ENOMEM;
 
-    e->type = VM_TYPE_STRING;
-    e->v.s  = str;
+    *e = VM_TAGGED(VM_TYPE_STRING, (uintptr_t)str);
 
     return 0;
 }
@@ -212,13 +207,29 @@ vm_push_string(vm_stack_t *s, char *str)
 int
 vm_push_global(vm_stack_t *s, vm_global_t *g)
 {
-    vm_stack_entry_t *e = STACK_PUSH(s);
+    vm_tagged_t *e = STACK_PUSH(s);
+    
+    if (e == NULL)
+        return ENOMEM;
+    
+    *e = VM_TAGGED(VM_TYPE_GLOBAL, (uintptr_t)g);
+    
+    return 0;
+}
+
+
+/********************
+ * vm_push_field
+ ********************/
+int
+vm_push_field(vm_stack_t *s, GQuark field)
+{
+    vm_tagged_t *e = STACK_PUSH(s);
     
     if (e == NULL)
         return ENOMEM;
     
-    e->type = VM_TYPE_GLOBAL;
-    e->v.g  = g;
+    *e = VM_TAGGED(VM_TYPE_FIELD, field);
     
     return 0;
 }
@@ -230,13 +241,12 @@ vm_push_global(vm_stack_t *s, vm_global_t *g)
 int
 vm_push(vm_stack_t *s, int type, vm_value_t value)
 {
-    vm_stack_entry_t *e = STACK_PUSH(s);
+    vm_tagged_t *e = STACK_PUSH(s);
     
     if (e == NULL)
         return ENOMEM;
     
-    e->type = type;
-    e->v    = value;
+    *e = vm_tag(type, value);
 
     return 0;
 }
@@ -258,23 +268,19 @@ vm_type(vm_stack_t *s)
 int
 vm_peek(vm_stack_t *s, int idx, vm_value_t *value)
 {
-    vm_stack_entry_t *e = STACK_ENTRY(s, idx);
-    int               t;
+    vm_tagged_t *e = STACK_ENTRY(s, idx);
 
     if (e == NULL)
         return VM_TYPE_UNKNOWN;
     
-    *value = e->v;
-    t      = e->type;
-    
-    return t;
+    return vm_untag(*e, value);
 }
 
 
 /********************
  * vm_args
  ********************/
-vm_stack_entry_t *
+vm_tagged_t *
 vm_args(vm_stack_t *s, int narg)
 {
     return STACK_ENTRY(s, narg - 1);
@@ -287,19 +293,14 @@ vm_args(vm_stack_t *s, int narg)
 int
 vm_pop(vm_stack_t *s, vm_value_t *value)
 {
-    vm_stack_entry_t *e = STACK_TOP(s);
-    int               t;
+    vm_tagged_t *e = STACK_TOP(s);
 
     if (e == NULL)
         return VM_TYPE_UNKNOWN;
     
-    *value = e->v;
-    t      = e->type;
-    
-    e->type = VM_TYPE_UNKNOWN;
     s->nentry--;
     
-    return t;
+    return vm_untag(*e, value);
 }
 
 
@@ -309,15 +310,14 @@ vm_pop(vm_stack_t *s, vm_value_t *value)
 int
 vm_pop_int(vm_stack_t *s)
 {
-    vm_stack_entry_t *e = STACK_TOP(s);
+    vm_tagged_t *e = STACK_TOP(s);
 
-    if (e == NULL || e->type != VM_TYPE_INTEGER)
+    if (e == NULL || VM_TAGGED_TYPE(*e) != VM_TYPE_INTEGER)
         return INT_MAX;
     
-    e->type = VM_TYPE_UNKNOWN;
     s->nentry--;
 
-    return e->v.i;
+    return VM_TAGGED_INT(*e);
 }
 
 
@@ -327,15 +327,16 @@ vm_pop_int(vm_stack_t *s)
 double
 vm_pop_double(vm_stack_t *s)
 {
-    vm_stack_entry_t *e = STACK_TOP(s);
+    vm_tagged_t *e = STACK_TOP(s);
+    vm_value_t   v;
 
-    if (e == NULL || e->type != VM_TYPE_DOUBLE)
+    if (e == NULL || !VM_TAGGED_IS_DOUBLE(*e))
         return 666.666;
     
-    e->type = VM_TYPE_UNKNOWN;
     s->nentry--;
+    vm_untag(*e, &v);
 
-    return e->v.d;
+    return v.d;
 }
 
 
@@ -345,15 +346,14 @@ vm_pop_double(vm_stack_t *s)
 char *
 vm_pop_string(vm_stack_t *s)
 {
-    vm_stack_entry_t *e = STACK_TOP(s);
+    vm_tagged_t *e = STACK_TOP(s);
 
-    if (e == NULL || e->type != VM_TYPE_STRING)
+    if (e == NULL || VM_TAGGED_TYPE(*e) != VM_TYPE_STRING)
         return NULL;
     
-    e->type = VM_TYPE_UNKNOWN;
     s->nentry--;
 
-    return e->v.s;
+    return VM_TAGGED_PTR(*e);
 }
 
 
@@ -363,15 +363,38 @@ vm_pop_string(vm_stack_t *s)
 vm_global_t *
 vm_pop_global(vm_stack_t *s)
 {
-    vm_stack_entry_t *e = STACK_TOP(s);
+    vm_tagged_t *e = STACK_TOP(s);
 
-    if (e == NULL || e->type != VM_TYPE_GLOBAL)
+    if (e == NULL || VM_TAGGED_TYPE(*e) != VM_TYPE_GLOBAL)
         return NULL;
     
-    e->type = VM_TYPE_UNKNOWN;
     s->nentry--;
 
-    return e->v.g;
+    return VM_TAGGED_PTR(*e);
+}
+
+
+/********************
+ * vm_pop_field
+ ********************/
+GQuark
+vm_pop_field(vm_stack_t *s)
+{
+    vm_tagged_t *e = STACK_TOP(s);
+    GQuark       q;
+
+    if (e == NULL)
+        return 0;
+
+    switch (VM_TAGGED_TYPE(*e)) {
+    case VM_TYPE_FIELD:  q = VM_TAGGED_QUARK(*e);                   break;
+    case VM_TYPE_STRING: q = g_quark_from_string(VM_TAGGED_PTR(*e)); break;
+    default:             return 0;
+    }
+    
+    s->nentry--;
+
+    return q;
 }
 
 
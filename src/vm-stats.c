@@ -0,0 +1,142 @@
+/*************************************************************************
+This file is part of dres the resource policy dependency resolver.
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <dres/compiler.h>
+#include <dres/mm.h>
+#include <dres/vm.h>
+
+
+/********************
+ * vm_stats_init
+ ********************/
+int
+vm_stats_init(vm_state_t *vm)
+{
+#ifdef DRES_VM_STATISTICS
+    if ((vm->stats = ALLOC(vm_stats_t)) == NULL)
+        return ENOMEM;
+#else
+    vm->stats = NULL;
+#endif
+    
+    return 0;
+}
+
+
+/********************
+ * vm_stats_exit
+ ********************/
+void
+vm_stats_exit(vm_state_t *vm)
+{
+    if (vm->stats != NULL) {
+        FREE(vm->stats->methods);
+        FREE(vm->stats);
+        vm->stats = NULL;
+    }
+}
+
+
+/********************
+ * vm_stats_reset
+ ********************/
+void
+vm_stats_reset(vm_state_t *vm)
+{
+    vm_stats_t *stats = vm->stats;
+
+    if (stats != NULL) {
+        memset(stats->opcodes, 0, sizeof(stats->opcodes));
+        if (stats->methods != NULL)
+            memset(stats->methods, 0, stats->nmethod * sizeof(vm_counter_t));
+    }
+}
+
+
+/********************
+ * vm_stats_method
+ ********************/
+vm_counter_t *
+vm_stats_method(vm_state_t *vm, int id)
+{
+    /*
+     * Notes:
+     *   Methods can be added at any time, so the per-method counters are
+     *   grown on demand to cover the method table. If this fails we just
+     *   lose the statistics for the method.
+     */
+
+    vm_stats_t *stats = vm->stats;
+    int         n;
+    
+    if (stats == NULL || id < 0)
+        return NULL;
+
+    if (id >= stats->nmethod) {
+        n = vm->nmethod > id ? vm->nmethod : id + 1;
+        if (REALLOC_ARR(stats->methods, stats->nmethod, n) == NULL)
+            return NULL;
+        stats->nmethod = n;
+    }
+    
+    return stats->methods + id;
+}
+
+
+/********************
+ * vm_opcode_name
+ ********************/
+const char *
+vm_opcode_name(int code)
+{
+    switch ((vm_opcode_t)code) {
+    case VM_OP_PUSH:    return "push";
+    case VM_OP_POP:     return "pop";
+    case VM_OP_FILTER:  return "filter";
+    case VM_OP_UPDATE:  return "update";
+    case VM_OP_SET:     return "set";
+    case VM_OP_GET:     return "get";
+    case VM_OP_CREATE:  return "create";
+    case VM_OP_CALL:    return "call";
+    case VM_OP_CMP:     return "cmp";
+    case VM_OP_BRANCH:  return "branch";
+    case VM_OP_DEBUG:   return "debug";
+    case VM_OP_HALT:    return "halt";
+    case VM_OP_REPLACE: return "replace";
+    case VM_OP_LOAD:    return "load";
+    default:            return NULL;
+    }
+}
+
+
+/* 
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:set expandtab shiftwidth=4:
+ */
@@ -0,0 +1,432 @@
+/*************************************************************************
+This file is part of dres the resource policy dependency resolver.
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <dres/mm.h>
+#include <dres/vm.h>
+
+#define TYPE_ANY 0xff                         /* unknown at verification */
+
+typedef struct {
+    int            depth;                     /* stack depth, < 0 unreached */
+    unsigned char *types;                     /* abstract stack contents */
+} vstate_t;
+
+typedef struct {
+    vm_state_t    *vm;                        /* VM we verify for */
+    vm_chunk_t    *c;                         /* chunk being verified */
+    unsigned char *types;                     /* current abstract stack */
+    int            depth;                     /* current depth, < 0 dead */
+    int            size;                      /* max. stack depth */
+    vstate_t      *states;                    /* saved states at branches */
+    const char    *error;                     /* reason for failure */
+} verifier_t;
+
+#define FAIL(v, msg) do {                       \
+        (v)->error = msg;                       \
+        return EINVAL;                          \
+    } while (0)
+
+#define NEED(v, n) do {                                 \
+        if ((v)->depth < (n))                           \
+            FAIL(v, "stack underflow");                 \
+    } while (0)
+
+#define TYPE(v, idx) ((v)->types[(v)->depth - 1 - (idx)])
+
+#define POP(v, n) ((v)->depth -= (n))
+
+#define PUSH(v, type) do {                              \
+        if ((v)->depth >= (v)->size)                    \
+            FAIL(v, "stack overflow");                  \
+        (v)->types[(v)->depth++] = (type);              \
+    } while (0)
+
+#define IS_FIELD(type) ((type) == VM_TYPE_FIELD || (type) == VM_TYPE_STRING)
+
+/* globals are type-checked again by the handlers, so unknown ones are fine */
+#define IS_GLOBAL(type) ((type) == VM_TYPE_GLOBAL || (type) == TYPE_ANY)
+
+
+static int verify_op  (verifier_t *v, vm_op_t *op);
+static int verify_load(verifier_t *v, vm_op_t *op);
+static int merge_state(verifier_t *v, int idx);
+
+
+/********************
+ * vm_chunk_verify
+ ********************/
+int
+vm_chunk_verify(vm_state_t *vm, vm_chunk_t *c, const char **error)
+{
+    /*
+     * Notes:
+     *   Verifies a decoded chunk by abstract interpretation of the types
+     *   on the stack. Every instruction is checked to find operands of the
+     *   expected types on the stack, without ever reaching below the depth
+     *   the chunk was entered with, and its immediate operands to be
+     *   valid. The compiler only branches forward so, as in vm_chunk_depth,
+     *   a single pass is enough provided we merge the state falling
+     *   through to an instruction with the states of all the branches
+     *   seen to it. Merged states must agree on the depth of the stack but
+     *   slots with differing types are just degraded to TYPE_ANY. Verified
+     *   chunks are run without the per-instruction checks, see
+     *   vm_run_verified.
+     *
+     *   Results of method calls and local variables are of unknown type,
+     *   yet they are routinely assigned to fact variables. Hence operands
+     *   expected to be globals are allowed to be TYPE_ANY. The handlers of
+     *   all instructions taking globals check their type at runtime, and
+     *   FILTER falls back to its checked handler on a mismatch.
+     */
+
+    verifier_t v;
+    vm_op_t   *op;
+    int        i, err;
+
+    c->verified = FALSE;
+    
+    if (error != NULL)
+        *error = NULL;
+    
+    if (c->ops == NULL) {
+        if (error != NULL)
+            *error = "chunk not decoded";
+        return EINVAL;
+    }
+
+    memset(&v, 0, sizeof(v));
+    v.vm    = vm;
+    v.c     = c;
+    v.size  = (c->maxdepth >= 0 ? c->maxdepth : vm_chunk_depth(c));
+    
+    if (v.size < 0) {
+        if (error != NULL)
+            *error = "failed to determine stack depth";
+        return EINVAL;
+    }
+
+    v.types  = ALLOC_ARR(unsigned char, v.size + 1);
+    v.states = ALLOC_ARR(vstate_t, c->nop + 1);
+    
+    if (v.types == NULL || v.states == NULL) {
+        err = ENOMEM;
+        goto out;
+    }
+    
+    for (i = 0; i <= c->nop; i++)
+        v.states[i].depth = -1;
+
+    err = 0;
+    for (i = 0, op = c->ops; i <= c->nop && !err; i++, op++) {
+        if (v.states[i].depth >= 0) {
+            if (v.depth >= 0 && (err = merge_state(&v, i)) != 0)
+                break;
+            v.depth = v.states[i].depth;
+            memcpy(v.types, v.states[i].types, v.depth);
+        }
+        
+        if (v.depth < 0)                      /* dead code, never run */
+            continue;
+
+        err = verify_op(&v, op);
+    }
+    
+    if (!err)
+        c->verified = TRUE;
+    
+ out:
+    if (v.states != NULL)
+        for (i = 0; i <= c->nop; i++)
+            FREE(v.states[i].types);
+    FREE(v.states);
+    FREE(v.types);
+
+    if (error != NULL)
+        *error = err == ENOMEM ? "out of memory" : v.error;
+    
+    return err;
+}
+
+
+/********************
+ * merge_state
+ ********************/
+static int
+merge_state(verifier_t *v, int idx)
+{
+    vstate_t *s = v->states + idx;
+    int       i;
+
+    if (s->depth < 0) {
+        if (s->types == NULL &&
+            (s->types = ALLOC_ARR(unsigned char, v->size + 1)) == NULL)
+            return ENOMEM;
+        s->depth = v->depth;
+        memcpy(s->types, v->types, v->depth);
+        return 0;
+    }
+
+    if (s->depth != v->depth)
+        FAIL(v, "stack depth mismatch at branch target");
+    
+    for (i = 0; i < s->depth; i++)
+        if (s->types[i] != v->types[i])
+            s->types[i] = TYPE_ANY;
+
+    return 0;
+}
+
+
+/********************
+ * verify_op
+ ********************/
+static int
+verify_op(verifier_t *v, vm_op_t *op)
+{
+    int n, i, target;
+    
+    switch ((vm_opcode_t)op->code) {
+    case VM_OP_PUSH:
+        switch (op->type) {
+        case VM_TYPE_INTEGER:
+        case VM_TYPE_DOUBLE:
+        case VM_TYPE_STRING:
+        case VM_TYPE_GLOBAL:
+            PUSH(v, op->type);
+            break;
+        case VM_TYPE_FIELD:
+            if (op->arg < 0 || op->arg >= v->vm->nfield)
+                FAIL(v, "PUSH FIELD: invalid field");
+            PUSH(v, VM_TYPE_FIELD);
+            break;
+        case VM_TYPE_LOCAL:
+            NEED(v, 2 * op->arg);
+            for (i = 0; i < op->arg; i++) {
+                if (TYPE(v, 0) != VM_TYPE_INTEGER)
+                    FAIL(v, "PUSH LOCALS: integer ID expected");
+                POP(v, 2);
+            }
+            break;
+        default:
+            FAIL(v, "PUSH: invalid type");
+        }
+        break;
+        
+    case VM_OP_POP:
+        switch (op->arg) {
+        case VM_POP_LOCALS:
+            break;
+        case VM_POP_DISCARD:
+            NEED(v, 1);
+            POP(v, 1);
+            break;
+        default:
+            FAIL(v, "POP: invalid type");
+        }
+        break;
+
+    case VM_OP_FILTER:
+        n = op->arg;
+        NEED(v, 3 * n + 1);
+        if (!IS_GLOBAL(TYPE(v, 3 * n)))
+            FAIL(v, "FILTER: global expected");
+        for (i = 0; i < n; i++) {
+            if (!IS_FIELD(TYPE(v, 3 * i)))
+                FAIL(v, "FILTER: field expected");
+            if (TYPE(v, 3 * i + 2) != VM_TYPE_INTEGER)
+                FAIL(v, "FILTER: relational operator expected");
+        }
+        POP(v, 3 * n);
+        break;
+
+    case VM_OP_UPDATE:
+    case VM_OP_REPLACE:
+        n = op->arg;
+        NEED(v, n + 2);
+        for (i = 0; i < n; i++)
+            if (!IS_FIELD(TYPE(v, i)))
+                FAIL(v, "UPDATE/REPLACE: field expected");
+        if (!IS_GLOBAL(TYPE(v, n)) || !IS_GLOBAL(TYPE(v, n + 1)))
+            FAIL(v, "UPDATE/REPLACE: globals expected");
+        POP(v, n + 2);
+        break;
+
+    case VM_OP_SET:
+        if (op->arg & VM_SET_FIELD) {
+            NEED(v, 3);
+            if (!IS_FIELD(TYPE(v, 0)) || !IS_GLOBAL(TYPE(v, 1)))
+                FAIL(v, "SET FIELD: field and global expected");
+            POP(v, 3);
+        }
+        else {
+            NEED(v, 2);
+            if (!IS_GLOBAL(TYPE(v, 0)) || !IS_GLOBAL(TYPE(v, 1)))
+                FAIL(v, "SET: globals expected");
+            POP(v, 2);
+        }
+        break;
+
+    case VM_OP_GET:
+        if (op->arg & VM_GET_FIELD) {
+            NEED(v, 2);
+            if (!IS_FIELD(TYPE(v, 0)) || !IS_GLOBAL(TYPE(v, 1)))
+                FAIL(v, "GET FIELD: field and global expected");
+            POP(v, 2);
+            PUSH(v, TYPE_ANY);
+        }
+        else if (op->arg & VM_GET_LOCAL)
+            PUSH(v, TYPE_ANY);
+        else
+            FAIL(v, "GET: unsupported variant");
+        break;
+
+    case VM_OP_CREATE:
+        n = op->arg;
+        NEED(v, 2 * n);
+        for (i = 0; i < n; i++)
+            if (!IS_FIELD(TYPE(v, 2 * i)))
+                FAIL(v, "CREATE: field expected");
+        POP(v, 2 * n);
+        PUSH(v, VM_TYPE_GLOBAL);
+        break;
+
+    case VM_OP_CALL:
+        NEED(v, op->arg + 1);
+        if (TYPE(v, 0) != VM_TYPE_INTEGER && TYPE(v, 0) != VM_TYPE_STRING)
+            FAIL(v, "CALL: method ID expected");
+        POP(v, op->arg + 1);
+        PUSH(v, TYPE_ANY);
+        break;
+
+    case VM_OP_CMP:
+        if (op->arg < VM_RELOP_EQ || op->arg > VM_RELOP_NOT)
+            FAIL(v, "CMP: invalid relational operator");
+        n = (op->arg == VM_RELOP_NOT ? 1 : 2);
+        NEED(v, n);
+        POP(v, n);
+        PUSH(v, VM_TYPE_INTEGER);
+        break;
+
+    case VM_OP_BRANCH:
+        target = op->imm.branch - v->c->ops;
+        if (target <= op - v->c->ops || target > v->c->nop)
+            FAIL(v, "BRANCH: invalid target");
+        switch (op->type) {
+        case VM_BRANCH:
+            break;
+        case VM_BRANCH_EQ:
+        case VM_BRANCH_NE:
+            NEED(v, 1);
+            POP(v, 1);
+            break;
+        default:
+            FAIL(v, "BRANCH: invalid type");
+        }
+        if (merge_state(v, target) != 0)
+            return v->error ? EINVAL : ENOMEM;
+        if (op->type == VM_BRANCH)
+            v->depth = -1;
+        break;
+
+    case VM_OP_LOAD:
+        return verify_load(v, op);
+        
+    case VM_OP_DEBUG:
+        break;
+
+    case VM_OP_HALT:
+        v->depth = -1;
+        break;
+
+    default:
+        FAIL(v, "invalid instruction");
+    }
+    
+    return 0;
+}
+
+
+/********************
+ * verify_load
+ ********************/
+static int
+verify_load(verifier_t *v, vm_op_t *op)
+{
+    /*
+     * Notes:
+     *   The size of the inline selectors has already been checked while
+     *   decoding (see vm_load_size), here we check their contents.
+     */
+
+    uintptr_t *p = (uintptr_t *)op->imm.s;
+    int        i, len;
+
+    len = (int)*p;
+    p  += 1 + VM_ALIGN_TO_INSTR(len);
+
+    if (len < 1 || ((char *)(p - VM_ALIGN_TO_INSTR(len)))[len - 1] != '\0')
+        FAIL(v, "LOAD: unterminated name");
+    
+    for (i = 0; i < op->arg; i++) {
+        if (VM_SELECT_FIELD(*p) < 0 || VM_SELECT_FIELD(*p) >= v->vm->nfield)
+            FAIL(v, "LOAD: invalid selector field");
+        
+        switch (VM_SELECT_TYPE(*p++)) {
+        case VM_TYPE_INTEGER:
+            p++;
+            break;
+        case VM_TYPE_DOUBLE:
+            p += VM_ALIGN_TO_INSTR(sizeof(double));
+            break;
+        case VM_TYPE_STRING:
+            len = (int)*p;
+            p  += 1 + VM_ALIGN_TO_INSTR(len);
+            if (len < 1 ||
+                ((char *)(p - VM_ALIGN_TO_INSTR(len)))[len - 1] != '\0')
+                FAIL(v, "LOAD: unterminated selector string");
+            break;
+        default:
+            FAIL(v, "LOAD: invalid selector type");
+        }
+    }
+    
+    if (op->type < -1 || op->type >= v->vm->nfield)   /* -1: whole global */
+        FAIL(v, "LOAD: invalid field");
+    
+    PUSH(v, op->type < 0 ? VM_TYPE_GLOBAL : TYPE_ANY);
+    
+    return 0;
+}
+
+
+/* 
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:set expandtab shiftwidth=4:
+ */
@@ -25,7 +25,6 @@ USA.
 #include <string.h>
 #include <limits.h>
 #include <errno.h>
-#include <setjmp.h>
 
 #include <dres/mm.h>
 #include <dres/vm.h>
@@ -47,6 +46,12 @@ vm_init(vm_state_t *vm, int stack_size)
     if ((vm->stack = vm_stack_new(stack_size)) == NULL)
         return ENOMEM;
     
+    if (vm_stats_init(vm) != 0) {
+        vm_stack_del(vm->stack);
+        vm->stack = NULL;
+        return ENOMEM;
+    }
+    
     return 0;
 }
 
@@ -59,11 +64,103 @@ vm_exit(vm_state_t *vm)
 {
     if (vm) {
         vm_stack_del(vm->stack);
-        if (!VM_TST_FLAG(vm, COMPILED)) {
-            vm_free_methods(vm);
-            vm_free_varnames(vm);
+        vm_free_methods(vm);
+        vm_free_varnames(vm);
+        vm_scope_exit(vm);
+        vm_free_fields(vm);
+        vm_stats_exit(vm);
+        vm_global_cache_exit(vm);
+    }
+}
+
+
+/********************
+ * vm_set_exec_mode
+ ********************/
+int
+vm_set_exec_mode(vm_state_t *vm, vm_exec_mode_t mode)
+{
+    switch (mode) {
+    case VM_EXEC_DEFAULT:
+    case VM_EXEC_INTERPRET:
+        break;
+    case VM_EXEC_JIT:
+        if (!vm_jit_available())
+            return EOPNOTSUPP;
+        break;
+    default:
+        return EINVAL;
+    }
+
+    vm->mode = mode;
+    return 0;
+}
+
+
+/********************
+ * vm_catch
+ ********************/
+static int
+vm_catch(vm_state_t *vm, int status, int depth, int scope)
+{
+    /*
+     * Notes:
+     *   Handles an exception or silent failure that aborted the execution
+     *   of a chunk. The exception is logged, the stack is unwound back to
+     *   depth and the local variable scopes back to scope. Returns the
+     *   status to be passed on by vm_exec.
+     */
+
+    vm_exception_t *e = &vm->exception;
+    vm_value_t      v;
+    char           *name;
+    int             i, type;
+    
+    if (status < 0 && e->error != 0) {
+        VM_ERROR("VM exception %d", e->error);
+        if (e->message[0])
+            VM_ERROR("  %s", e->message);
+        if (e->context)
+            VM_ERROR("  while excecuting %s", e->context);
+        
+        VM_ERROR("  local variables:");
+        for (i = 0; i < vm->nlocal; i++) {
+            type = vm_scope_get(vm, i, &v);
+            name = vm->names && vm->names[i] ? vm->names[i] : "<unknown>";
+            switch (type) {
+            case VM_TYPE_UNKNOWN:
+            case VM_TYPE_NIL:
+                /* VM_ERROR("    0x%x (%s) is unset", i, name); */
+                break;
+            case VM_TYPE_INTEGER:
+                VM_ERROR("    0x%x (%s): %d", i, name, v.i);
+                break;
+            case VM_TYPE_DOUBLE:
+                VM_ERROR("    0x%x (%s): %f", i, name, v.d);
+                break;
+            case VM_TYPE_STRING:
+                VM_ERROR("    0x%x (%s): '%s'", i, name,
+                         v.s && v.s[0] ? v.s : "");
+                break;
+            default:
+                VM_ERROR("    0x%x (%s): ???", i, name);
+                break;
+            }
         }
     }
+    fflush(stdout);
+    
+    if (vm->stack->nentry > depth) {
+        VM_INFO("cleaning up the stack...");
+        vm_stack_cleanup(vm->stack, vm->stack->nentry - depth);
+    }
+    if (vm->scope.depth > scope) {
+        VM_INFO("cleaning up the local/scope stack...");
+        while (vm->scope.depth > scope)
+            vm_scope_pop(vm);
+    }
+    
+    return status < 0 ? status : FALSE;
 }
 
 
@@ -73,17 +170,50 @@ vm_exit(vm_state_t *vm)
 int
 vm_exec(vm_state_t *vm, vm_chunk_t *code)
 {
-    int status;
+    /*
+     * Notes:
+     *   A negative status indicates a VM exception. This will result in
+     *   an error message and the rollback of the current DRES transaction.
+     *   A zero status indicates (silent) failure resulting in the rollback
+     *   of the current transaction. Any other status is interpreted as
+     *   TRUE, and results in the continued evaluation of the current DRES
+     *   goal. This convention is directly visible at the VM/DRES method
+     *   handler level. The handler return value should be crafted according
+     *   to the rules above.
+     *
+     *   We reserve the stack space needed by the chunk here, once, so the
+     *   instructions themselves never need to check for or grow it. The
+     *   reservation is relative to the current top of the stack, so the
+     *   nested invocations of a method calling back to the resolver end
+     *   up reserving cumulatively on top of their callers. If the depth
+     *   cannot be determined we fall back to the number of instructions,
+     *   as without backward branches none of them can be run more than
+     *   once and none of them grows the stack by more than one entry.
+     */
+
+    int status, depth, scope, nreserve;
+
+
+    if (code->maxdepth < 0)
+        code->maxdepth = vm_chunk_depth(code);
+    
+    nreserve = code->maxdepth >= 0 ? code->maxdepth : code->ninstr;
 
+    if (vm_stack_grow(vm->stack, nreserve) != 0)
+        return -ENOMEM;
+    
+    depth = vm->stack->nentry;
+    scope = vm->scope.depth;
 
     vm->chunk  = code;
     vm->pc     = code->instrs;
     vm->ninstr = code->ninstr;
     vm->nsize  = code->nsize;
     
-    status = VM_TRY(vm);
-
-    return status;
+    if ((status = vm_run(vm)) == VM_STATUS_OK)
+        return TRUE;
+    else
+        return vm_catch(vm, status, depth, scope);
 }
 
 
@@ -0,0 +1,34 @@
+#!/bin/sh
+
+# usage: compare-test.sh name description command-a command-b
+#
+# Run two commands that are expected to produce identical output, saving
+# their outputs as name.a.out and name.b.out, and fail showing the
+# differences if they don't. Either command exiting with 77 skips the
+# test.
+
+name=$1
+what=$2
+a=$name.a.out
+b=$name.b.out
+
+run() {
+    eval "$1" > $2
+    case $? in
+        0)  ;;
+        77) rm -f $a $b; exit 77;;
+        *)  exit 1;;
+    esac
+}
+
+run "$3" $a
+run "$4" $b
+
+if ! cmp -s $a $b; then
+    echo "$what results differ:"
+    diff -u $a $b
+    exit 1
+fi
+
+rm -f $a $b
+exit 0
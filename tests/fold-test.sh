@@ -0,0 +1,13 @@
+#!/bin/sh
+
+# Run the targets of fold.dres once with and once without constant
+# folding and dead branch elimination and check that the output of the
+# targets and the resulting fact stores are identical.
+
+srcdir=${srcdir:-.}
+
+export DRES_NATIVE=off
+
+exec sh $srcdir/compare-test.sh fold-test "folded and unfolded" \
+    "./native-test --interpret --no-fold $srcdir/fold.dres" \
+    "./native-test --interpret $srcdir/fold.dres"
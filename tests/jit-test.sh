@@ -0,0 +1,13 @@
+#!/bin/sh
+
+# Run the targets of ruleset.dres through both the bytecode interpreter
+# and the JIT and check that the resulting fact stores are identical.
+# Skipped on architectures without JIT support.
+
+srcdir=${srcdir:-.}
+
+export DRES_NATIVE=off
+
+exec sh $srcdir/compare-test.sh jit-test "JIT and interpreter" \
+    "./native-test --interpret $srcdir/ruleset.dres" \
+    "./native-test --jit $srcdir/ruleset.dres"
@@ -0,0 +1,137 @@
+/*************************************************************************
+This file is part of dres the resource policy dependency resolver.
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+
+/*
+ * Run every target of a ruleset once, in order, and dump the resulting
+ * facts after each update. native-test.sh runs this once with and once
+ * without the native module of the ruleset, jit-test.sh once with the
+ * interpreter and once with the JIT, fold-test.sh once with and once
+ * without constant folding, and all of them compare the outputs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <dres/dres.h>
+#include <ohm/ohm-fact.h>
+
+#include "test-util.h"
+
+#define DEFAULT_RULESET "./ruleset.dres"
+
+
+/********************
+ * count_native
+ ********************/
+static int
+count_native(dres_t *dres)
+{
+    dres_target_t *t;
+    int            i, n;
+
+    for (i = n = 0, t = dres->targets; i < dres->ntarget; i++, t++)
+        if (t->code != NULL && t->code->native != NULL)
+            n++;
+
+    return n;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    OhmFactStore     *store;
+    dres_t           *dres;
+    const char       *ruleset;
+    dres_exec_mode_t  mode;
+    int               i, expect_native, fold, status;
+
+    ruleset       = DEFAULT_RULESET;
+    expect_native = FALSE;
+    fold          = TRUE;
+    mode          = DRES_EXEC_DEFAULT;
+    
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--expect-native"))
+            expect_native = TRUE;
+        else if (!strcmp(argv[i], "--interpret"))
+            mode = DRES_EXEC_INTERPRET;
+        else if (!strcmp(argv[i], "--jit"))
+            mode = DRES_EXEC_JIT;
+        else if (!strcmp(argv[i], "--no-fold"))
+            fold = FALSE;
+        else
+            ruleset = argv[i];
+    }
+
+#if (GLIB_MAJOR_VERSION <= 2) && (GLIB_MINOR_VERSION < 36)
+    g_type_init();
+#endif
+
+    if ((store = ohm_get_fact_store()) == NULL)
+        fatal(1, "failed to initialize factstore");
+
+    dres_set_log_level(DRES_LOG_WARNING);
+    
+    if ((dres = dres_open((char *)ruleset)) == NULL)
+        fatal(1, "failed to open ruleset '%s'", ruleset);
+    
+    if (!fold && dres_set_folding(dres, FALSE) != 0)
+        fatal(1, "failed to disable constant folding");
+    
+    if (dres_finalize(dres) != 0)
+        fatal(1, "failed to finalize ruleset '%s'", ruleset);
+
+    if ((status = dres_set_exec_mode(dres, mode)) != 0) {
+        if (status == EOPNOTSUPP) {
+            printf("execution mode %d not supported, skipping\n", mode);
+            exit(77);
+        }
+        fatal(1, "failed to set execution mode %d", mode);
+    }
+
+    if (expect_native && !count_native(dres))
+        fatal(2, "no native code loaded for '%s'", ruleset);
+
+    for (i = 0; i < dres->ntarget; i++) {
+        status = dres_update_goal(dres, dres->targets[i].name, NULL);
+        printf("%s: %d\n", dres->targets[i].name, status);
+        dump_facts(store, dres);
+    }
+
+    dres_exit(dres);
+    g_object_unref(store);
+
+    return 0;
+}
+
+
+/* 
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:set expandtab shiftwidth=4:
+ */
@@ -0,0 +1,12 @@
+#!/bin/sh
+
+# Run the targets of ruleset.dres through both the bytecode interpreter
+# and the code generated by dresc --emit-c and check that the resulting
+# fact stores are identical.
+
+srcdir=${srcdir:-.}
+
+exec sh $srcdir/compare-test.sh native-test "native and bytecode" \
+    "DRES_NATIVE=off ./native-test $srcdir/ruleset.dres" \
+    "DRES_NATIVE=.libs/ruleset-native.so \
+         ./native-test --expect-native $srcdir/ruleset.dres"
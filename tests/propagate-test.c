@@ -0,0 +1,251 @@
+/*************************************************************************
+This file is part of dres the resource policy dependency resolver.
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+
+/*
+ * Run a fixed script of fact changes and goal updates against
+ * propagate.dres, printing the result of every update, the facts and the
+ * per-target statistics. propagate-test.sh compares the output of a run
+ * with dirty propagation to one checking every target (--no-propagate).
+ * With --expect-propagate the run also fails unless the targets marked
+ * in the script are skipped as clean, so the comparison cannot pass
+ * vacuously.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <dres/dres.h>
+#include <ohm/ohm-fact.h>
+
+#include "test-util.h"
+
+#define DEFAULT_RULESET "./propagate.dres"
+
+
+typedef struct {
+    const char *var;                     /* factvar to change, or NULL */
+    const char *name;                    /* fact to change, goal to update */
+    int         value;                   /* new value of the fact */
+    const char *clean;                   /* target expected to be clean */
+} step_t;
+
+#define SET(v, n, val)         { .var = v, .name = n, .value = val }
+#define UPDATE(goal)           { .var = NULL, .name = goal }
+#define UPDATE_CLEAN(goal, t)  { .var = NULL, .name = goal, .clean = t }
+
+static step_t script[] = {
+    UPDATE("top"),
+    UPDATE("top"),                       /* nothing changed */
+    SET("input", "a", 10),
+    UPDATE("final"),
+    UPDATE_CLEAN("top", "side"),         /* $other did not change */
+    SET("other", "x", 1),
+    UPDATE("side"),                      /* leaves stage2 outdated */
+    UPDATE("top"),
+    SET("mid", "m", 1),
+    SET("input", "b", 20),
+    UPDATE("stage3"),
+    UPDATE("final"),
+    SET("input", "a", 11),
+    UPDATE("broken"),                    /* rolls back stage1 */
+    UPDATE("top"),
+    SET("mid", "m", 2),
+    UPDATE("broken"),
+    UPDATE("final"),
+    UPDATE("stage1"),
+    UPDATE("top"),
+    SET("other", "x", 2),
+    SET("input", "b", 21),
+    UPDATE("always"),
+    UPDATE_CLEAN("top", "stage3"),       /* $mid did not change */
+    { .var = NULL, .name = NULL }
+};
+
+
+
+
+/********************
+ * dump_stats
+ ********************/
+static void
+dump_stats(dres_t *dres)
+{
+    dres_target_stats_t *stats, *s;
+    int                  nstat, i;
+
+    if (dres_target_stats_get(dres, &stats, &nstat) != 0)
+        fatal(1, "failed to get target statistics");
+
+    /*
+     * Notes:
+     *   A target skipped as clean would have been checked and found
+     *   up-to-date without propagation, so clean skips are added to the
+     *   checked and up-to-date counts for the comparison. The clean
+     *   counts themselves only go to stderr for diagnostics.
+     */
+
+    for (i = 0, s = stats; i < nstat; i++, s++) {
+        printf("%s: checked %lu, up-to-date %lu, run %lu, failed %lu, "
+               "goal %lu, rolled back %lu\n", s->name,
+               s->ncheck + s->nclean, s->nskip + s->nclean,
+               s->nrun, s->nfail + s->nerror, s->ngoal, s->nrollback);
+        fprintf(stderr, "%s: checked %lu, skipped %lu, clean %lu\n",
+                s->name, s->ncheck, s->nskip, s->nclean);
+    }
+
+    dres_target_stats_free(stats);
+}
+
+
+/********************
+ * clean_count
+ ********************/
+static unsigned long
+clean_count(dres_t *dres, const char *name)
+{
+    dres_target_stats_t *stats, *s;
+    unsigned long        n;
+    int                  nstat, i;
+
+    if (dres_target_stats_get(dres, &stats, &nstat) != 0)
+        fatal(1, "failed to get target statistics");
+
+    for (i = 0, s = stats, n = 0; i < nstat; i++, s++)
+        if (!strcmp(s->name, name))
+            n = s->nclean;
+
+    dres_target_stats_free(stats);
+
+    return n;
+}
+
+
+/********************
+ * set_fact
+ ********************/
+static void
+set_fact(OhmFactStore *store, const char *var, const char *name, int value)
+{
+    OhmFact *fact;
+    GValue  *v;
+    GSList  *l;
+
+    l = ohm_fact_store_get_facts_by_name(store, var);
+    for ( ; l != NULL; l = g_slist_next(l)) {
+        fact = (OhmFact *)l->data;
+        v    = ohm_fact_get(fact, "name");
+
+        if (v != NULL && G_VALUE_HOLDS_STRING(v) &&
+            !strcmp(g_value_get_string(v), name)) {
+            ohm_fact_set(fact, "value", ohm_value_from_int(value));
+            return;
+        }
+    }
+
+    fatal(1, "no fact %s with name '%s'", var, name);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    OhmFactStore *store;
+    dres_t       *dres;
+    const char   *ruleset;
+    step_t       *step;
+    unsigned long nclean;
+    int           i, expect_propagate, propagate, status;
+
+    ruleset          = DEFAULT_RULESET;
+    expect_propagate = FALSE;
+    propagate        = TRUE;
+    nclean           = 0;
+    
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--expect-propagate"))
+            expect_propagate = TRUE;
+        else if (!strcmp(argv[i], "--no-propagate"))
+            propagate = FALSE;
+        else
+            ruleset = argv[i];
+    }
+
+#if (GLIB_MAJOR_VERSION <= 2) && (GLIB_MINOR_VERSION < 36)
+    g_type_init();
+#endif
+
+    if ((store = ohm_get_fact_store()) == NULL)
+        fatal(1, "failed to initialize factstore");
+
+    dres_set_log_level(DRES_LOG_WARNING);
+    
+    if ((dres = dres_open((char *)ruleset)) == NULL)
+        fatal(1, "failed to open ruleset '%s'", ruleset);
+    
+    if (!propagate && dres_set_propagation(dres, FALSE) != 0)
+        fatal(1, "failed to disable dirty propagation");
+    
+    if (dres_finalize(dres) != 0)
+        fatal(1, "failed to finalize ruleset '%s'", ruleset);
+
+    if (expect_propagate && dres->depends == NULL)
+        fatal(2, "no reverse dependencies for '%s'", ruleset);
+
+    for (step = script; step->name != NULL; step++) {
+        if (step->var != NULL) {
+            printf("%s[%s] = %d\n", step->var, step->name, step->value);
+            set_fact(store, step->var, step->name, step->value);
+        }
+        else {
+            if (step->clean != NULL)
+                nclean = clean_count(dres, step->clean);
+
+            status = dres_update_goal(dres, (char *)step->name, NULL);
+            printf("%s: %d\n", step->name, status);
+            dump_facts(store, dres);
+
+            if (expect_propagate && step->clean != NULL &&
+                clean_count(dres, step->clean) <= nclean)
+                fatal(2, "%s was not skipped as clean updating %s",
+                      step->clean, step->name);
+        }
+    }
+
+    dump_stats(dres);
+
+    dres_exit(dres);
+    g_object_unref(store);
+
+    return 0;
+}
+
+
+/* 
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:set expandtab shiftwidth=4:
+ */
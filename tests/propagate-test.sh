@@ -0,0 +1,14 @@
+#!/bin/sh
+
+# Run a script of fact changes and goal updates against propagate.dres
+# once checking only the targets marked dirty by the changes and once
+# checking every target and check that the results are identical.
+
+srcdir=${srcdir:-.}
+
+export DRES_NATIVE=off
+
+exec sh $srcdir/compare-test.sh propagate-test \
+    "dirty propagation and full scan" \
+    "./propagate-test --no-propagate $srcdir/propagate.dres" \
+    "./propagate-test --expect-propagate $srcdir/propagate.dres"
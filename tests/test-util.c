@@ -0,0 +1,71 @@
+/*************************************************************************
+This file is part of dres the resource policy dependency resolver.
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dres/dres.h>
+#include <ohm/ohm-fact.h>
+
+#include "test-util.h"
+
+
+/********************
+ * dump_facts
+ ********************/
+void
+dump_facts(OhmFactStore *store, dres_t *dres)
+{
+    dres_variable_t *var;
+    OhmFact         *fact;
+    GSList          *l;
+    char            *fstr;
+    int              i;
+
+    /*
+     * Notes:
+     *   Dumps every fact of every fact variable of the ruleset, in the
+     *   order of the variables and the fact store, for comparing the
+     *   fact stores of two runs textually.
+     */
+
+    for (i = 0, var = dres->factvars; i < dres->nfactvar; i++, var++) {
+        l = ohm_fact_store_get_facts_by_name(store, var->name);
+        for ( ; l != NULL; l = g_slist_next(l)) {
+            fact = (OhmFact *)l->data;
+            fstr = ohm_structure_to_string(OHM_STRUCTURE(fact));
+            printf("  %s\n", fstr ? fstr : "");
+            g_free(fstr);
+        }
+    }
+}
+
+
+/* 
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:set expandtab shiftwidth=4:
+ */
@@ -0,0 +1,54 @@
+/*************************************************************************
+This file is part of dres the resource policy dependency resolver.
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+#ifndef __DRES_TEST_UTIL_H__
+#define __DRES_TEST_UTIL_H__
+
+/*
+ * helpers shared by the differential test programs
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <dres/dres.h>
+#include <ohm/ohm-fact.h>
+
+#define fatal(ec, fmt, args...) do {                \
+        printf("fatal error: " fmt "\n", ## args);  \
+        exit(ec);                                   \
+    } while (0)
+
+
+void dump_facts(OhmFactStore *store, dres_t *dres);
+
+
+#endif /* __DRES_TEST_UTIL_H__ */
+
+
+/* 
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:set expandtab shiftwidth=4:
+ */